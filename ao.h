@@ -0,0 +1,155 @@
+/* Ambient occlusion, baked per face corner.
+
+   Each corner of a face gets darker the more of the three boxes around it
+   (in front of the face) are there: the two along its edges and the one
+   diagonally out from it. Both edges being there means it's fully in a
+   crease, no matter the diagonal. That's 0..3, where 3 is unoccluded.
+
+   It's worked out ahead of time rather than in the mesher, for every face
+   of every box, occluded or not, and kept per island. When an island
+   changes, its version log (see box.h) says which cells did, and only the
+   boxes within one cell of those get baked again. A new island, or one too
+   far behind for its log, gets baked all over. */
+
+/* the four corners of face f, 2 bits each. corner k is on the + side of
+   the face's first tangent axis if k & 1, and its second if k & 2; the
+   tangent axes are the other two of x, y, z, in that order. */
+typedef uint8_t BoxAOFace;
+
+typedef struct {
+    /* which island this was baked from, and how far along its log */
+    uint32_t uid, version;
+    /* by occupancy chunk, then box_chunk_index */
+    BoxAOFace faces[MAX_BOX_OCCS][BOX_CHUNK_SIZE * BOX_CHUNK_SIZE * BOX_CHUNK_SIZE][Face_COUNT];
+} BoxAO;
+
+/* one for each of islands[], in arena_world */
+static BoxAO *island_ao;
+
+/* a box's 3x3x3 neighborhood, bit (dx + 1) + (dy + 1) * 3 + (dz + 1) * 9 */
+static uint32_t ao_bit(int dx, int dy, int dz) {
+    return 1u << ((dx + 1) + (dy + 1) * 3 + (dz + 1) * 9);
+}
+
+/* for each face and corner, the neighborhood bits of its two edges and its diagonal */
+static uint32_t ao_sides[Face_COUNT][4][2], ao_diag[Face_COUNT][4];
+
+static void ao_init(void) {
+    for (Face f = 0; f < Face_COUNT; f++) {
+        int n[3] = { face_offset[f].x, face_offset[f].y, face_offset[f].z };
+        int u = n[0] ? 1 : 0, v = n[2] ? 1 : 2;
+        for (int k = 0; k < 4; k++) {
+            int a[3] = { n[0], n[1], n[2] }, b[3] = { n[0], n[1], n[2] };
+            a[u] = k & 1 ? 1 : -1;
+            b[v] = k & 2 ? 1 : -1;
+            ao_sides[f][k][0] = ao_bit(a[0], a[1], a[2]);
+            ao_sides[f][k][1] = ao_bit(b[0], b[1], b[2]);
+            a[v] = b[v];
+            ao_diag[f][k] = ao_bit(a[0], a[1], a[2]);
+        }
+    }
+}
+
+/* Baking goes a chunk at a time: the 3x3x3 chunks around it are looked up
+   once, and every box in it or next to it reads its neighbors straight out
+   of their bits. */
+typedef struct {
+    BoxPos pos;
+    BoxOcc *near[27];
+} AOChunks;
+
+static void ao_chunks(AOChunks *c, Island *isl, BoxPos chunk_pos) {
+    c->pos = chunk_pos;
+    for (int dz = -1; dz <= 1; dz++)
+        for (int dy = -1; dy <= 1; dy++)
+            for (int dx = -1; dx <= 1; dx++)
+                c->near[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 9] =
+                    box_occ_at(isl, add_bp(chunk_pos, (BoxPos) { dx, dy, dz }));
+}
+
+/* p has to be within a chunk of c's middle one */
+static int ao_occupied(AOChunks *c, BoxPos p) {
+    int x = p.x - c->pos.x * BOX_CHUNK_SIZE, y = p.y - c->pos.y * BOX_CHUNK_SIZE;
+    int z = p.z - c->pos.z * BOX_CHUNK_SIZE;
+    BoxOcc *chunk = c->near[((x >> 4) + 1) + ((y >> 4) + 1) * 3 + ((z >> 4) + 1) * 9];
+    return chunk && (chunk->cols[x & 15][(z & 15) >> 2] & box_occ_bit(p));
+}
+
+/* which of the boxes around p are there. away from the edges of its chunk,
+   that's three bits out of each of nine columns. */
+static uint32_t ao_around(AOChunks *c, BoxOcc *chunk, BoxPos p) {
+    /* 3 bits of a column (dy = -1..1) spread out to where they go in the neighborhood */
+    static const uint32_t spread[8] = { 0, 01, 010, 011, 0100, 0101, 0110, 0111 };
+    int x = p.x & 15, y = p.y & 15, z = p.z & 15;
+    uint32_t around = 0;
+
+    if (x > 0 && x < 15 && y > 0 && y < 15 && z > 0 && z < 15) {
+        for (int dz = -1; dz <= 1; dz++)
+            for (int dx = -1; dx <= 1; dx++) {
+                uint64_t col = chunk->cols[x + dx][(z + dz) >> 2] >> (((z + dz) & 3) * 16 + y - 1);
+                around |= spread[col & 7] << ((dx + 1) + (dz + 1) * 9);
+            }
+        return around;
+    }
+
+    for (int dz = -1; dz <= 1; dz++)
+        for (int dy = -1; dy <= 1; dy++)
+            for (int dx = -1; dx <= 1; dx++)
+                if (ao_occupied(c, add_bp(p, (BoxPos) { dx, dy, dz })))
+                    around |= ao_bit(dx, dy, dz);
+    return around;
+}
+
+/* bakes all six faces of whatever's at p, which has to be within a chunk of c's middle one */
+static void ao_bake_box(BoxAO *ao, Island *isl, AOChunks *c, BoxPos p) {
+    BoxPos cp = box_chunk_pos(p);
+    BoxOcc *chunk = c->near[(cp.x - c->pos.x + 1) + (cp.y - c->pos.y + 1) * 3 + (cp.z - c->pos.z + 1) * 9];
+    if (chunk == NULL || !(chunk->cols[p.x & 15][(p.z & 15) >> 2] & box_occ_bit(p))) return;
+
+    uint32_t around = ao_around(c, chunk, p);
+    BoxAOFace *faces = ao->faces[chunk - isl->occs][box_chunk_index(p)];
+    for (Face f = 0; f < Face_COUNT; f++) {
+        BoxAOFace corners = 0;
+        for (int k = 0; k < 4; k++) {
+            int s0 = !!(around & ao_sides[f][k][0]), s1 = !!(around & ao_sides[f][k][1]);
+            int level = s0 && s1 ? 0 : 3 - s0 - s1 - !!(around & ao_diag[f][k]);
+            corners |= (BoxAOFace) (level << (k * 2));
+        }
+        faces[f] = corners;
+    }
+}
+
+/* catches ao up with isl, which it's kept for */
+static void ao_update(BoxAO *ao, Island *isl) {
+    if (ao_sides[0][0][0] == 0) ao_init();
+    AOChunks c;
+
+    if (ao->uid != isl->uid || !box_log_has(isl, ao->version)) {
+        for (uint16_t occ = 1; occ < MAX_BOX_OCCS; occ++) if (isl->occs[occ].count) {
+            BoxOcc *chunk = isl->occs + occ;
+            ao_chunks(&c, isl, chunk->pos);
+            for (int x = 0; x < BOX_CHUNK_SIZE; x++)
+                for (int w = 0; w < BOX_CHUNK_SIZE / 4; w++)
+                    for (uint64_t bits = chunk->cols[x][w]; bits; bits &= bits - 1)
+                        ao_bake_box(ao, isl, &c, box_occ_cell(chunk, x, w, ctz64(bits)));
+        }
+    } else {
+        for (uint32_t v = ao->version; v != isl->version; v++) {
+            BoxPos changed = isl->log[v % BOX_LOG_SIZE].pos;
+            ao_chunks(&c, isl, box_chunk_pos(changed));
+            for (int dz = -1; dz <= 1; dz++)
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dx = -1; dx <= 1; dx++)
+                        ao_bake_box(ao, isl, &c, add_bp(changed, (BoxPos) { dx, dy, dz }));
+        }
+    }
+    ao->uid = isl->uid;
+    ao->version = isl->version;
+}
+
+/* which corner of face f a vertex of a unit cube at local is */
+static int ao_corner(Face f, Vec3 local) {
+    if (face_offset[f].x) return (local.y > 0.5f) | (local.z > 0.5f) << 1;
+    if (face_offset[f].y) return (local.x > 0.5f) | (local.z > 0.5f) << 1;
+    return (local.x > 0.5f) | (local.y > 0.5f) << 1;
+}
@@ -0,0 +1,140 @@
+/* Linear allocators, for memory that isn't a fixed size static array.
+
+   An arena reserves all the address space it'll ever have up front and
+   hands it out front to back, committing pages as it goes, so getting
+   memory out of one is a pointer bump and never a trip to the system
+   allocator. It all goes back at once, either by arena_reset or by
+   popping back to an earlier arena_mark.
+
+   arena_world is for things that live as long as the islands do, like
+   the lighting and AO caches. It's big, randomly accessed and never
+   freed, so if USE_LARGE_PAGES is set it asks for 2MB pages, which takes
+   the "Lock pages in memory" right; without it you just get normal pages.
+
+   arena_frame is scratch for the sim thread: reset at the top of every
+   tick, and anything that wants temporary space mid-tick pushes onto it
+   and pops back off when it's done, so it never really builds up. It's
+   not safe to use from any other thread.
+
+   Both keep their high-water mark so it can be checked they're sized
+   right (F4). */
+
+typedef struct {
+    const char *name;
+    uint64_t reserve;
+    int large_pages;
+
+    char *base;
+    uint64_t committed, used, high_water;
+} Arena;
+
+#define ARENA_ALIGN (16)
+/* committing a page at a time would make a lot of trips for big pushes */
+#define ARENA_COMMIT_CHUNK (1 << 16)
+
+static Arena arena_world = { "world", 64ull << 20, USE_LARGE_PAGES };
+static Arena arena_frame = { "frame", 16ull << 20, 0 };
+
+/* large pages need SeLockMemoryPrivilege turned on in our own token,
+   which only works if the user's been granted it in the first place */
+static int arena_enable_large_pages(void) {
+    static int tried, worked;
+    if (tried) return worked;
+    tried = 1;
+
+    if (GetLargePageMinimum() == 0) return 0;
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+        return 0;
+    TOKEN_PRIVILEGES tp = { .PrivilegeCount = 1 };
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    if (LookupPrivilegeValueW(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid))
+        /* succeeds even when it didn't assign anything, so GetLastError says which */
+        worked = AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL)
+              && GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return worked;
+}
+
+static int arena_reserve(Arena *a) {
+    if (a->large_pages && arena_enable_large_pages()) {
+        /* large pages can't be committed a bit at a time, so it's all committed now */
+        uint64_t page = GetLargePageMinimum();
+        uint64_t size = (a->reserve + page - 1) / page * page;
+        a->base = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (a->base) {
+            a->reserve = a->committed = size;
+            return 1;
+        }
+    }
+    a->large_pages = 0;
+
+    a->base = VirtualAlloc(NULL, a->reserve, MEM_RESERVE, PAGE_READWRITE);
+    if (a->base == NULL) {
+        log_win32_last_err("Couldn't reserve arena");
+        return 0;
+    }
+    return 1;
+}
+
+/* size bytes, ARENA_ALIGN aligned, or NULL if the arena's full.
+   not zeroed; see arena_push_zero. */
+static void *arena_push(Arena *a, uint64_t size) {
+    if (a->base == NULL && !arena_reserve(a)) return NULL;
+
+    uint64_t at = (a->used + ARENA_ALIGN - 1) & ~(uint64_t) (ARENA_ALIGN - 1);
+    if (at + size > a->reserve) {
+        log_err("Arena full");
+        return NULL;
+    }
+
+    if (at + size > a->committed) {
+        uint64_t to = (at + size + ARENA_COMMIT_CHUNK - 1) & ~(uint64_t) (ARENA_COMMIT_CHUNK - 1);
+        to = to < a->reserve ? to : a->reserve;
+        if (!VirtualAlloc(a->base + a->committed, to - a->committed, MEM_COMMIT, PAGE_READWRITE)) {
+            log_win32_last_err("Couldn't commit arena memory");
+            return NULL;
+        }
+        a->committed = to;
+    }
+
+    a->used = at + size;
+    if (a->used > a->high_water) a->high_water = a->used;
+    return a->base + at;
+}
+
+static void *arena_push_zero(Arena *a, uint64_t size) {
+    void *p = arena_push(a, size);
+    if (p) memset(p, 0, size);
+    return p;
+}
+
+/* where the arena's at, to pop back to once whatever's pushed after is done with */
+static uint64_t arena_mark(Arena *a) {
+    return a->used;
+}
+
+static void arena_pop(Arena *a, uint64_t mark) {
+    a->used = mark;
+}
+
+/* everything pushed is gone, but the pages stay committed for next time */
+static void arena_reset(Arena *a) {
+    a->used = 0;
+}
+
+static void arena_log(Arena *a) {
+    char buf[128];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_str(&f, a->name);
+    fmt_str(&f, " arena: ");
+    fmt_u64(&f, a->used);
+    fmt_str(&f, "B used, ");
+    fmt_u64(&f, a->high_water);
+    fmt_str(&f, "B high-water, ");
+    fmt_u64(&f, a->committed);
+    fmt_str(&f, "B of ");
+    fmt_u64(&f, a->reserve);
+    fmt_str(&f, a->large_pages ? "B committed (large pages)" : "B committed");
+    log_fmt(&f);
+}
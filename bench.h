@@ -0,0 +1,1466 @@
+/* Benchmarks. When RUN_BENCHMARKS (top of main.c) is 1, these run instead of
+   the game, and the results get logged the same way errors do, so you need a
+   debugger (or DebugView) to read them.
+
+   Things picked at compile time, like BOX_BACKEND, get compared by building
+   once for each and running again. */
+
+static int64_t bench_now_ns(void) {
+    LARGE_INTEGER qpc, freq;
+    QueryPerformanceCounter(&qpc);
+    QueryPerformanceFrequency(&freq);
+    return (int64_t) ((double) qpc.QuadPart * 1e9 / (double) freq.QuadPart);
+}
+
+/* keeps the compiler from throwing away work nothing reads */
+static volatile uint64_t bench_sink;
+
+static void bench_log(const char *what, int64_t ns, uint64_t ops) {
+    char buf[256];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_str(&f, what);
+    fmt_str(&f, ": ");
+    fmt_f32(&f, ops ? (float) ns / (float) (int64_t) ops : 0.0f, 1);
+    fmt_str(&f, "ns/op (");
+    fmt_u64(&f, ops);
+    fmt_str(&f, " ops, ");
+    fmt_f32(&f, (float) ns / 1e6f, 3);
+    fmt_str(&f, "ms)");
+    log_fmt(&f);
+}
+
+/* the shape islands tend to be: wide and flat on top, tapering underneath */
+static int bench_island_shape(BoxPos p, int radius) {
+    if (p.y > 0) return 0;
+    int r = radius + p.y * 2;
+    return r > 0 && p.x*p.x + p.z*p.z <= r*r;
+}
+
+/* grows an island out from the origin with add_box, the way a player would */
+static uint32_t bench_build_island(Island *isl, int radius) {
+    static BoxId queue[MAX_BOXES];
+    uint32_t head = 0, tail = 0;
+
+    queue[tail++] = box_insert(isl, (BoxPos) {0}, BoxKind_Dirt);
+    while (head < tail) {
+        BoxId id = queue[head++];
+        for (Face f = 0; f < Face_COUNT; f++) {
+            BoxPos np = add_bp(isl->boxes[id].pos, face_offset[f]);
+            if (!bench_island_shape(np, radius) || box_index_find(isl, np)) continue;
+
+            BoxId new_id = add_box(isl, id, f, BoxKind_Dirt);
+            if (new_id == BoxId_NULL) return tail;
+            queue[tail++] = new_id;
+        }
+    }
+    return tail;
+}
+
+static void bench_clear_boxes(Island *isl) {
+    for (BoxId id = 1; id < MAX_BOXES; id++)
+        rem_box(isl, id);
+}
+
+/* the benchmarks here all get an island to themselves, outside of islands[] */
+static Island bench_island;
+
+static void bench_box_backend(void) {
+    Island *isl = &bench_island;
+    island_clear(isl);
+    const char *backend_names[] = { "linked", "chunks", "hash", "bricks" };
+    char buf[64];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_str(&f, "box backend: ");
+    fmt_str(&f, backend_names[BOX_BACKEND]);
+    log_fmt(&f);
+
+    #define BENCH_ISLAND_RADIUS 14
+    int64_t start = bench_now_ns();
+    uint32_t count = bench_build_island(isl, BENCH_ISLAND_RADIUS);
+    bench_log("add_box", bench_now_ns() - start, count);
+
+    box_mem_log("bench island", box_mem_report(isl));
+
+    uint64_t sink = 0;
+    start = bench_now_ns();
+    for (int rep = 0; rep < 100; rep++)
+        for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id]))
+            for (Face f = 0; f < Face_COUNT; f++)
+                sink += box_neighbor(isl, id, f);
+    bench_log("box_neighbor", bench_now_ns() - start, 100ull * count * Face_COUNT);
+
+    uint32_t rng = 0x1234567;
+    #define BENCH_LOOKUPS 100000
+    start = bench_now_ns();
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        int16_t r = BENCH_ISLAND_RADIUS;
+        BoxPos p = {
+            (int16_t) (rand_u32(&rng) % (2*r + 1)) - r,
+            -(int16_t) (rand_u32(&rng) % (r / 2 + 1)),
+            (int16_t) (rand_u32(&rng) % (2*r + 1)) - r,
+        };
+        sink += box_index_find(isl, p);
+    }
+    bench_log("find by position", bench_now_ns() - start, BENCH_LOOKUPS);
+
+    start = bench_now_ns();
+    for (int rep = 0; rep < 100; rep++)
+        for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id]))
+            sink += isl->boxes[id].pos.x;
+    bench_log("iterate", bench_now_ns() - start, 100ull * count);
+
+    #define BENCH_RAYS 10000
+    start = bench_now_ns();
+    for (int i = 0; i < BENCH_RAYS; i++) {
+        Vec3 eye = vec3(rand_f(&rng) * 40.0f - 20.0f, 3.0f, rand_f(&rng) * 40.0f - 20.0f);
+        Vec3 dir = norm3(vec3(rand_f(&rng) - 0.5f, -1.0f, rand_f(&rng) - 0.5f));
+        Face face;
+        sink += box_under_ray(isl, eye, dir, &face);
+    }
+    bench_log("box_under_ray", bench_now_ns() - start, BENCH_RAYS);
+
+    start = bench_now_ns();
+    bench_clear_boxes(isl);
+    bench_log("rem_box", bench_now_ns() - start, count);
+
+    bench_sink = sink;
+}
+
+/* counting exposed faces the way the mesher does, against asking every box
+   about each of its neighbors */
+static void bench_face_extraction(void) {
+    Island *isl = &bench_island;
+    island_clear(isl);
+    bench_build_island(isl, BENCH_ISLAND_RADIUS);
+
+    #define BENCH_FACE_REPS 100
+    uint64_t by_bits = 0;
+    int64_t start = bench_now_ns();
+    for (int rep = 0; rep < BENCH_FACE_REPS; rep++)
+        for (uint16_t occ = 1; occ < MAX_BOX_OCCS; occ++) if (isl->occs[occ].count)
+            for (Face f = 0; f < Face_COUNT; f++) {
+                uint64_t exposed[BOX_CHUNK_SIZE][BOX_CHUNK_SIZE / 4];
+                box_occ_faces(isl, isl->occs + occ, f, exposed);
+                for (int x = 0; x < BOX_CHUNK_SIZE; x++)
+                    for (int w = 0; w < BOX_CHUNK_SIZE / 4; w++)
+                        for (uint64_t bits = exposed[x][w]; bits; bits &= bits - 1)
+                            by_bits++;
+            }
+    bench_log("exposed faces, occupancy bits", bench_now_ns() - start, by_bits);
+
+    uint64_t by_neighbor = 0;
+    start = bench_now_ns();
+    for (int rep = 0; rep < BENCH_FACE_REPS; rep++)
+        for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id]))
+            for (Face f = 0; f < Face_COUNT; f++)
+                by_neighbor += box_neighbor(isl, id, f) == BoxId_NULL;
+    bench_log("exposed faces, box_neighbor", bench_now_ns() - start, by_neighbor);
+
+    if (by_bits != by_neighbor)
+        log_err("Occupancy bits and box_neighbor disagree on exposed faces");
+
+    bench_clear_boxes(isl);
+}
+
+/* for meshing with; see island_geometry */
+static BoxAO bench_ao_cache;
+static BoxLight bench_light_cache;
+static Vertex bench_verts[MAX_VERTS];
+static uint32_t bench_indxs[MAX_VERTS];
+static FaceBuckets bench_buckets;
+
+/* baking ambient occlusion for a whole island, catching it up after single
+   edits, and meshing with it */
+static void bench_ao(void) {
+    Island *isl = &bench_island;
+    BoxAO *ao = &bench_ao_cache;
+    BoxLight *light = &bench_light_cache;
+    island_clear(isl);
+    isl->uid = 1;
+    uint32_t count = bench_build_island(isl, BENCH_ISLAND_RADIUS);
+
+    #define BENCH_AO_REPS 100
+    int64_t start = bench_now_ns();
+    for (int rep = 0; rep < BENCH_AO_REPS; rep++) {
+        /* looks like some other island, so it all gets baked */
+        ao->uid = 0;
+        ao_update(ao, isl);
+    }
+    bench_log("ao_update, whole island", bench_now_ns() - start, BENCH_AO_REPS * count);
+
+    int vi = 0, ii = 0;
+    light_update(light, isl);
+    start = bench_now_ns();
+    for (int rep = 0; rep < BENCH_AO_REPS; rep++) {
+        vi = ii = 0;
+        island_geometry(isl, ao, light, bench_verts, bench_indxs, &vi, &ii, &bench_buckets);
+    }
+    bench_log("island_geometry", bench_now_ns() - start, BENCH_AO_REPS * (vi / 6));
+
+    /* one edit at a time, caught up after each like a frame would */
+    #define BENCH_AO_EDITS 1000
+    uint32_t rng = 0xA0, edits = 0;
+    int64_t spent = 0;
+    while (edits < BENCH_AO_EDITS) {
+        BoxId id = (BoxId) (1 + rand_u32(&rng) % (MAX_BOXES - 1));
+        if (!OCCUPIED(isl->boxes[id]) || box_neighbor(isl, id, Face_Above)) continue;
+        if (isl->boxes[id].pos.y > 0) rem_box(isl, id);
+        else if (!add_box(isl, id, Face_Above, BoxKind_Dirt)) continue;
+        start = bench_now_ns();
+        ao_update(ao, isl);
+        spent += bench_now_ns() - start;
+        edits++;
+    }
+    bench_log("ao_update, one edit", spent, edits);
+
+    bench_clear_boxes(isl);
+}
+
+/* how much of an island's geometry its face buckets let through from
+   around it and on top of it, and whether everything they leave out really
+   is facing away */
+static void bench_face_buckets(void) {
+    Island *isl = &bench_island;
+    island_clear(isl);
+    isl->uid = 1;
+    bench_build_island(isl, BENCH_ISLAND_RADIUS);
+    bench_ao_cache.uid = 0;
+    ao_update(&bench_ao_cache, isl);
+    light_update(&bench_light_cache, isl);
+
+    int vi = 0, ii = 0;
+    FaceBuckets *b = &bench_buckets;
+    island_geometry(isl, &bench_ao_cache, &bench_light_cache, bench_verts, bench_indxs, &vi, &ii, b);
+
+    /* a ring of eyes around the island, a few above it, and one on top */
+    #define BENCH_BUCKET_EYES 25
+    Vec3 eyes[BENCH_BUCKET_EYES];
+    for (int i = 0; i < 24; i++) {
+        float a = (float) i / 24.0f * PI_f * 2.0f;
+        float r = BENCH_ISLAND_RADIUS * (i < 16 ? 2.0f : 0.5f);
+        eyes[i] = vec3(r * cosf(a), i < 8 ? -6.0f : 4.0f + (float) (i % 3), r * sinf(a));
+    }
+    eyes[24] = vec3(0.5f, 2.6f, 0.5f);
+
+    uint64_t sent = 0, facing_away = 0, wrong = 0;
+    int64_t start = bench_now_ns();
+    for (int e = 0; e < BENCH_BUCKET_EYES; e++)
+        for (Face f = 0; f < Face_COUNT; f++) {
+            uint32_t first = b->first[f];
+            uint32_t end = b->chunks ? b->end[f][b->chunks - 1] : first;
+            uint32_t visible = face_bucket_visible(b, f, eyes[e]);
+            sent += visible;
+            /* a face faces the eye if the eye's in front of its plane */
+            for (uint32_t i = first; i < end; i += 6) {
+                Vertex *v = bench_verts + bench_indxs[i];
+                int away = dot3(v->norm, sub3(eyes[e], v->pos)) <= 0.0f;
+                if (i < first + visible) facing_away += away;
+                else wrong += !away;
+            }
+        }
+    bench_log("face buckets, eyes", bench_now_ns() - start, BENCH_BUCKET_EYES);
+
+    char buf[256];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_str(&f, "face buckets: sent ");
+    fmt_f32(&f, 100.0f * (float) sent / (float) ((uint64_t) ii * BENCH_BUCKET_EYES), 1);
+    fmt_str(&f, "% of indices, ");
+    fmt_f32(&f, sent ? 100.0f * (float) (facing_away * 6) / (float) sent : 0.0f, 1);
+    fmt_str(&f, "% of those still facing away");
+    log_fmt(&f);
+
+    if (wrong)
+        log_err("Face buckets left out a face that was facing the camera");
+
+    bench_clear_boxes(isl);
+}
+
+/* lighting a whole island from scratch, and catching it up after single
+   edits, which are mostly dirt with the odd lamp */
+static void bench_light(void) {
+    Island *isl = &bench_island;
+    static BoxLight light;
+    island_clear(isl);
+    isl->uid = 1;
+    uint32_t count = bench_build_island(isl, BENCH_ISLAND_RADIUS);
+
+    #define BENCH_LIGHT_REPS 20
+    int64_t start = bench_now_ns();
+    for (int rep = 0; rep < BENCH_LIGHT_REPS; rep++) {
+        /* looks like some other island, so it all gets lit */
+        light.uid = 0;
+        light_update(&light, isl);
+    }
+    bench_log("light_update, whole island", bench_now_ns() - start, BENCH_LIGHT_REPS);
+
+    #define BENCH_LIGHT_EDITS 1000
+    uint32_t rng = 0x11, edits[2] = {0};
+    int64_t spent[2] = {0}, worst[2] = {0};
+    while (edits[0] + edits[1] < BENCH_LIGHT_EDITS) {
+        BoxId id = (BoxId) (1 + rand_u32(&rng) % (MAX_BOXES - 1));
+        if (!OCCUPIED(isl->boxes[id]) || box_neighbor(isl, id, Face_Above)) continue;
+        int lamp = 0;
+        if (isl->boxes[id].pos.y > 0) {
+            lamp = isl->boxes[id].kind == BoxKind_Lamp;
+            rem_box(isl, id);
+        } else {
+            lamp = rand_u32(&rng) % 10 == 0;
+            if (!add_box(isl, id, Face_Above, lamp ? BoxKind_Lamp : BoxKind_Dirt)) continue;
+        }
+        start = bench_now_ns();
+        light_update(&light, isl);
+        int64_t took = bench_now_ns() - start;
+        spent[lamp] += took;
+        worst[lamp] = max(worst[lamp], took);
+        edits[lamp]++;
+    }
+    bench_log("light_update, one dirt edit", spent[0], edits[0]);
+    bench_log("  worst", worst[0], 1);
+    bench_log("light_update, one lamp edit", spent[1], edits[1]);
+    bench_log("  worst", worst[1], 1);
+
+    bench_clear_boxes(isl);
+}
+
+/* scratch space off arena_frame against asking the heap for it, the way
+   raw input used to */
+static void bench_arena(void) {
+    #define BENCH_ARENA_REPS 100000
+    uint32_t rng = 99;
+    int64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_ARENA_REPS; i++) {
+        uint64_t mark = arena_mark(&arena_frame);
+        char *p = arena_push(&arena_frame, 64 + rand_u32(&rng) % 4096);
+        p[0] = (char) i;
+        bench_sink += p[0];
+        arena_pop(&arena_frame, mark);
+    }
+    bench_log("arena_push + arena_pop", bench_now_ns() - start, BENCH_ARENA_REPS);
+
+    start = bench_now_ns();
+    for (int i = 0; i < BENCH_ARENA_REPS; i++) {
+        char *p = HeapAlloc(GetProcessHeap(), 0, 64 + rand_u32(&rng) % 4096);
+        p[0] = (char) i;
+        bench_sink += p[0];
+        HeapFree(GetProcessHeap(), 0, p);
+    }
+    bench_log("HeapAlloc + HeapFree", bench_now_ns() - start, BENCH_ARENA_REPS);
+    arena_log(&arena_frame);
+}
+
+/* math.h's batch kernels against calling the scalar functions in a loop,
+   which also checks they come out the same to the bit */
+#define BENCH_MATH_N 4096
+static float bench_math_in[6][BENCH_MATH_N], bench_math_out[2][4][BENCH_MATH_N];
+
+static void bench_math_check(const char *what, float *scalar, float *batch, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++)
+        if (*(uint32_t *) (scalar + i) != *(uint32_t *) (batch + i)) {
+            log_err(what);
+            return;
+        }
+}
+
+static void bench_math(void) {
+    const char *simd_names[] = { "scalar", "sse", "avx2" };
+    char buf[64];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_str(&f, "math simd: ");
+    fmt_str(&f, simd_names[MATH_SIMD]);
+    log_fmt(&f);
+
+    uint32_t rng = 0x1234567;
+    for (int a = 0; a < 6; a++)
+        for (int i = 0; i < BENCH_MATH_N; i++)
+            bench_math_in[a][i] = rand_f(&rng) * 200.0f - 100.0f;
+    Vec3s a = { bench_math_in[0], bench_math_in[1], bench_math_in[2] };
+    Vec3s b = { bench_math_in[3], bench_math_in[4], bench_math_in[5] };
+    Vec3s scalar = { bench_math_out[0][0], bench_math_out[0][1], bench_math_out[0][2] };
+    Vec3s batch = { bench_math_out[1][0], bench_math_out[1][1], bench_math_out[1][2] };
+    float *scalar_f = bench_math_out[0][3], *batch_f = bench_math_out[1][3];
+    Mat4 m = mul4x4(translate4x4(vec3(3.0f, -2.0f, 7.0f)), rotate4x4(vec3(0.3f, 1.0f, 0.2f), 0.7f));
+
+    #define BENCH_MATH_REPS 200
+    #define BENCH_MATH(name, scalar_loop, batch_call, check) {                      \
+        int64_t start = bench_now_ns();                                               \
+        for (int rep = 0; rep < BENCH_MATH_REPS; rep++)                               \
+            for (uint32_t i = 0; i < BENCH_MATH_N; i++) { scalar_loop; }              \
+        bench_log(name ", scalar", bench_now_ns() - start, BENCH_MATH_REPS * BENCH_MATH_N); \
+        start = bench_now_ns();                                                       \
+        for (int rep = 0; rep < BENCH_MATH_REPS; rep++) { batch_call; }               \
+        bench_log(name ", batch", bench_now_ns() - start, BENCH_MATH_REPS * BENCH_MATH_N);  \
+        check;                                                                        \
+    }
+    #define BENCH_MATH_CHECK3(name) \
+        bench_math_check(name " batch doesn't match scalar", scalar.x, batch.x, BENCH_MATH_N); \
+        bench_math_check(name " batch doesn't match scalar", scalar.y, batch.y, BENCH_MATH_N); \
+        bench_math_check(name " batch doesn't match scalar", scalar.z, batch.z, BENCH_MATH_N)
+
+    BENCH_MATH("mul4x4_pos",
+        vec3s_set(scalar, i, mul4x4_pos(m, vec3s_get(a, i))),
+        mul4x4_pos_n(m, a, batch, BENCH_MATH_N),
+        BENCH_MATH_CHECK3("mul4x4_pos"));
+    BENCH_MATH("dot3",
+        scalar_f[i] = dot3(vec3s_get(a, i), vec3s_get(b, i)),
+        dot3_n(a, b, batch_f, BENCH_MATH_N),
+        bench_math_check("dot3 batch doesn't match scalar", scalar_f, batch_f, BENCH_MATH_N));
+    BENCH_MATH("cross3",
+        vec3s_set(scalar, i, cross3(vec3s_get(a, i), vec3s_get(b, i))),
+        cross3_n(a, b, batch, BENCH_MATH_N),
+        BENCH_MATH_CHECK3("cross3"));
+    BENCH_MATH("norm3",
+        vec3s_set(scalar, i, norm3(vec3s_get(a, i))),
+        norm3_n(a, batch, BENCH_MATH_N),
+        BENCH_MATH_CHECK3("norm3"));
+
+    /* boxes a chunk or so across, against the six planes of a view */
+    static uint8_t scalar_in[BENCH_MATH_N], batch_in[BENCH_MATH_N];
+    Vec3s lo = a, hi = scalar;
+    for (uint32_t i = 0; i < BENCH_MATH_N; i++)
+        hi.x[i] = lo.x[i] + fabsf(b.x[i]) * 0.16f,
+        hi.y[i] = lo.y[i] + fabsf(b.y[i]) * 0.16f,
+        hi.z[i] = lo.z[i] + fabsf(b.z[i]) * 0.16f;
+    Vec4 planes[6];
+    for (int p = 0; p < 6; p++) {
+        Vec3 n = norm3(vec3(rand_f(&rng) - 0.5f, rand_f(&rng) - 0.5f, rand_f(&rng) - 0.5f));
+        planes[p] = (Vec4) { n.x, n.y, n.z, 60.0f };
+    }
+    uint64_t visible = 0;
+    BENCH_MATH("aabb against 6 planes",
+        scalar_in[i] = 1;
+        for (int p = 0; p < 6 && scalar_in[i]; p++)
+            scalar_in[i] = (uint8_t) aabb_plane_in(planes[p], vec3s_get(lo, i), vec3s_get(hi, i)),
+        aabb_planes_n(planes, 6, lo, hi, batch_in, BENCH_MATH_N),
+        for (uint32_t i = 0; i < BENCH_MATH_N; i++) {
+            visible += batch_in[i];
+            if (scalar_in[i] != batch_in[i]) {
+                log_err("aabb_planes_n doesn't match aabb_plane_in");
+                break;
+            }
+        });
+    bench_sink = visible;
+}
+
+/* mem.h's memset/memcpy/memmove against the byte at a time loops they
+   used to be, from a few bytes up to well past the last level of cache */
+static void bench_mem(void) {
+    #define BENCH_MEM_MAX (64 << 20)
+    char *a = VirtualAlloc(NULL, BENCH_MEM_MAX + 64, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    char *b = VirtualAlloc(NULL, BENCH_MEM_MAX + 64, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!a || !b) {
+        log_err("Couldn't allocate memory to benchmark mem.h with");
+        return;
+    }
+    /* touch every page first so the first size doesn't pay for faulting them in */
+    memset(a, 1, BENCH_MEM_MAX + 64);
+    memset(b, 2, BENCH_MEM_MAX + 64);
+
+    for (uint32_t size = 16; size <= BENCH_MEM_MAX; size *= 4) {
+        /* about the same number of bytes for every size, so small ones don't get lost in the timer */
+        uint32_t reps = min(100000, max(4, (256 << 20) / size));
+        char name[64];
+
+        for (int kind = 0; kind < 6; kind++) {
+            int64_t start = bench_now_ns();
+            for (uint32_t r = 0; r < reps; r++) {
+                /* a little off of aligned, the way most copies are */
+                char *dest = a + (r & 1) * 3, *src = b + 1;
+                switch (kind) {
+                    case 0: memset(dest, (int) r, size); break;
+                    case 1: for (uint32_t i = 0; i < size; i++) dest[i] = (char) r; break;
+                    case 2: memcpy(dest, src, size); break;
+                    case 3: for (uint32_t i = 0; i < size; i++) dest[i] = src[i]; break;
+                    case 4: memmove(dest, dest + 8, size); break;
+                    case 5: for (uint32_t i = 0; i < size; i++) dest[i] = dest[i + 8]; break;
+                }
+            }
+            int64_t took = bench_now_ns() - start;
+            bench_sink = a[size / 2];
+
+            const char *kind_names[] = {
+                "memset", "memset, bytes", "memcpy", "memcpy, bytes", "memmove", "memmove, bytes"
+            };
+            Fmt f = { name, 0, sizeof(name) };
+            fmt_str(&f, kind_names[kind]);
+            fmt_str(&f, ", ");
+            fmt_u64(&f, size);
+            fmt_str(&f, "B");
+            name[min(f.len, sizeof(name) - 1)] = '\0';
+            bench_log(name, took, reps);
+        }
+    }
+
+    VirtualFree(a, 0, MEM_RELEASE);
+    VirtualFree(b, 0, MEM_RELEASE);
+}
+
+/* the island broadphase (see bvh.h), with far more islands than MAX_ISLANDS
+   all drifting around, against just checking every one of them */
+#define BENCH_BVH_LEAVES 4096
+static BvhNode bench_bvh_nodes[BENCH_BVH_LEAVES * 2];
+
+static void bench_broadphase(void) {
+    static Aabb boxes[BENCH_BVH_LEAVES];
+    static uint16_t leaves[BENCH_BVH_LEAVES];
+    static uint32_t found[BENCH_BVH_LEAVES];
+    static Vec3 vel[BENCH_BVH_LEAVES];
+    uint32_t rng = 0x1234567;
+    Bvh tree;
+    bvh_init(&tree, bench_bvh_nodes, _countof(bench_bvh_nodes));
+
+    /* island sized, spread out over a couple of kilometers */
+    int64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_BVH_LEAVES; i++) {
+        Vec3 c = vec3(rand_f(&rng) * 2000.0f, rand_f(&rng) * 200.0f, rand_f(&rng) * 2000.0f);
+        Vec3 half = vec3(4.0f + rand_f(&rng) * 12.0f, 2.0f + rand_f(&rng) * 6.0f, 4.0f + rand_f(&rng) * 12.0f);
+        boxes[i] = (Aabb) { sub3(c, half), add3(c, half) };
+        vel[i] = vec3(rand_f(&rng) * 0.2f - 0.1f, rand_f(&rng) * 0.04f - 0.02f, rand_f(&rng) * 0.2f - 0.1f);
+        leaves[i] = bvh_insert(&tree, boxes[i], (uint32_t) i);
+    }
+    bench_log("bvh_insert", bench_now_ns() - start, BENCH_BVH_LEAVES);
+
+    #define BENCH_BVH_TICKS 100
+    #define BENCH_BVH_QUERIES 64
+    uint64_t sink = 0, reinserted = 0, hits = 0, brute_hits = 0;
+    int64_t refit_ns = 0, query_ns = 0, brute_ns = 0;
+    for (int tick = 0; tick < BENCH_BVH_TICKS; tick++) {
+        start = bench_now_ns();
+        for (int i = 0; i < BENCH_BVH_LEAVES; i++) {
+            boxes[i] = (Aabb) { add3(boxes[i].lo, vel[i]), add3(boxes[i].hi, vel[i]) };
+            reinserted += bvh_move(&tree, leaves[i], boxes[i]);
+        }
+        refit_ns += bench_now_ns() - start;
+
+        /* a player's worth of box, somewhere out there */
+        Aabb queries[BENCH_BVH_QUERIES];
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++) {
+            Vec3 p = vec3(rand_f(&rng) * 2000.0f, rand_f(&rng) * 200.0f, rand_f(&rng) * 2000.0f);
+            queries[q] = (Aabb) { add3_f(p, -0.4f), add3_f(p, 0.4f) };
+        }
+
+        start = bench_now_ns();
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++)
+            hits += bvh_query(&tree, queries[q], found, BENCH_BVH_LEAVES);
+        query_ns += bench_now_ns() - start;
+
+        start = bench_now_ns();
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++)
+            for (int i = 0; i < BENCH_BVH_LEAVES; i++)
+                brute_hits += aabb_overlaps(boxes[i], queries[q]);
+        brute_ns += bench_now_ns() - start;
+    }
+    bench_log("bvh_move, every leaf every tick", refit_ns, (uint64_t) BENCH_BVH_TICKS * BENCH_BVH_LEAVES);
+    char buf[64];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_str(&f, "  put back in: ");
+    fmt_u64(&f, reinserted);
+    log_fmt(&f);
+    bench_log("bvh_query", query_ns, (uint64_t) BENCH_BVH_TICKS * BENCH_BVH_QUERIES);
+    bench_log("checking every leaf", brute_ns, (uint64_t) BENCH_BVH_TICKS * BENCH_BVH_QUERIES);
+    /* the tree's leaves are fattened, so it can only find more */
+    if (hits < brute_hits)
+        log_err("bvh_query missed leaves checking every one found");
+
+    sink += found[0];
+    bench_sink = sink;
+}
+
+/* sweeping a player sized box around on the bench island, the way
+   player_physics does every tick: mostly walking, some of it falling fast */
+static void bench_sweep(void) {
+    Island *isl = island_alloc();
+    bench_build_island(isl, BENCH_ISLAND_RADIUS);
+    uint32_t rng = 0x1234567;
+
+    #define BENCH_SWEEPS 100000
+    Vec3 sink = {0};
+    uint64_t stopped = 0;
+    int64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_SWEEPS; i++) {
+        Vec3 p = vec3(rand_f(&rng) * 30.0f - 15.0f, 1.0f, rand_f(&rng) * 30.0f - 15.0f);
+        Aabb box = { vec3(p.x - 0.3f, p.y, p.z - 0.3f), vec3(p.x + 0.3f, p.y + 1.8f, p.z + 0.3f) };
+        Vec3 move = i % 8 ? vec3(rand_f(&rng) * 0.2f - 0.1f, -0.03f, rand_f(&rng) * 0.2f - 0.1f)
+                          : vec3(0.0f, -rand_f(&rng) * 20.0f, 0.0f);
+        IslandStops stops;
+        sink = add3(sink, island_sweep(box, move, &stops));
+        stopped += stops.count;
+    }
+    bench_log("island_sweep", bench_now_ns() - start, BENCH_SWEEPS);
+    if (stopped < BENCH_SWEEPS / 2)
+        log_err("Bench sweeps didn't land on the bench island");
+
+    bench_sink = (uint64_t) sink.x;
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+}
+
+/* BENCH_ENTITIES bodies dropped onto the bench island, half player sized
+   and half dropped box sized, stepped on one thread and then on all of
+   them, which have to end up in exactly the same place */
+#define BENCH_ENTITIES 10000
+#define BENCH_ENTITY_TICKS 100
+static void bench_entity_spawn(void) {
+    uint32_t rng = 0x7654321;
+    entities.count = 0;
+    for (int i = 0; i < BENCH_ENTITIES; i++) {
+        Vec3 p = vec3(rand_f(&rng) * 30.0f - 15.0f, rand_f(&rng) * 8.0f, rand_f(&rng) * 30.0f - 15.0f);
+        if (i & 1) entity_spawn(p, 0.3f, 1.8f);
+        else       entity_spawn(p, 0.125f, 0.25f);
+    }
+}
+
+static void bench_entities(void) {
+    Island *isl = island_alloc();
+    bench_build_island(isl, BENCH_ISLAND_RADIUS);
+
+    uint64_t hash[2];
+    for (int parallel = 0; parallel < 2; parallel++) {
+        bench_entity_spawn();
+        int64_t start = bench_now_ns();
+        for (int t = 0; t < BENCH_ENTITY_TICKS; t++)
+            entity_step(parallel);
+        bench_log(parallel ? "entity_step, all cores" : "entity_step, one core",
+                  bench_now_ns() - start, (uint64_t) BENCH_ENTITIES * BENCH_ENTITY_TICKS);
+        hash[parallel] = entity_hash(0);
+    }
+    if (hash[0] != hash[1])
+        log_err("Stepping entities in parallel came out different");
+
+    uint32_t grounded = 0;
+    for (uint32_t i = 0; i < entities.count; i++)
+        grounded += entities.ground_cooldown[i] < 0;
+    if (grounded < BENCH_ENTITIES / 4)
+        log_err("Bench entities didn't land on the bench island");
+
+    entities.count = 0;
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+}
+
+/* a bulk carve's worth of debris, topped up to BENCH_PARTICLES, stepped
+   for long enough that most of it's landed but none of it's gone yet */
+#define BENCH_PARTICLES 100000
+#define BENCH_PARTICLE_TICKS 50
+static void bench_particles(void) {
+    Island *isl = island_alloc();
+    bench_build_island(isl, BENCH_ISLAND_RADIUS);
+
+    particles.count = 0;
+    BoxShape s = box_shape_sphere((BoxPos) { .y = -2 }, 8);
+    particle_burst_shape(&s);
+    island_carve(&s);
+    uint32_t from_carve = particles.count;
+    /* the rest rains down on what's left */
+    uint32_t rng = 0xD1257;
+    while (particles.count < BENCH_PARTICLES) {
+        BoxPos p = { (int16_t) (rand_u32(&rng) % 29) - 14, 2 + rand_u32(&rng) % 4, (int16_t) (rand_u32(&rng) % 29) - 14 };
+        particle_burst(isl, p, BoxKind_Dirt, min(PARTICLE_BURST, BENCH_PARTICLES - particles.count));
+    }
+    uint32_t count = particles.count;
+
+    int64_t start = bench_now_ns();
+    for (int t = 0; t < BENCH_PARTICLE_TICKS; t++)
+        particle_step();
+    int64_t ns = bench_now_ns() - start;
+    bench_log("particle_step", ns, (uint64_t) count * BENCH_PARTICLE_TICKS);
+
+    static ParticleInstance out[MAX_PARTICLES];
+    start = bench_now_ns();
+    bench_sink = particle_instances(out);
+    bench_log("particle_instances", bench_now_ns() - start, particles.count);
+
+    char buf[128];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_u64(&f, from_carve);
+    fmt_str(&f, " particles from the carve, ");
+    fmt_f32(&f, (float) ns / 1e6f / BENCH_PARTICLE_TICKS, 3);
+    fmt_str(&f, "ms a tick for ");
+    fmt_u64(&f, count);
+    log_fmt(&f);
+    if (particles.count != count)
+        log_err("Bench particles died before they were supposed to");
+
+    particles.count = 0;
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+}
+
+/* readers going over every published view as fast as they can while the
+   island underneath gets edited and republished, checking that every view
+   they see agrees with itself. one that got reused while it was being read
+   wouldn't, at least not for long. */
+#define BENCH_EPOCH_READERS 3
+#define BENCH_EPOCH_TICKS 2000
+static volatile LONG bench_epoch_stop, bench_epoch_running, bench_epoch_reads, bench_epoch_bad;
+
+static int bench_epoch_check(BoxView *v) {
+    uint32_t count = 0;
+    for (int x = 0; x < BOX_CHUNK_SIZE; x++)
+        for (int w = 0; w < BOX_CHUNK_SIZE / 4; w++)
+            for (uint32_t bit = 0; bit < 64; bit++) {
+                BoxPos p = { x, bit & 15, w * 4 + (bit >> 4) };
+                int occupied = (v->cols[x][w] >> bit) & 1;
+                if (occupied != (v->kinds[box_chunk_index(p)] != BoxKind_Unoccupied)) return 0;
+                count += occupied;
+            }
+    return count == v->count && count > 0;
+}
+
+static DWORD WINAPI bench_epoch_reader(LPVOID arg) {
+    uint32_t r = epoch_join();
+    while (r < EPOCH_MAX_READERS && !InterlockedCompareExchange(&bench_epoch_stop, 0, 0)) {
+        epoch_pin(r);
+        for (uint32_t i = 0; i < MAX_ISLANDS; i++) {
+            BoxViewSet *s = box_view_set(i);
+            for (uint16_t v = 0; s && v < s->count; v++)
+                if (!bench_epoch_check(s->views[v]) || box_view_chunk(s, s->views[v]->pos) != s->views[v])
+                    InterlockedIncrement(&bench_epoch_bad);
+        }
+        epoch_unpin(r);
+        InterlockedIncrement(&bench_epoch_reads);
+    }
+    InterlockedDecrement(&bench_epoch_running);
+    return 0;
+}
+
+static void bench_epoch(void) {
+    Island *isl = island_alloc();
+    /* smaller than the usual, so there's room for it to grow */
+    bench_build_island(isl, BENCH_ISLAND_RADIUS - 4);
+
+    bench_epoch_stop = bench_epoch_reads = bench_epoch_bad = 0;
+    bench_epoch_running = BENCH_EPOCH_READERS;
+    for (int t = 0; t < BENCH_EPOCH_READERS; t++)
+        if (CreateThread(NULL, 0, bench_epoch_reader, NULL, 0, NULL) == NULL) {
+            log_win32_last_err("Couldn't start a bench reader");
+            InterlockedDecrement(&bench_epoch_running);
+        }
+
+    uint32_t rng = 0xE90C;
+    int64_t publish_ns = 0;
+    for (int t = 0; t < BENCH_EPOCH_TICKS; t++) {
+        /* columns going up and down, same as bench_net, and every so often
+           a hole knocked in the bottom and filled back in, which splits
+           bits off and merges them back */
+        for (int e = 0; e < 8; e++) {
+            BoxId id = (BoxId) (1 + rand_u32(&rng) % (MAX_BOXES - 1));
+            if (!OCCUPIED(isl->boxes[id]) || box_neighbor(isl, id, Face_Above)) continue;
+            if (rand_u32(&rng) % 2) island_add_box(isl, id, Face_Above, BoxKind_Lamp);
+            else if (isl->boxes[id].pos.y > 0) island_rem_box(isl, id);
+        }
+        if (t % 100 == 50) {
+            BoxShape s = box_shape_sphere((BoxPos) { (int16_t) (t / 200 % 9) - 4, -5, 0 }, 3);
+            if (t % 200 == 50) island_carve(&s);
+            else island_fill(&s, BoxKind_Dirt);
+        }
+        for (int i = 0; i < MAX_ISLANDS && !island_used[isl - islands]; i++)
+            if (island_used[i]) isl = islands + i;
+
+        int64_t start = bench_now_ns();
+        box_view_publish();
+        publish_ns += bench_now_ns() - start;
+    }
+
+    InterlockedExchange(&bench_epoch_stop, 1);
+    while (InterlockedCompareExchange(&bench_epoch_running, 0, 0)) YieldProcessor();
+    bench_log("box_view_publish", publish_ns, BENCH_EPOCH_TICKS);
+
+    char buf[128];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_u64(&f, (uint64_t) bench_epoch_reads);
+    fmt_str(&f, " reads of every island alongside, ");
+    fmt_u64(&f, epoch.retired_count);
+    fmt_str(&f, " retired still waiting");
+    log_fmt(&f);
+    if (bench_epoch_bad) log_err("A reader saw a box view change underneath it");
+
+    /* and what ended up published is what's there */
+    for (uint32_t i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+        BoxViewSet *s = box_view_set(i);
+        uint32_t count = 0;
+        /* none if no reader ever got going */
+        if (s == NULL) continue;
+        for (uint16_t v = 0; v < s->count; v++) count += s->views[v]->count;
+        int same = count == islands[i].box_count;
+        for (BoxId id = 1; id < MAX_BOXES && same; id++) if (OCCUPIED(islands[i].boxes[id]))
+            same = box_view_kind(s, islands[i].boxes[id].pos) == islands[i].boxes[id].kind;
+        if (!same) log_err("Box views don't match the island they're of");
+    }
+
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+    box_view_publish();
+}
+
+/* the same island with its boxes strewn all over the arena, then compacted.
+   everything that walks the arena by id gets timed both ways. */
+#define BENCH_COMPACT_REPS 100
+static void bench_compact_walk(Island *isl, int64_t ns[4]) {
+    uint64_t sink = 0;
+    int64_t start = bench_now_ns();
+    for (int rep = 0; rep < BENCH_COMPACT_REPS; rep++)
+        for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id]))
+            sink += isl->boxes[id].pos.x + isl->boxes[id].kind;
+    ns[0] = bench_now_ns() - start;
+
+    /* flood fills from box to neighbor, like a split check */
+    static BoxId queue[MAX_BOXES];
+    static uint16_t seen[MAX_BOXES];
+    memset(seen, 0, sizeof(seen));
+    start = bench_now_ns();
+    for (uint16_t rep = 1; rep <= BENCH_COMPACT_REPS; rep++)
+        for (BoxId first = 1; first < MAX_BOXES; first++) {
+            if (!OCCUPIED(isl->boxes[first]) || seen[first] == rep) continue;
+            uint32_t head = 0, tail = 0;
+            seen[first] = rep;
+            queue[tail++] = first;
+            while (head < tail) {
+                BoxId id = queue[head++];
+                for (Face f = 0; f < Face_COUNT; f++) {
+                    BoxId n = box_neighbor(isl, id, f);
+                    if (n == BoxId_NULL || seen[n] == rep) continue;
+                    seen[n] = rep;
+                    queue[tail++] = n;
+                }
+            }
+            sink += tail;
+        }
+    ns[1] = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (int rep = 0; rep < BENCH_COMPACT_REPS / 10; rep++)
+        for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id]))
+            sink += box_index_find(isl, isl->boxes[id].pos);
+    ns[2] = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (int rep = 0; rep < BENCH_COMPACT_REPS; rep++) {
+        int vi = 0, ii = 0;
+        island_geometry(isl, &bench_ao_cache, &bench_light_cache, bench_verts, bench_indxs, &vi, &ii,
+                        &bench_buckets);
+        sink += vi;
+    }
+    ns[3] = bench_now_ns() - start;
+    bench_sink = sink;
+}
+
+static void bench_compact(void) {
+    Island *isl = island_alloc();
+    /* small enough that it fits twice over */
+    uint32_t count = bench_build_island(isl, BENCH_ISLAND_RADIUS - 4);
+
+    /* take everything out, and put it back in a random order with a junk
+       box after each one, then take the junk out, which leaves the island
+       spread over twice the arena with a hole in between every box */
+    static Box saved[MAX_BOXES];
+    uint32_t n = 0;
+    for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id])) {
+        saved[n++] = isl->boxes[id];
+        rem_box(isl, id);
+    }
+    uint32_t rng = 0xC0FFEE;
+    for (uint32_t i = n - 1; i > 0; i--) {
+        uint32_t j = rand_u32(&rng) % (i + 1);
+        Box t = saved[i];
+        saved[i] = saved[j];
+        saved[j] = t;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        box_insert(isl, saved[i].pos, saved[i].kind);
+        box_insert(isl, (BoxPos) { 100 + (i & 15), 100 + ((i >> 4) & 15), (int16_t) (i >> 8) }, BoxKind_Dirt);
+    }
+    for (BoxId id = 1; id < MAX_BOXES; id++)
+        if (OCCUPIED(isl->boxes[id]) && isl->boxes[id].pos.x >= 100) rem_box(isl, id);
+    uint64_t hash = replay_world_hash();
+
+    bench_ao_cache.uid = bench_light_cache.uid = 0;
+    ao_update(&bench_ao_cache, isl);
+    light_update(&bench_light_cache, isl);
+    int64_t before[4], after[4];
+    bench_compact_walk(isl, before);
+
+    uint32_t slices = 0;
+    int64_t spent = 0, worst = 0;
+    for (int done = 0; !done; slices++) {
+        int64_t start = bench_now_ns();
+        done = island_compact_step(ISLAND_COMPACT_BUDGET);
+        int64_t took = bench_now_ns() - start;
+        spent += took;
+        worst = max(worst, took);
+    }
+    bench_log("island_compact_step", spent, slices);
+    bench_log("  worst", worst, 1);
+
+    /* same boxes, linked up the same, packed in by morton code */
+    int ok = replay_world_hash() == hash;
+    uint64_t last = 0;
+    for (BoxId id = 1; id <= count && ok; id++) {
+        ok = OCCUPIED(isl->boxes[id]) && box_morton(isl->boxes[id].pos) > last;
+        last = box_morton(isl->boxes[id].pos);
+        for (Face f = 0; f < Face_COUNT && ok; f++) {
+            BoxPos np = add_bp(isl->boxes[id].pos, face_offset[f]);
+            BoxId nb = box_neighbor(isl, id, f);
+            ok = nb ? eq_bp(isl->boxes[nb].pos, np) : !box_occupied(isl, np);
+        }
+    }
+    if (!ok) log_err("Compacting the island broke it");
+
+    bench_compact_walk(isl, after);
+    const char *what[4] = { "iterate", "neighbor flood fill", "find by position", "island_geometry" };
+    for (int i = 0; i < 4; i++) {
+        char buf[128];
+        Fmt f = { buf, 0, sizeof(buf) };
+        fmt_str(&f, what[i]);
+        fmt_str(&f, ", strewn ");
+        fmt_f32(&f, (float) before[i] / 1e6f, 3);
+        fmt_str(&f, "ms, compacted ");
+        fmt_f32(&f, (float) after[i] / 1e6f, 3);
+        fmt_str(&f, "ms (");
+        fmt_f32(&f, (float) before[i] / (float) max(after[i], 1), 2);
+        fmt_str(&f, "x)");
+        log_fmt(&f);
+    }
+
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+}
+
+/* grass creeping out over the top of an island from the middle; then a
+   burst of scheduled updates, more than a tick's budget, with the island
+   compacted before they're due so every id they were scheduled with has
+   moved; then a box put down on some grass, which should smother it */
+static void bench_updates(void) {
+    Island *isl = island_alloc();
+    bench_build_island(isl, BENCH_ISLAND_RADIUS);
+    uint32_t top = 0;
+    for (BoxId id = 1; id < MAX_BOXES; id++)
+        top += OCCUPIED(isl->boxes[id]) && !box_neighbor(isl, id, Face_Above);
+    BoxId middle = box_index_find(isl, (BoxPos) {0});
+    box_set_kind(isl, middle, BoxKind_Grass);
+
+    /* nothing but spreading changes the island, so its version counts grass */
+    #define BENCH_UPDATE_TICKS 1000000
+    uint32_t ticks = 0, grass = 1;
+    int64_t start = bench_now_ns();
+    for (; ticks < BENCH_UPDATE_TICKS && grass < top; ticks++) {
+        arena_reset(&arena_frame);
+        uint32_t version = isl->version;
+        update_tick();
+        grass += isl->version - version;
+    }
+    bench_log("update_tick, grass spreading", bench_now_ns() - start, ticks);
+
+    char buf[128];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_str(&f, "grass covered ");
+    fmt_u64(&f, grass);
+    fmt_str(&f, " of ");
+    fmt_u64(&f, top);
+    fmt_str(&f, " boxes in ");
+    fmt_f32(&f, (float) ticks / SIM_HZ, 1);
+    fmt_str(&f, "s");
+    log_fmt(&f);
+    if (grass < top) log_err("Grass didn't make it over the whole island");
+
+    uint32_t n = 0;
+    for (int rep = 0; n + top < UPDATE_MAX_SCHEDULED - 1; rep++)
+        for (BoxId id = 1; id < MAX_BOXES; id++)
+            if (isl->boxes[id].kind == BoxKind_Grass) {
+                update_schedule(isl, id, 1);
+                n++;
+            }
+    while (!island_compact_step(ISLAND_COMPACT_BUDGET));
+
+    uint64_t ran = updates.ran_scheduled, dropped = updates.dropped;
+    uint32_t most = 0;
+    ticks = 0;
+    start = bench_now_ns();
+    while (updates.scheduled) {
+        arena_reset(&arena_frame);
+        uint64_t before = updates.ran_scheduled;
+        update_tick();
+        most = max(most, (uint32_t) (updates.ran_scheduled - before));
+        ticks++;
+    }
+    bench_log("update_tick, scheduled burst", bench_now_ns() - start, updates.ran_scheduled - ran);
+    if (updates.ran_scheduled - ran != n || updates.dropped != dropped)
+        log_err("Scheduled updates lost track of their boxes");
+    if (most > UPDATE_BUDGET)
+        log_err("Scheduled updates went over budget");
+
+    middle = box_index_find(isl, (BoxPos) {0});
+    add_box(isl, middle, Face_Above, BoxKind_Dirt);
+    for (ticks = 0; ticks < BENCH_UPDATE_TICKS && isl->boxes[middle].kind == BoxKind_Grass; ticks++) {
+        arena_reset(&arena_frame);
+        update_tick();
+    }
+    if (isl->boxes[middle].kind == BoxKind_Grass)
+        log_err("Covered grass never turned back into dirt");
+
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+    memset(updates.wheel, 0, sizeof(updates.wheel));
+    updates.free_count = updates.scheduled = 0;
+    updates.next = 1;
+}
+
+/* A walled basin with a block of water hanging over it and a block of sand
+   over that, let go, and stepped until nothing's moving. */
+#define BENCH_FLUID_TICKS 10000
+static Island *bench_fluid_basin(void) {
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+    Island *isl = island_alloc();
+    BoxShape floor = box_shape_aabb((BoxPos) { -10, 0, -10 }, (BoxPos) { 9, 0, 9 });
+    BoxShape walls[4] = {
+        box_shape_aabb((BoxPos) { -10, 1, -10 }, (BoxPos) {  9, 5, -10 }),
+        box_shape_aabb((BoxPos) { -10, 1,   9 }, (BoxPos) {  9, 5,   9 }),
+        box_shape_aabb((BoxPos) { -10, 1,  -9 }, (BoxPos) { -10, 5,  8 }),
+        box_shape_aabb((BoxPos) {   9, 1,  -9 }, (BoxPos) {  9, 5,   8 }),
+    };
+    BoxShape water = box_shape_aabb((BoxPos) { -6, 8, -6 }, (BoxPos) { 5, 14, 5 });
+    BoxShape sand = box_shape_aabb((BoxPos) { -3, 15, -3 }, (BoxPos) { 2, 21, 2 });
+    box_fill(isl, &floor, BoxKind_Dirt);
+    for (int w = 0; w < 4; w++) box_fill(isl, walls + w, BoxKind_Dirt);
+    box_fill(isl, &water, BoxKind_Water);
+    box_fill(isl, &sand, BoxKind_Sand);
+    return isl;
+}
+
+/* steps until there's nothing active, returning how many ticks that took,
+   and how long they did and the worst of them took */
+static uint32_t bench_fluid_settle(int parallel, int64_t *ns, int64_t *worst) {
+    uint32_t ticks = 0;
+    *ns = *worst = 0;
+    for (; ticks < BENCH_FLUID_TICKS; ticks++) {
+        arena_reset(&arena_frame);
+        int64_t start = bench_now_ns();
+        fluid_tick(parallel);
+        int64_t took = bench_now_ns() - start;
+        *ns += took;
+        *worst = max(*worst, took);
+        /* shuffles ids out from under the active list, like it would in game */
+        island_tick();
+        if (fluid.count[fluid.cur] == 0 && fluid.wake_count == 0) break;
+    }
+    return ticks + 1;
+}
+
+/* where every loose box is, in any order */
+static uint64_t bench_fluid_hash(Island *isl, uint32_t *count) {
+    uint64_t h = 0;
+    *count = 0;
+    for (BoxId id = 1; id < MAX_BOXES; id++) if (LOOSE(isl->boxes[id])) {
+        uint64_t k = (box_morton(isl->boxes[id].pos) << 3 | isl->boxes[id].kind) * 0x9E3779B97F4A7C15ull;
+        h += k ^ (k >> 31);
+        (*count)++;
+    }
+    return h;
+}
+
+/* the basin flooded with every core and then again with just one, which
+   has to come out the same; then a hole knocked in the floor for it to
+   drain out of */
+static void bench_fluid(void) {
+    uint32_t start_tick = fluid.tick, loose = 0, left = 0;
+    int64_t ns, worst;
+    fluid_reset();
+    Island *isl = bench_fluid_basin();
+    bench_fluid_hash(isl, &loose);
+    uint64_t looked_at = fluid.looked_at, moves = fluid.moves;
+    uint32_t ticks = bench_fluid_settle(1, &ns, &worst);
+    bench_log("fluid_tick, flood", ns, ticks);
+    bench_log("  worst tick", worst, 1);
+    bench_log("  per cell looked at", ns, fluid.looked_at - looked_at);
+
+    char buf[256];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_u64(&f, loose);
+    fmt_str(&f, " water and sand settled in ");
+    fmt_u64(&f, ticks);
+    fmt_str(&f, " ticks (");
+    fmt_f32(&f, (float) ticks / SIM_HZ, 1);
+    fmt_str(&f, "s), ");
+    fmt_u64(&f, fluid.moves - moves);
+    fmt_str(&f, " moves, looking at ");
+    fmt_f32(&f, 100.0f * (float) (fluid.looked_at - looked_at) / ((float) loose * ticks), 1);
+    fmt_str(&f, "% of the cells stepping all of them would");
+    log_fmt(&f);
+
+    uint64_t parallel_hash = bench_fluid_hash(isl, &left);
+    if (left != loose) log_err("Water or sand got out of the basin");
+    if (ticks > BENCH_FLUID_TICKS) log_err("The flood never settled");
+
+    /* everything wakes up, and nothing should have anywhere to go */
+    fluid_reset();
+    moves = fluid.moves;
+    arena_reset(&arena_frame);
+    fluid_tick(1);
+    if (fluid.moves != moves || fluid.count[fluid.cur])
+        log_err("Settled water or sand could still move");
+
+    fluid_reset();
+    fluid.tick = start_tick;
+    isl = bench_fluid_basin();
+    ticks = bench_fluid_settle(0, &ns, &worst);
+    bench_log("fluid_tick, flood, one chunk at a time", ns, ticks);
+    if (bench_fluid_hash(isl, &left) != parallel_hash)
+        log_err("Flooding in parallel came out different");
+
+    BoxShape hole = box_shape_aabb((BoxPos) { -1, 0, -1 }, (BoxPos) { 0, 0, 0 });
+    box_carve(isl, &hole);
+    uint64_t fell = fluid.fell;
+    looked_at = fluid.looked_at;
+    ticks = bench_fluid_settle(1, &ns, &worst);
+    bench_log("fluid_tick, draining", ns, ticks);
+    bench_fluid_hash(isl, &left);
+
+    f.len = 0;
+    fmt_u64(&f, fluid.fell - fell);
+    fmt_str(&f, " drained out in ");
+    fmt_u64(&f, ticks);
+    fmt_str(&f, " ticks, ");
+    fmt_u64(&f, left);
+    fmt_str(&f, " left sitting on the floor");
+    log_fmt(&f);
+    if (fluid.fell == fell || left + (fluid.fell - fell) != loose)
+        log_err("The basin didn't drain right");
+
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+    fluid_reset();
+}
+
+/* cuts the island in two one box at a time, by taking out a layer of it,
+   then fills the layer back in. every edit along the way has to check for
+   a split or a merge. */
+static void bench_island_edits(void) {
+    Island *isl = island_alloc();
+    uint32_t count = bench_build_island(isl, BENCH_ISLAND_RADIUS);
+
+    BoxPos cut[MAX_BOXES];
+    uint32_t cut_count = 0;
+    int64_t start = bench_now_ns(), worst = 0;
+    for (BoxId id = 1; id < MAX_BOXES; id++)
+        if (OCCUPIED(isl->boxes[id]) && isl->boxes[id].pos.y == -3) {
+            cut[cut_count++] = isl->boxes[id].pos;
+            int64_t edit = bench_now_ns();
+            island_rem_box(isl, id);
+            worst = max(worst, bench_now_ns() - edit);
+        }
+    while (!island_split_step(ISLAND_SPLIT_BUDGET));
+    bench_log("island_rem_box, cutting", bench_now_ns() - start, cut_count);
+    bench_log("  worst edit", worst, 1);
+
+    int pieces = 0;
+    for (int i = 0; i < MAX_ISLANDS; i++) pieces += island_used[i];
+    if (pieces != 2)
+        log_err("Cutting the bench island didn't leave two islands");
+
+    /* the layer above is wider, so every box has something to go under */
+    start = bench_now_ns();
+    worst = 0;
+    for (uint32_t i = 0; i < cut_count; i++) {
+        BoxPos above = add_bp(cut[i], face_offset[Face_Above]);
+        Island *onto = island_at(above);
+        int64_t edit = bench_now_ns();
+        island_add_box(onto, box_index_find(onto, above), Face_Below, BoxKind_Dirt);
+        worst = max(worst, bench_now_ns() - edit);
+    }
+    bench_log("island_add_box, rejoining", bench_now_ns() - start, cut_count);
+    bench_log("  worst edit", worst, 1);
+
+    pieces = 0;
+    for (int i = 0; i < MAX_ISLANDS; i++) pieces += island_used[i];
+    if (pieces != 1 || island_at((BoxPos) {0})->box_count != count)
+        log_err("Rejoining the bench island didn't leave it whole");
+
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+}
+
+/* filling and carving a chunk of boxes in one go, against doing the same
+   thing a box at a time */
+static void bench_bulk_edits(void) {
+    Island *isl = &bench_island;
+    BoxShape slab = box_shape_aabb((BoxPos) { -8, -4, -8 }, (BoxPos) { 7, -1, 7 });
+    BoxShape ball = box_shape_sphere((BoxPos) { 0, -2, 0 }, 5);
+
+    #define BENCH_BULK_REPS 10
+    int64_t one_fill = 0, bulk_fill = 0, one_carve = 0, bulk_carve = 0;
+    uint32_t filled = 0, carved = 0;
+    for (int rep = 0; rep < BENCH_BULK_REPS; rep++) {
+        island_clear(isl);
+        int64_t start = bench_now_ns();
+        for (int16_t x = slab.lo.x; x <= slab.hi.x; x++)
+            for (int16_t z = slab.lo.z; z <= slab.hi.z; z++)
+                for (int16_t y = slab.lo.y; y <= slab.hi.y; y++)
+                    box_insert(isl, (BoxPos) { x, y, z }, BoxKind_Dirt);
+        one_fill += bench_now_ns() - start;
+
+        start = bench_now_ns();
+        for (int16_t x = ball.lo.x; x <= ball.hi.x; x++)
+            for (int16_t z = ball.lo.z; z <= ball.hi.z; z++)
+                for (int16_t y = ball.lo.y; y <= ball.hi.y; y++) {
+                    BoxPos p = { x, y, z };
+                    if (box_shape_has(&ball, p)) rem_box(isl, box_index_find(isl, p));
+                }
+        one_carve += bench_now_ns() - start;
+        uint16_t one_left = isl->box_count;
+
+        island_clear(isl);
+        start = bench_now_ns();
+        filled = box_fill(isl, &slab, BoxKind_Dirt);
+        bulk_fill += bench_now_ns() - start;
+
+        start = bench_now_ns();
+        carved = box_carve(isl, &ball);
+        bulk_carve += bench_now_ns() - start;
+
+        if (isl->box_count != one_left)
+            log_err("Bulk and one at a time edits left different boxes behind");
+    }
+    bench_log("fill slab, box_insert each", one_fill, BENCH_BULK_REPS * filled);
+    bench_log("fill slab, box_fill", bulk_fill, BENCH_BULK_REPS * filled);
+    bench_log("carve ball, rem_box each", one_carve, BENCH_BULK_REPS * carved);
+    bench_log("carve ball, box_carve", bulk_carve, BENCH_BULK_REPS * carved);
+}
+
+/* reloads a snapshot taken with a hole in islands[], then splits an island
+   and runs random ticks on both the live world and the reloaded one. the
+   split has to land in the same slot both times, or the random ticks go
+   through the islands in a different order and grow different grass. */
+static void bench_snapshot_slots(void) {
+    #define BENCH_SNAPSHOT_TICKS 2000
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+    Island *hole = island_alloc();
+    box_insert(hole, (BoxPos) { -40, 0, 0 }, BoxKind_Dirt);
+
+    /* two slabs with a bridge between them, and a patch off on its own */
+    Island *isl = island_alloc();
+    for (int16_t x = -8; x <= 8; x++)
+        for (int16_t z = -4; z <= 4; z++) if (x <= -4 || x >= 4 || z == 0)
+            box_insert(isl, (BoxPos) { x, 0, z }, (x + z) % 5 ? BoxKind_Dirt : BoxKind_Grass);
+    Island *patch = island_alloc();
+    for (int16_t x = 0; x < 6; x++)
+        for (int16_t z = 0; z < 6; z++)
+            box_insert(patch, (BoxPos) { 40 + x, 0, z }, x ? BoxKind_Dirt : BoxKind_Grass);
+    island_used[hole - islands] = 0;
+
+    uint32_t len = journal_snap_build(0), rng = updates.rng;
+    uint64_t hash[2];
+    int64_t load_ns = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass) {
+            int64_t start = bench_now_ns();
+            journal_snap_load(len);
+            load_ns = bench_now_ns() - start;
+            updates.rng = rng;
+        }
+        Island *at = island_at((BoxPos) {0});
+        island_rem_box(at, box_index_find(at, (BoxPos) {0}));
+        island_split_step(MAX_BOXES);
+        for (int t = 0; t < BENCH_SNAPSHOT_TICKS; t++)
+            update_run_random(UPDATE_BUDGET);
+        hash[pass] = replay_world_hash();
+    }
+    bench_log("journal_snap_load", load_ns, 1);
+    if (hash[0] != hash[1])
+        log_err("Reloaded snapshot came out different from the live world");
+
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+}
+
+#if USE_JOURNAL
+/* a million edits through the journal, flushed every BENCH_JOURNAL_TICK of
+   them like a busy tick would, then loading them all back */
+static void bench_journal(void) {
+    #define BENCH_JOURNAL_EDITS 1000000
+    #define BENCH_JOURNAL_TICK 1000
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+    journal_open("bench");
+    journal.checkpoint_every = UINT32_MAX;
+
+    Island *isl = island_alloc();
+    BoxId origin = box_insert(isl, (BoxPos) {0}, BoxKind_Dirt);
+    journal_checkpoint();
+
+    /* the same edits without the journal, to take back out of the timing */
+    int64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_JOURNAL_EDITS / 2; i++) {
+        Face f = (Face) (i % Face_COUNT);
+        island_add_box(isl, origin, f, BoxKind_Dirt);
+        island_rem_box(isl, box_neighbor(isl, origin, f));
+    }
+    int64_t edits_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (int i = 0; i < BENCH_JOURNAL_EDITS / 2; i++) {
+        Face f = (Face) (i % Face_COUNT);
+        journal_add_box(isl, origin, f, BoxKind_Dirt);
+        journal_rem_box(isl, box_neighbor(isl, origin, f));
+        if ((i * 2) % BENCH_JOURNAL_TICK == 0) journal_tick();
+    }
+    journal_tick();
+    int64_t journaled_ns = bench_now_ns() - start;
+    bench_log("journal write", journaled_ns - edits_ns, BENCH_JOURNAL_EDITS);
+
+    char buf[64];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_str(&f, "  ");
+    fmt_f32(&f, (float) BENCH_JOURNAL_EDITS * sizeof(JournalRecord)
+                / ((float) (journaled_ns - edits_ns) / 1e9f) / (1 << 20), 1);
+    fmt_str(&f, "MB/s");
+    log_fmt(&f);
+
+    journal_close();
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+    start = bench_now_ns();
+    journal_open("bench");
+    bench_log("journal recovery", bench_now_ns() - start, BENCH_JOURNAL_EDITS);
+
+    if (journal.edits != BENCH_JOURNAL_EDITS || island_at((BoxPos) {0})->box_count != 1)
+        log_err("Journal recovery didn't get back what was written");
+
+    journal_close();
+    DeleteFileA("bench.journal");
+    DeleteFileA("bench.snap");
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+}
+#endif
+
+#if NET_MODE == NetMode_Server
+/* a stand-in client that only keeps track of which version of each island
+   it has, which is all the server cares about */
+typedef struct {
+    SOCKET sock;
+    SOCKADDR_IN addr;
+    Vec3 pos;
+    NetHave have[MAX_ISLANDS];
+} BenchNetClient;
+
+static void bench_net_client_tick(BenchNetClient *c) {
+    static uint8_t packet[NET_MAX_PACKET];
+    int got;
+    while ((got = recv(c->sock, (char *) packet, sizeof(packet), 0)) > 0) {
+        NetBuf b = { packet, 0, (uint32_t) got };
+        uint8_t msg = net_get_u8(&b);
+        uint32_t uid = net_get_u32(&b), version = net_get_u32(&b);
+        if (msg != NetMsg_Snapshot && msg != NetMsg_Delta) continue;
+
+        NetHave *have = net_have(c->have, uid);
+        if (have == NULL) have = net_have(c->have, 0);
+        if (have == NULL) continue;
+        if (msg == NetMsg_Snapshot) *have = (NetHave) { uid, version };
+        else if (have->uid == uid && have->version == version)
+            have->version = net_get_u32(&b);
+    }
+
+    NetBuf b = { packet, 0, sizeof(packet) };
+    net_put_u8(&b, NetMsg_Client);
+    net_put_f32(&b, c->pos.x);
+    net_put_f32(&b, c->pos.y);
+    net_put_f32(&b, c->pos.z);
+    uint32_t count_at = b.len;
+    uint8_t count = 0;
+    net_put_u8(&b, 0);
+    for (int i = 0; i < MAX_ISLANDS; i++) if (c->have[i].uid) {
+        net_put_u32(&b, c->have[i].uid);
+        net_put_u32(&b, c->have[i].version);
+        count++;
+    }
+    b.buf[count_at] = count;
+    net_put_u8(&b, 0);
+    sendto(c->sock, (const char *) b.buf, b.len, 0, (SOCKADDR *) &net.server, sizeof(net.server));
+}
+
+/* 64 clients spread around two islands being edited a few times a tick.
+   a quarter of them are too far off to be sent anything. */
+static void bench_net(void) {
+    #define BENCH_NET_TICKS 600
+    #define BENCH_NET_EDITS 4
+    static BenchNetClient clients[NET_MAX_CLIENTS];
+    static uint64_t tick_ns[BENCH_NET_TICKS];
+
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+    Island *near = island_alloc();
+    bench_build_island(near, BENCH_ISLAND_RADIUS);
+    Island *far = island_alloc();
+    BoxShape slab = box_shape_aabb((BoxPos) { 200, -2, -8 }, (BoxPos) { 215, -1, 7 });
+    box_fill(far, &slab, BoxKind_Dirt);
+
+    if (!net_init(1)) return;
+    uint32_t rng = 0xBEEF;
+    for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+        BenchNetClient *c = clients + i;
+        *c = (BenchNetClient) { socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP) };
+        c->addr = (SOCKADDR_IN) { .sin_family = AF_INET };
+        c->addr.sin_addr.s_addr = inet_addr(NET_HOST);
+        bind(c->sock, (SOCKADDR *) &c->addr, sizeof(c->addr));
+        u_long nonblocking = 1;
+        ioctlsocket(c->sock, FIONBIO, &nonblocking);
+        c->pos = i < NET_MAX_CLIENTS / 4
+            ? vec3(-500.0f, 0.0f, 0.0f)
+            : vec3(rand_f(&rng) * 40.0f - 20.0f + (i % 2) * 200.0f, 2.0f, rand_f(&rng) * 40.0f - 20.0f);
+    }
+
+    uint64_t sent_before = net.bytes_sent;
+    for (int t = 0; t < BENCH_NET_TICKS; t++) {
+        for (int i = 0; i < NET_MAX_CLIENTS; i++) bench_net_client_tick(clients + i);
+
+        /* stack up columns on top of the near island and take them back
+           down, which never splits it */
+        for (int e = 0; e < BENCH_NET_EDITS; e++) {
+            BoxId id = (BoxId) (1 + rand_u32(&rng) % (MAX_BOXES - 1));
+            if (!OCCUPIED(near->boxes[id]) || box_neighbor(near, id, Face_Above)) continue;
+            if (rand_u32(&rng) % 2) island_add_box(near, id, Face_Above, BoxKind_Dirt);
+            else if (near->boxes[id].pos.y > 0) island_rem_box(near, id);
+        }
+
+        int64_t start = bench_now_ns();
+        net_server_tick();
+        tick_ns[t] = bench_now_ns() - start;
+    }
+    uint64_t sent = net.bytes_sent - sent_before;
+
+    sort_u64(tick_ns, BENCH_NET_TICKS);
+    bench_log("net_server_tick, p50", (int64_t) tick_ns[BENCH_NET_TICKS / 2], 1);
+    bench_log("net_server_tick, p99", (int64_t) tick_ns[BENCH_NET_TICKS * 99 / 100], 1);
+
+    char buf[128];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_str(&f, "  ");
+    fmt_u64(&f, sent / NET_MAX_CLIENTS / BENCH_NET_TICKS);
+    fmt_str(&f, "B per client per tick, ");
+    fmt_f32(&f, (float) (int64_t) (sent / NET_MAX_CLIENTS) * 60.0f / BENCH_NET_TICKS / 1024.0f, 1);
+    fmt_str(&f, "KB/s per client at 60 ticks a second");
+    log_fmt(&f);
+
+    for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+        NetHave *have = net_have(clients[i].have, near->uid);
+        int should = net_island_dist(near, clients[i].pos) < NET_INTEREST_RADIUS;
+        if (should != (have != NULL)) log_err("Bench client didn't get what it was interested in");
+        closesocket(clients[i].sock);
+    }
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+}
+#endif
+
+static void bench_run(void) {
+    bench_box_backend();
+    bench_face_extraction();
+    bench_ao();
+    bench_face_buckets();
+    bench_light();
+    bench_mem();
+    bench_arena();
+    bench_math();
+    bench_broadphase();
+    bench_sweep();
+    bench_entities();
+    bench_particles();
+    bench_epoch();
+    bench_compact();
+    bench_updates();
+    bench_fluid();
+    bench_island_edits();
+    bench_bulk_edits();
+    bench_snapshot_slots();
+#if USE_JOURNAL
+    bench_journal();
+#endif
+#if NET_MODE == NetMode_Server
+    bench_net();
+#endif
+}
@@ -13,8 +13,14 @@ static int eq_bp(BoxPos a, BoxPos b) {
            a.z == b.z;
 }
 
-typedef enum { BoxKind_Unoccupied, BoxKind_Dirt } BoxKind;
+typedef enum {
+    BoxKind_Unoccupied, BoxKind_Dirt, BoxKind_Lamp, BoxKind_Grass,
+    BoxKind_Water, BoxKind_Sand,
+    BoxKind_COUNT
+} BoxKind;
 #define OCCUPIED(box) ((box).kind != BoxKind_Unoccupied)
+/* flows around on its own (fluid.h), and doesn't hold an island together */
+#define LOOSE(box) ((box).kind == BoxKind_Water || (box).kind == BoxKind_Sand)
 
 typedef enum {
     Face_Left,  Face_Right,
@@ -35,74 +41,858 @@ const BoxPos face_offset[Face_COUNT] = {
 
 #define BoxId uint16_t
 #define BoxId_NULL (0)
+
+/* How a box finds the boxes around it. Pick one with BOX_BACKEND (top of main.c).
+
+   BoxBackend_Linked: every box stores the ids of its six neighbors; finding a
+   box by position means looking through the whole arena.
+   BoxBackend_Chunks: Minecraft style dense 16x16x16 chunks of ids, kept in a
+   sparse map so empty sky costs nothing.
+   BoxBackend_Hash: a hash table from position straight to id.
+   BoxBackend_Bricks: a two level sparse brick map. A hash finds the 16x16x16
+   region a box is in; that region only has nodes for the 4x4x4 bricks with
+   something in them, so empty space costs nothing at either level and rays
+   can hop over it a region or brick at a time.
+
+   Whichever you pick, boxes themselves live in their Island's `boxes` arena
+   and are referred to by BoxId, so code outside of this file doesn't care. */
+#define BoxBackend_Linked 0
+#define BoxBackend_Chunks 1
+#define BoxBackend_Hash   2
+#define BoxBackend_Bricks 3
+#ifndef BOX_BACKEND
+#define BOX_BACKEND BoxBackend_Linked
+#endif
+
 typedef struct {
+#if BOX_BACKEND == BoxBackend_Linked
     /* records indexes of Boxes that touch faces */
     BoxId touching[Face_COUNT];
+#endif
     BoxPos pos;
     BoxKind kind;
 } Box;
 
 #define MAX_BOXES (2 << 10)
-static Box boxes[MAX_BOXES];
 
-static void rem_box(BoxId bye_id) {
-    Box *bye = boxes + bye_id;
-    for (Face f = 0; f < Face_COUNT; f++)
-        boxes[bye->touching[f]].touching[face_opposite[f]] = BoxId_NULL;
-    *bye = (Box) {0};
+/* Open addressing from a BoxPos to a nonzero uint16_t, used by the chunk and
+   hash backends. A val of 0 marks an empty slot. slots must be a power of two. */
+typedef struct { BoxPos pos; uint16_t val; } PosMapSlot;
+typedef struct {
+    PosMapSlot *slots;
+    uint32_t mask;
+} PosMap;
+
+static uint32_t pos_map_hash(PosMap *map, BoxPos p) {
+    uint64_t k = ((uint64_t) (uint16_t) p.x << 32)
+               | ((uint64_t) (uint16_t) p.y << 16)
+               |  (uint64_t) (uint16_t) p.z;
+    return (uint32_t) ((k * 0x9E3779B97F4A7C15ull) >> 32) & map->mask;
 }
 
-static BoxId add_box(BoxId onto_id, Face face, BoxKind kind) {
-    Box *onto = boxes + onto_id;
+static uint16_t pos_map_get(PosMap *map, BoxPos p) {
+    for (uint32_t i = pos_map_hash(map, p);; i = (i + 1) & map->mask) {
+        PosMapSlot *s = map->slots + i;
+        if (s->val == 0 || eq_bp(s->pos, p)) return s->val;
+    }
+}
 
-    /* no adding BoxKind_Unoccupied boxes, that's weird */
-    if (kind == BoxKind_Unoccupied) return BoxId_NULL;
+/* returns 0 if the map is full */
+static int pos_map_set(PosMap *map, BoxPos p, uint16_t val) {
+    uint32_t start = pos_map_hash(map, p), i = start;
+    do {
+        PosMapSlot *s = map->slots + i;
+        if (s->val == 0 || eq_bp(s->pos, p)) {
+            *s = (PosMapSlot) { p, val };
+            return 1;
+        }
+    } while ((i = (i + 1) & map->mask) != start);
+    return 0;
+}
 
-    /* no adding onto an unoccupied box, that's weird */
-    if (!OCCUPIED(*onto)) return BoxId_NULL;
+static uint32_t pos_map_count(PosMap *map) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i <= map->mask; i++)
+        count += map->slots[i].val != 0;
+    return count;
+}
 
-    /* no writing over a face this box already has */
-    if (onto->touching[face] != BoxId_NULL) return BoxId_NULL;
+static void pos_map_del(PosMap *map, BoxPos p) {
+    uint32_t i = pos_map_hash(map, p);
+    for (;; i = (i + 1) & map->mask) {
+        if (map->slots[i].val == 0) return;
+        if (eq_bp(map->slots[i].pos, p)) break;
+    }
 
-    BoxId new_box_id = BoxId_NULL;
-    for (BoxId id = 1; id < MAX_BOXES; id++)
-        if (!OCCUPIED(boxes[id])) {
-            new_box_id = id;
-            break;
+    /* shift later members of the probe run back into the hole, so lookups
+       never stop early at it; saves having tombstones */
+    for (uint32_t j = i;;) {
+        j = (j + 1) & map->mask;
+        PosMapSlot *s = map->slots + j;
+        if (s->val == 0) break;
+        uint32_t home = pos_map_hash(map, s->pos);
+        if (((j - home) & map->mask) >= ((j - i) & map->mask)) {
+            map->slots[i] = *s;
+            i = j;
         }
-    /* dayum, you done used all the boxes up
-       TODO: reallocate or something here? */
-    if (new_box_id == BoxId_NULL) return BoxId_NULL;
+    }
+    map->slots[i] = (PosMapSlot) {0};
+}
+
+/* the chunk a box falls in, and where in that chunk.
+   >> on a negative int16_t is an arithmetic shift with MSVC, so this floors */
+#define BOX_CHUNK_SIZE 16
+static BoxPos box_chunk_pos(BoxPos p) {
+    return (BoxPos) { p.x >> 4, p.y >> 4, p.z >> 4 };
+}
+static uint32_t box_chunk_index(BoxPos p) {
+    return (p.x & 15) | ((p.y & 15) << 4) | ((p.z & 15) << 8);
+}
+
+
+/* Every chunk with boxes in it also keeps a bit per cell saying whether it's
+   occupied, no matter which BOX_BACKEND is picked. Testing a neighbor is a
+   bit lookup instead of chasing ids around, and which faces of a whole column
+   of boxes are exposed falls out of a few shifts and ANDs.
+
+   Columns run along y, 16 bits each, and four of them side by side along z
+   share a uint64_t: bit (z & 3) * 16 + y of cols[x][z >> 2]. */
+typedef struct {
+    BoxPos pos;
+    uint16_t count;
+    uint64_t cols[BOX_CHUNK_SIZE][BOX_CHUNK_SIZE / 4];
+} BoxOcc;
+
+#define MAX_BOX_OCCS 64
+
+#if BOX_BACKEND == BoxBackend_Chunks
+#define MAX_BOX_CHUNKS 64
+typedef struct {
+    BoxId ids[BOX_CHUNK_SIZE * BOX_CHUNK_SIZE * BOX_CHUNK_SIZE];
+    uint16_t count;
+} BoxChunk;
+#elif BOX_BACKEND == BoxBackend_Bricks
+/* a 4x4x4 brick, only allocated if something's in it */
+typedef struct {
+    uint64_t occupied;
+    BoxId ids[64];
+} BoxBrick;
+/* a 16x16x16 region, which is 4x4x4 bricks */
+typedef struct {
+    uint64_t has_brick;
+    uint16_t bricks[64];
+} BoxRegion;
+
+#define MAX_BOX_REGIONS 64
+#define MAX_BOX_BRICKS MAX_BOXES
+/* bump allocated, with freed ones stacked up for reuse */
+typedef struct {
+    uint16_t next, free_count, free[MAX_BOX_BRICKS];
+} BoxPool;
+#define BOX_POOL_ALLOC(pool, max) \
+    ((pool).free_count ? (pool).free[--(pool).free_count] \
+                       : (pool).next < (max) ? (pool).next++ : 0)
+#define BOX_POOL_FREE(pool, i) ((pool).free[(pool).free_count++] = (i))
+#endif
+
+/* a box being put in, taken out (kind is BoxKind_Unoccupied), or turned
+   into some other kind where it is */
+typedef struct { BoxPos pos; uint16_t kind; } BoxChange;
+#define BOX_LOG_SIZE 1024
+
+/* Each island is its own grid of boxes, with its own arena and its own
+   lookup structures. Everything from here on works on one island at a time;
+   island.h is what knows about more than one.
+
+   In every array below, index 0 is never handed out, so 0 can mean
+   "none" in the maps and in touching[]. */
+typedef struct {
+    Box boxes[MAX_BOXES];
+    uint16_t box_count;
+    /* never reused, so an island can be told apart from whatever took its slot */
+    uint32_t uid;
+
+    /* goes up by one for every box put in, taken out or changed. the last
+       BOX_LOG_SIZE of those are kept, change v (the one that took version
+       from v to v + 1) at log[v % BOX_LOG_SIZE], for anything that wants to
+       catch up on what changed since it last looked. */
+    uint32_t version;
+    BoxChange log[BOX_LOG_SIZE];
+    /* the version the log starts at, for islands that didn't start out empty */
+    uint32_t log_start;
+
+    BoxOcc occs[MAX_BOX_OCCS];
+    PosMapSlot occ_slots[MAX_BOX_OCCS * 2];
+    PosMap occ_map;
+
+#if BOX_BACKEND == BoxBackend_Chunks
+    BoxChunk chunks[MAX_BOX_CHUNKS];
+    PosMapSlot chunk_slots[MAX_BOX_CHUNKS * 2];
+    PosMap chunk_map;
+#elif BOX_BACKEND == BoxBackend_Hash
+    PosMapSlot hash_slots[MAX_BOXES * 2];
+    PosMap hash;
+#elif BOX_BACKEND == BoxBackend_Bricks
+    BoxRegion regions[MAX_BOX_REGIONS];
+    BoxBrick bricks[MAX_BOX_BRICKS];
+    PosMapSlot region_slots[MAX_BOX_REGIONS * 2];
+    PosMap region_map;
+    BoxPool brick_pool, region_pool;
+#endif
+} Island;
+
+/* empties out an island so it's ready to have boxes put in it */
+static void island_clear(Island *isl) {
+    memset(isl, 0, sizeof(Island));
+    isl->occ_map = (PosMap) { isl->occ_slots, _countof(isl->occ_slots) - 1 };
+#if BOX_BACKEND == BoxBackend_Chunks
+    isl->chunk_map = (PosMap) { isl->chunk_slots, _countof(isl->chunk_slots) - 1 };
+#elif BOX_BACKEND == BoxBackend_Hash
+    isl->hash = (PosMap) { isl->hash_slots, _countof(isl->hash_slots) - 1 };
+#elif BOX_BACKEND == BoxBackend_Bricks
+    isl->region_map = (PosMap) { isl->region_slots, _countof(isl->region_slots) - 1 };
+    isl->brick_pool.next = isl->region_pool.next = 1;
+#endif
+}
+
+static void box_log(Island *isl, BoxPos pos, BoxKind kind) {
+    isl->log[isl->version++ % BOX_LOG_SIZE] = (BoxChange) { pos, (uint16_t) kind };
+}
+
+/* whether every change since version `since` is still in the log */
+static int box_log_has(Island *isl, uint32_t since) {
+    return since - isl->log_start <= isl->version - isl->log_start &&
+           isl->version - since <= BOX_LOG_SIZE;
+}
+
+static uint64_t box_occ_bit(BoxPos p) {
+    return (uint64_t) 1 << (((p.z & 3) << 4) | (p.y & 15));
+}
+
+static int box_occupied(Island *isl, BoxPos p) {
+    uint16_t occ = pos_map_get(&isl->occ_map, box_chunk_pos(p));
+    return occ && (isl->occs[occ].cols[p.x & 15][(p.z & 15) >> 2] & box_occ_bit(p));
+}
+
+static int box_occ_set(Island *isl, BoxPos p) {
+    BoxPos cp = box_chunk_pos(p);
+    uint16_t occ = pos_map_get(&isl->occ_map, cp);
+    if (occ == 0) {
+        for (uint16_t i = 1; i < MAX_BOX_OCCS; i++)
+            if (isl->occs[i].count == 0) {
+                occ = i;
+                break;
+            }
+        if (occ == 0 || !pos_map_set(&isl->occ_map, cp, occ)) {
+            log_err("Out of box occupancy chunks");
+            return 0;
+        }
+        isl->occs[occ].pos = cp;
+    }
+    isl->occs[occ].cols[p.x & 15][(p.z & 15) >> 2] |= box_occ_bit(p);
+    isl->occs[occ].count++;
+    return 1;
+}
+
+static void box_occ_clear(Island *isl, BoxPos p) {
+    BoxPos cp = box_chunk_pos(p);
+    uint16_t occ = pos_map_get(&isl->occ_map, cp);
+    isl->occs[occ].cols[p.x & 15][(p.z & 15) >> 2] &= ~box_occ_bit(p);
+    if (--isl->occs[occ].count == 0)
+        pos_map_del(&isl->occ_map, cp);
+}
+
+static BoxOcc *box_occ_at(Island *isl, BoxPos chunk_pos) {
+    uint16_t occ = pos_map_get(&isl->occ_map, chunk_pos);
+    return occ ? isl->occs + occ : NULL;
+}
+
+/* Writes out which cells of chunk have face f exposed, laid out the same way
+   as BoxOcc.cols: a cell's face is exposed if it's occupied and the cell
+   face_offset[f] away isn't. */
+static void box_occ_faces(Island *isl, BoxOcc *chunk, Face f, uint64_t out[BOX_CHUNK_SIZE][BOX_CHUNK_SIZE / 4]) {
+    #define LANE_LO  0x0001000100010001ull
+    #define LANE_HI  0x8000800080008000ull
+    static const uint64_t empty[BOX_CHUNK_SIZE][BOX_CHUNK_SIZE / 4];
+
+    /* the chunk the offset leads into, for cells on that edge */
+    BoxOcc *next = box_occ_at(isl, add_bp(chunk->pos, face_offset[f]));
+    const uint64_t (*nc)[BOX_CHUNK_SIZE / 4] = next ? next->cols : empty;
+    uint64_t (*c)[BOX_CHUNK_SIZE / 4] = chunk->cols;
+
+    for (int x = 0; x < BOX_CHUNK_SIZE; x++)
+        for (int w = 0; w < BOX_CHUNK_SIZE / 4; w++) {
+            uint64_t col = c[x][w], beside;
+            switch (f) {
+            case Face_Above:
+                beside = ((col >> 1) & ~LANE_HI) | ((nc[x][w] & LANE_LO) << 15);
+                break;
+            case Face_Below:
+                beside = ((col << 1) & ~LANE_LO) | ((nc[x][w] & LANE_HI) >> 15);
+                break;
+            case Face_Left:
+                beside = x < BOX_CHUNK_SIZE - 1 ? c[x + 1][w] : nc[0][w];
+                break;
+            case Face_Right:
+                beside = x > 0 ? c[x - 1][w] : nc[BOX_CHUNK_SIZE - 1][w];
+                break;
+            case Face_Front:
+                beside = (col >> 16) | ((w < 3 ? c[x][w + 1] : nc[x][0]) << 48);
+                break;
+            default:
+                beside = (col << 16) | ((w > 0 ? c[x][w - 1] : nc[x][3]) >> 48);
+                break;
+            }
+            out[x][w] = col & ~beside;
+        }
+}
+
+/* the cell a bit in BoxOcc.cols (or box_occ_faces' output) stands for */
+static BoxPos box_occ_cell(BoxOcc *chunk, int x, int w, uint32_t bit) {
+    return (BoxPos) {
+        chunk->pos.x * BOX_CHUNK_SIZE + x,
+        chunk->pos.y * BOX_CHUNK_SIZE + (bit & 15),
+        chunk->pos.z * BOX_CHUNK_SIZE + w * 4 + (bit >> 4),
+    };
+}
+
+#if BOX_BACKEND == BoxBackend_Chunks
+
+static BoxId box_index_find(Island *isl, BoxPos p) {
+    uint16_t chunk = pos_map_get(&isl->chunk_map, box_chunk_pos(p));
+    return chunk ? isl->chunks[chunk].ids[box_chunk_index(p)] : BoxId_NULL;
+}
+
+static int box_index_insert(Island *isl, BoxId id) {
+    BoxPos cp = box_chunk_pos(isl->boxes[id].pos);
+    uint16_t chunk = pos_map_get(&isl->chunk_map, cp);
+    if (chunk == 0) {
+        for (uint16_t c = 1; c < MAX_BOX_CHUNKS; c++)
+            if (isl->chunks[c].count == 0) {
+                chunk = c;
+                break;
+            }
+        if (chunk == 0 || !pos_map_set(&isl->chunk_map, cp, chunk)) {
+            log_err("Out of box chunks");
+            return 0;
+        }
+    }
+    isl->chunks[chunk].ids[box_chunk_index(isl->boxes[id].pos)] = id;
+    isl->chunks[chunk].count++;
+    return 1;
+}
+
+static void box_index_remove(Island *isl, BoxId id) {
+    BoxPos cp = box_chunk_pos(isl->boxes[id].pos);
+    uint16_t chunk = pos_map_get(&isl->chunk_map, cp);
+    isl->chunks[chunk].ids[box_chunk_index(isl->boxes[id].pos)] = BoxId_NULL;
+    if (--isl->chunks[chunk].count == 0)
+        pos_map_del(&isl->chunk_map, cp);
+}
+
+/* the box at id's position is id now */
+static void box_index_relabel(Island *isl, BoxId id) {
+    uint16_t chunk = pos_map_get(&isl->chunk_map, box_chunk_pos(isl->boxes[id].pos));
+    isl->chunks[chunk].ids[box_chunk_index(isl->boxes[id].pos)] = id;
+}
+
+static BoxId box_neighbor(Island *isl, BoxId id, Face f) {
+    return box_index_find(isl, add_bp(isl->boxes[id].pos, face_offset[f]));
+}
+
+static uint64_t box_index_bytes(Island *isl) {
+    return sizeof(isl->chunk_slots) + pos_map_count(&isl->chunk_map) * sizeof(BoxChunk);
+}
+
+#elif BOX_BACKEND == BoxBackend_Hash
+
+static BoxId box_index_find(Island *isl, BoxPos p) {
+    return pos_map_get(&isl->hash, p);
+}
+
+static int box_index_insert(Island *isl, BoxId id) {
+    return pos_map_set(&isl->hash, isl->boxes[id].pos, id);
+}
+
+static void box_index_remove(Island *isl, BoxId id) {
+    pos_map_del(&isl->hash, isl->boxes[id].pos);
+}
+
+static void box_index_relabel(Island *isl, BoxId id) {
+    pos_map_set(&isl->hash, isl->boxes[id].pos, id);
+}
+
+static BoxId box_neighbor(Island *isl, BoxId id, Face f) {
+    return box_index_find(isl, add_bp(isl->boxes[id].pos, face_offset[f]));
+}
+
+static uint64_t box_index_bytes(Island *isl) {
+    return sizeof(isl->hash_slots);
+}
+
+#elif BOX_BACKEND == BoxBackend_Bricks
+
+static uint32_t box_region_brick(BoxPos p) {
+    return ((p.x >> 2) & 3) | (((p.y >> 2) & 3) << 2) | (((p.z >> 2) & 3) << 4);
+}
+static uint32_t box_brick_cell(BoxPos p) {
+    return (p.x & 3) | ((p.y & 3) << 2) | ((p.z & 3) << 4);
+}
+
+static BoxId box_index_find(Island *isl, BoxPos p) {
+    uint16_t region = pos_map_get(&isl->region_map, box_chunk_pos(p));
+    if (region == 0) return BoxId_NULL;
+    uint16_t brick = isl->regions[region].bricks[box_region_brick(p)];
+    if (brick == 0) return BoxId_NULL;
+    return isl->bricks[brick].ids[box_brick_cell(p)];
+}
+
+static int box_index_insert(Island *isl, BoxId id) {
+    BoxPos p = isl->boxes[id].pos, rp = box_chunk_pos(p);
+    uint16_t region = pos_map_get(&isl->region_map, rp);
+    if (region == 0) {
+        region = BOX_POOL_ALLOC(isl->region_pool, MAX_BOX_REGIONS);
+        if (region && !pos_map_set(&isl->region_map, rp, region)) {
+            BOX_POOL_FREE(isl->region_pool, region);
+            region = 0;
+        }
+        if (region == 0) {
+            log_err("Out of box regions");
+            return 0;
+        }
+    }
+
+    BoxRegion *r = isl->regions + region;
+    uint32_t rb = box_region_brick(p);
+    if (r->bricks[rb] == 0) {
+        r->bricks[rb] = BOX_POOL_ALLOC(isl->brick_pool, MAX_BOX_BRICKS);
+        if (r->bricks[rb] == 0) {
+            /* and don't leave behind a region with nothing in it */
+            if (r->has_brick == 0) {
+                BOX_POOL_FREE(isl->region_pool, region);
+                pos_map_del(&isl->region_map, rp);
+            }
+            log_err("Out of box bricks");
+            return 0;
+        }
+        r->has_brick |= (uint64_t) 1 << rb;
+    }
+
+    BoxBrick *b = isl->bricks + r->bricks[rb];
+    uint32_t cell = box_brick_cell(p);
+    b->ids[cell] = id;
+    b->occupied |= (uint64_t) 1 << cell;
+    return 1;
+}
+
+static void box_index_remove(Island *isl, BoxId id) {
+    BoxPos p = isl->boxes[id].pos, rp = box_chunk_pos(p);
+    uint16_t region = pos_map_get(&isl->region_map, rp);
+    BoxRegion *r = isl->regions + region;
+    uint32_t rb = box_region_brick(p);
+    BoxBrick *b = isl->bricks + r->bricks[rb];
+    uint32_t cell = box_brick_cell(p);
+    b->ids[cell] = BoxId_NULL;
+    b->occupied &= ~((uint64_t) 1 << cell);
+
+    /* empty space collapses all the way back up */
+    if (b->occupied) return;
+    BOX_POOL_FREE(isl->brick_pool, r->bricks[rb]);
+    r->bricks[rb] = 0;
+    r->has_brick &= ~((uint64_t) 1 << rb);
+
+    if (r->has_brick) return;
+    BOX_POOL_FREE(isl->region_pool, region);
+    pos_map_del(&isl->region_map, rp);
+}
+
+static void box_index_relabel(Island *isl, BoxId id) {
+    BoxPos p = isl->boxes[id].pos;
+    BoxRegion *r = isl->regions + pos_map_get(&isl->region_map, box_chunk_pos(p));
+    isl->bricks[r->bricks[box_region_brick(p)]].ids[box_brick_cell(p)] = id;
+}
+
+static BoxId box_neighbor(Island *isl, BoxId id, Face f) {
+    return box_index_find(isl, add_bp(isl->boxes[id].pos, face_offset[f]));
+}
+
+/* how big of a cube around p is known to be empty: a region, a brick,
+   or 1 if p's own cell needs looking at */
+static int16_t box_empty_extent(Island *isl, BoxPos p) {
+    uint16_t region = pos_map_get(&isl->region_map, box_chunk_pos(p));
+    if (region == 0) return 16;
+    if (isl->regions[region].bricks[box_region_brick(p)] == 0) return 4;
+    return 1;
+}
+
+static uint64_t box_index_bytes(Island *isl) {
+    return sizeof(isl->region_slots)
+         + (isl->region_pool.next - 1 - isl->region_pool.free_count) * sizeof(BoxRegion)
+         + (isl->brick_pool.next - 1 - isl->brick_pool.free_count) * sizeof(BoxBrick);
+}
 
-    Box new_box = (Box) { .kind = kind };
-    new_box.pos = add_bp(onto->pos, face_offset[face]);
-    new_box.touching[face_opposite[face]] = onto_id;
+#else
+
+static BoxId box_index_find(Island *isl, BoxPos p) {
+    for (BoxId id = 1; id < MAX_BOXES; id++)
+        if (OCCUPIED(isl->boxes[id]) && eq_bp(isl->boxes[id].pos, p))
+            return id;
+    return BoxId_NULL;
+}
+
+static int box_index_insert(Island *isl, BoxId new_box_id) {
+    Box *new_box = isl->boxes + new_box_id;
 
     /* TODO: this, without iterating through ALL of the boxes */
     for (BoxId id = 1; id < MAX_BOXES; id++)
-        if (OCCUPIED(boxes[id]))
+        if (OCCUPIED(isl->boxes[id]) && id != new_box_id)
             for (Face f = 0; f < Face_COUNT; f++)
-                if (eq_bp(boxes[id].pos, add_bp(new_box.pos, face_offset[f]))) {
-                    BoxId *touch = boxes[id].touching + face_opposite[f];
+                if (eq_bp(isl->boxes[id].pos, add_bp(new_box->pos, face_offset[f]))) {
+                    BoxId *touch = isl->boxes[id].touching + face_opposite[f];
 
-                    /* somehow one of this would-be boxes's neighbors already
+                    /* somehow one of this would-be box's neighbors already
                        has a neighbor in this spot, but the box we're building
                        off of wasn't informed of that. this means that the
                        linked list hasn't been maintained properly, so you're
                        really in deep if this happens */
                     if (*touch != BoxId_NULL) {
                         log_err("Critical linked list error found adding new block");
-                        return BoxId_NULL;
+                        return 0;
                     }
 
                     *touch = new_box_id;
-                    new_box.touching[f] = id;
+                    new_box->touching[f] = id;
                 }
+    return 1;
+}
+
+static void box_index_remove(Island *isl, BoxId bye_id) {
+    Box *bye = isl->boxes + bye_id;
+    for (Face f = 0; f < Face_COUNT; f++)
+        isl->boxes[bye->touching[f]].touching[face_opposite[f]] = BoxId_NULL;
+}
+
+static BoxId box_neighbor(Island *isl, BoxId id, Face f) {
+    return isl->boxes[id].touching[f];
+}
+
+static uint64_t box_index_bytes(Island *isl) {
+    return 0;
+}
+
+/* adding boxes one at a time means looking through the whole arena for each
+   of their neighbors, so instead put the batch in a hash and link everything
+   in one pass over the arena */
+static PosMapSlot box_batch_slots[MAX_BOXES * 2];
+static uint32_t box_index_insert_batch(Island *isl, BoxId *ids, uint32_t n) {
+    PosMap batch = { box_batch_slots, _countof(box_batch_slots) - 1 };
+    memset(box_batch_slots, 0, sizeof(box_batch_slots));
+    for (uint32_t i = 0; i < n; i++)
+        pos_map_set(&batch, isl->boxes[ids[i]].pos, ids[i]);
+
+    for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id]))
+        for (Face f = 0; f < Face_COUNT; f++) {
+            BoxId touch = pos_map_get(&batch, add_bp(isl->boxes[id].pos, face_offset[f]));
+            if (touch == BoxId_NULL) continue;
+            isl->boxes[id].touching[f] = touch;
+            isl->boxes[touch].touching[face_opposite[f]] = id;
+        }
+    return n;
+}
+
+/* looks up every one of pos at once, in one pass over the arena instead of
+   one each; ids gets BoxId_NULL wherever there's nothing. most boxes get
+   waved through by which cell of their chunk they're in, and the pass
+   stops once everything's been found. */
+static void box_index_find_batch(Island *isl, BoxPos *pos, BoxId *ids, uint32_t n) {
+    uint32_t size = 16;
+    while (size < n * 2) size *= 2;
+    uint64_t mark = arena_mark(&arena_frame);
+    PosMapSlot *slots = arena_push_zero(&arena_frame, size * sizeof(PosMapSlot));
+    if (n < 2 || slots == NULL || n >= 0xFFFF) {
+        for (uint32_t i = 0; i < n; i++) ids[i] = box_index_find(isl, pos[i]);
+        arena_pop(&arena_frame, mark);
+        return;
+    }
+
+    /* where each position first shows up in pos, plus one */
+    PosMap wanted = { slots, size - 1 };
+    uint64_t cells[BOX_CHUNK_SIZE * BOX_CHUNK_SIZE * BOX_CHUNK_SIZE / 64] = {0};
+    uint32_t left = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        ids[i] = BoxId_NULL;
+        if (pos_map_get(&wanted, pos[i])) continue;
+        pos_map_set(&wanted, pos[i], (uint16_t) (i + 1));
+        cells[box_chunk_index(pos[i]) >> 6] |= (uint64_t) 1 << (box_chunk_index(pos[i]) & 63);
+        left++;
+    }
+    for (BoxId id = 1; id < MAX_BOXES && left; id++) if (OCCUPIED(isl->boxes[id])) {
+        uint32_t cell = box_chunk_index(isl->boxes[id].pos);
+        if (!(cells[cell >> 6] >> (cell & 63) & 1)) continue;
+        uint16_t first = pos_map_get(&wanted, isl->boxes[id].pos);
+        if (first == 0) continue;
+        ids[first - 1] = id;
+        left--;
+    }
+    for (uint32_t i = 0; i < n; i++)
+        ids[i] = ids[pos_map_get(&wanted, pos[i]) - 1];
+    arena_pop(&arena_frame, mark);
+}
+
+#endif
+
+#if BOX_BACKEND != BoxBackend_Linked
+/* nothing to be gained doing these together, each one's already cheap.
+   returns how many made it in; the rest are rolled back and left out of ids. */
+static uint32_t box_index_insert_batch(Island *isl, BoxId *ids, uint32_t n) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (box_index_insert(isl, ids[i])) {
+            ids[kept++] = ids[i];
+            continue;
+        }
+        box_occ_clear(isl, isl->boxes[ids[i]].pos);
+        isl->boxes[ids[i]] = (Box) {0};
+    }
+    return kept;
+}
+
+/* same goes for these */
+static void box_index_find_batch(Island *isl, BoxPos *pos, BoxId *ids, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) ids[i] = box_index_find(isl, pos[i]);
+}
+#endif
+
+static void rem_box(Island *isl, BoxId bye_id) {
+    if (!OCCUPIED(isl->boxes[bye_id])) return;
+    box_index_remove(isl, bye_id);
+    box_occ_clear(isl, isl->boxes[bye_id].pos);
+    box_log(isl, isl->boxes[bye_id].pos, BoxKind_Unoccupied);
+    isl->boxes[bye_id] = (Box) {0};
+    isl->box_count--;
+}
+
+/* turns id into a box of some other kind, without moving it or
+   touching anything around it */
+static void box_set_kind(Island *isl, BoxId id, BoxKind kind) {
+    if (!OCCUPIED(isl->boxes[id]) || kind == BoxKind_Unoccupied || isl->boxes[id].kind == kind) return;
+    isl->boxes[id].kind = kind;
+    box_log(isl, isl->boxes[id].pos, kind);
+}
 
-    *(boxes + new_box_id) = new_box;
+/* puts a box at pos without needing anything to build it onto; not over
+   one that's already there, though */
+static BoxId box_insert(Island *isl, BoxPos pos, BoxKind kind) {
+    if (box_occupied(isl, pos)) return BoxId_NULL;
+
+    BoxId new_box_id = BoxId_NULL;
+    for (BoxId id = 1; id < MAX_BOXES; id++)
+        if (!OCCUPIED(isl->boxes[id])) {
+            new_box_id = id;
+            break;
+        }
+    /* dayum, you done used all the boxes up
+       TODO: reallocate or something here? */
+    if (new_box_id == BoxId_NULL) return BoxId_NULL;
+
+    isl->boxes[new_box_id] = (Box) { .pos = pos, .kind = kind };
+    if (!box_occ_set(isl, pos)) {
+        isl->boxes[new_box_id] = (Box) {0};
+        return BoxId_NULL;
+    }
+    if (!box_index_insert(isl, new_box_id)) {
+        box_occ_clear(isl, pos);
+        isl->boxes[new_box_id] = (Box) {0};
+        return BoxId_NULL;
+    }
+    isl->box_count++;
+    box_log(isl, pos, kind);
     return new_box_id;
 }
 
+static BoxId add_box(Island *isl, BoxId onto_id, Face face, BoxKind kind) {
+    Box *onto = isl->boxes + onto_id;
+
+    /* no adding BoxKind_Unoccupied boxes, that's weird */
+    if (kind == BoxKind_Unoccupied) return BoxId_NULL;
+
+    /* no adding onto an unoccupied box, that's weird */
+    if (!OCCUPIED(*onto)) return BoxId_NULL;
+
+    /* no writing over a face this box already has */
+    if (box_neighbor(isl, onto_id, face) != BoxId_NULL) return BoxId_NULL;
+
+    return box_insert(isl, add_bp(onto->pos, face_offset[face]), kind);
+}
+
+/* The cells a bulk edit covers. Make one with box_shape_aabb, box_shape_sphere
+   or box_shape_mask; lo and hi are always its inclusive bounds. */
+typedef enum { BoxShape_Aabb, BoxShape_Sphere, BoxShape_Mask } BoxShapeKind;
+typedef struct {
+    BoxShapeKind kind;
+    BoxPos lo, hi;
+    /* BoxShape_Sphere */
+    BoxPos center;
+    int16_t radius;
+    /* BoxShape_Mask: a byte per cell from lo to hi, nonzero if it's included.
+       x goes fastest, then y, then z. */
+    const uint8_t *mask;
+} BoxShape;
+
+static BoxShape box_shape_aabb(BoxPos lo, BoxPos hi) {
+    return (BoxShape) { .kind = BoxShape_Aabb, .lo = lo, .hi = hi };
+}
+
+static BoxShape box_shape_sphere(BoxPos center, int16_t radius) {
+    return (BoxShape) {
+        .kind = BoxShape_Sphere,
+        .lo = add_bp(center, (BoxPos) { -radius, -radius, -radius }),
+        .hi = add_bp(center, (BoxPos) {  radius,  radius,  radius }),
+        .center = center,
+        .radius = radius,
+    };
+}
+
+static BoxShape box_shape_mask(BoxPos lo, BoxPos hi, const uint8_t *mask) {
+    return (BoxShape) { .kind = BoxShape_Mask, .lo = lo, .hi = hi, .mask = mask };
+}
+
+static int box_shape_has(BoxShape *s, BoxPos p) {
+    if (p.x < s->lo.x || p.y < s->lo.y || p.z < s->lo.z ||
+        p.x > s->hi.x || p.y > s->hi.y || p.z > s->hi.z) return 0;
+
+    switch (s->kind) {
+    case BoxShape_Sphere: {
+        int dx = p.x - s->center.x, dy = p.y - s->center.y, dz = p.z - s->center.z;
+        return dx*dx + dy*dy + dz*dz <= s->radius * s->radius;
+    }
+    case BoxShape_Mask: {
+        int w = s->hi.x - s->lo.x + 1, h = s->hi.y - s->lo.y + 1;
+        return s->mask[(p.x - s->lo.x) + ((p.y - s->lo.y) + (p.z - s->lo.z) * h) * w];
+    }
+    default:
+        return 1;
+    }
+}
+
+static BoxId box_batch[MAX_BOXES];
+
+/* fills every empty cell in s with kind; nothing needs to be there to build
+   onto. Free slots come out of one pass over the arena, and the backend gets
+   handed the whole batch at once. Returns how many boxes were added. */
+static uint32_t box_fill(Island *isl, BoxShape *s, BoxKind kind) {
+    if (kind == BoxKind_Unoccupied) return 0;
+
+    uint32_t n = 0;
+    BoxId next = 1;
+    /* y innermost, since that's how BoxOcc lays out its bits */
+    for (int16_t x = s->lo.x; x <= s->hi.x; x++)
+        for (int16_t z = s->lo.z; z <= s->hi.z; z++)
+            for (int16_t y = s->lo.y; y <= s->hi.y; y++) {
+                BoxPos p = { x, y, z };
+                if (!box_shape_has(s, p) || box_occupied(isl, p)) continue;
+
+                while (next < MAX_BOXES && OCCUPIED(isl->boxes[next])) next++;
+                if (next == MAX_BOXES) {
+                    log_err("Out of boxes filling a shape");
+                    goto full;
+                }
+                if (!box_occ_set(isl, p)) goto full;
+                isl->boxes[next] = (Box) { .pos = p, .kind = kind };
+                box_batch[n++] = next;
+            }
+    full:
+
+    n = box_index_insert_batch(isl, box_batch, n);
+    isl->box_count += n;
+    for (uint32_t i = 0; i < n; i++)
+        box_log(isl, isl->boxes[box_batch[i]].pos, kind);
+    return n;
+}
+
+/* removes every box in s. returns how many that was. */
+static uint32_t box_carve(Island *isl, BoxShape *s) {
+    uint32_t n = 0;
+    for (BoxId id = 1; id < MAX_BOXES; id++)
+        if (OCCUPIED(isl->boxes[id]) && box_shape_has(s, isl->boxes[id].pos)) {
+            rem_box(isl, id);
+            n++;
+        }
+    return n;
+}
+
+/* moves every ids[i] to to[i] at once, so one can go where another just
+   left, each keeping its id. every to[] has to be empty once the whole batch
+   is out of the way. the backend relinks them all in one go, as with
+   box_fill. returns how many made it, leaving just those in ids; any that
+   didn't (out of occupancy chunks) are gone. */
+static uint32_t box_move_batch(Island *isl, BoxId *ids, BoxPos *to, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        BoxPos from = isl->boxes[ids[i]].pos;
+        box_index_remove(isl, ids[i]);
+        box_occ_clear(isl, from);
+        box_log(isl, from, BoxKind_Unoccupied);
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        BoxKind kind = isl->boxes[ids[i]].kind;
+        if (!box_occ_set(isl, to[i])) {
+            isl->boxes[ids[i]] = (Box) {0};
+            continue;
+        }
+        isl->boxes[ids[i]] = (Box) { .pos = to[i], .kind = kind };
+        ids[kept++] = ids[i];
+    }
+
+    uint32_t moved = box_index_insert_batch(isl, ids, kept);
+    isl->box_count -= (uint16_t) (n - moved);
+    for (uint32_t i = 0; i < moved; i++)
+        box_log(isl, isl->boxes[ids[i]].pos, isl->boxes[ids[i]].kind);
+    return moved;
+}
+
+/* x, y and z's bits interleaved, so boxes near each other in the grid
+   mostly sort near each other too */
+static uint64_t box_morton(BoxPos p) {
+    uint64_t c[3] = { (uint16_t) (p.x ^ 0x8000), (uint16_t) (p.y ^ 0x8000), (uint16_t) (p.z ^ 0x8000) };
+    for (int i = 0; i < 3; i++) {
+        c[i] = (c[i] | (c[i] << 16)) & 0x0000FF0000FFull;
+        c[i] = (c[i] | (c[i] <<  8)) & 0x00F00F00F00Full;
+        c[i] = (c[i] | (c[i] <<  4)) & 0x0C30C30C30C3ull;
+        c[i] = (c[i] | (c[i] <<  2)) & 0x249249249249ull;
+    }
+    return c[0] | (c[1] << 1) | (c[2] << 2);
+}
+
+/* trades the ids of whatever's in a and b; either can be empty. no box
+   moves anywhere, so nothing gets logged, and nothing that goes by
+   position (the occupancy bits, AO, light) needs to know. */
+static void box_swap(Island *isl, BoxId a, BoxId b) {
+    Box t = isl->boxes[a];
+    isl->boxes[a] = isl->boxes[b];
+    isl->boxes[b] = t;
+
+#if BOX_BACKEND == BoxBackend_Linked
+    /* they might be touching each other, so fix up their own links first */
+    BoxId ids[2] = { a, b };
+    for (int i = 0; i < 2; i++) if (OCCUPIED(isl->boxes[ids[i]]))
+        for (Face f = 0; f < Face_COUNT; f++) {
+            BoxId *n = isl->boxes[ids[i]].touching + f;
+            if (*n == a) *n = b;
+            else if (*n == b) *n = a;
+        }
+    for (int i = 0; i < 2; i++) if (OCCUPIED(isl->boxes[ids[i]]))
+        for (Face f = 0; f < Face_COUNT; f++) {
+            BoxId n = isl->boxes[ids[i]].touching[f];
+            if (n != BoxId_NULL) isl->boxes[n].touching[face_opposite[f]] = ids[i];
+        }
+#else
+    if (OCCUPIED(isl->boxes[a])) box_index_relabel(isl, a);
+    if (OCCUPIED(isl->boxes[b])) box_index_relabel(isl, b);
+#endif
+}
+
 static Face box_ray_face(Vec3 ro, Vec3 rd, Vec3 rad) {
     Vec3 m = div3(vec3_f(1.0f), rd);
     Vec3 n = mul3(m, ro);
@@ -139,22 +929,224 @@ static float box_ray_dist(Vec3 ro, Vec3 rd, Vec3 rad) {
 
 
 /* if face is not a NULL pointer, the face that was hit will be written into it */
-static BoxId box_under_ray(Vec3 p, Vec3 rd, Face *face) {
-    float res_dist = INFINITY;
-    Vec3 res_ro = {0};
+static BoxId box_under_ray(Island *isl, Vec3 p, Vec3 rd, Face *face) {
+    #define BOX_RAY_REACH (100.0f)
     BoxId res = BoxId_NULL;
-    for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(boxes[id])) {
-        Vec3 pos = box_pos_to_vec3(boxes[id].pos);
+#if BOX_BACKEND == BoxBackend_Linked
+    /* no way to find a box by position short of looking at all of them,
+       so might as well test the ray against all of them */
+    float res_dist = INFINITY;
+    for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id])) {
+        Vec3 pos = box_pos_to_vec3(isl->boxes[id].pos);
         Vec3 ro = sub3(p, add3_f(pos, 0.5f));
         float this_dist = box_ray_dist(ro, rd, vec3_f(0.5f));
         if (this_dist < res_dist) {
             res_dist = this_dist;
             res = id;
-            res_ro = ro;
         }
     }
+#elif BOX_BACKEND == BoxBackend_Bricks
+    /* like the cell walk below, but hop a whole region or brick at a time
+       whenever the one we're in is known to be empty */
+    #define BOX_RAY_EXIT(axis) (rd.axis == 0.0f ? INFINITY : \
+        ((rd.axis < 0.0f ? lo.axis : lo.axis + size) - p.axis) / rd.axis)
+    BoxPos cell = { (int16_t) floorf(p.x), (int16_t) floorf(p.y), (int16_t) floorf(p.z) };
+    for (float t = 0.0f; t <= BOX_RAY_REACH;) {
+        int16_t size = box_empty_extent(isl, cell);
+        if (size == 1) {
+            res = box_index_find(isl, cell);
+            if (res != BoxId_NULL) break;
+        }
+
+        /* sizes are powers of two, so masking rounds down to the cube's corner */
+        BoxPos lo_bp = { cell.x & -size, cell.y & -size, cell.z & -size };
+        Vec3 lo = box_pos_to_vec3(lo_bp);
+        float exit_x = BOX_RAY_EXIT(x), exit_y = BOX_RAY_EXIT(y), exit_z = BOX_RAY_EXIT(z);
+        t = min(min(exit_x, exit_y), exit_z);
+
+        /* step off of whichever face we left through by hand; leaving it to
+           floorf would get stuck on the boundary with a shallow enough ray */
+        Vec3 at = add3(p, mul3_f(rd, t));
+        cell = (BoxPos) { (int16_t) floorf(at.x), (int16_t) floorf(at.y), (int16_t) floorf(at.z) };
+        if (t == exit_x)
+            cell.x = rd.x < 0.0f ? lo_bp.x - 1 : lo_bp.x + size;
+        else if (t == exit_y)
+            cell.y = rd.y < 0.0f ? lo_bp.y - 1 : lo_bp.y + size;
+        else
+            cell.z = rd.z < 0.0f ? lo_bp.z - 1 : lo_bp.z + size;
+    }
+#else
+    /* walk the cells the ray passes through, nearest first (Amanatides & Woo) */
+    int16_t cell[3] = { (int16_t) floorf(p.x), (int16_t) floorf(p.y), (int16_t) floorf(p.z) };
+    float o[3] = { p.x, p.y, p.z }, d[3] = { rd.x, rd.y, rd.z };
+    int16_t step[3];
+    float t_max[3], t_delta[3];
+    for (int i = 0; i < 3; i++) {
+        step[i] = d[i] < 0.0f ? -1 : 1;
+        t_delta[i] = d[i] != 0.0f ? fabsf(1.0f / d[i]) : INFINITY;
+        float edge = (float) cell[i] + (d[i] < 0.0f ? 0.0f : 1.0f);
+        t_max[i] = d[i] != 0.0f ? (edge - o[i]) / d[i] : INFINITY;
+    }
+
+    for (float t = 0.0f; t <= BOX_RAY_REACH;) {
+        res = box_index_find(isl, (BoxPos) { cell[0], cell[1], cell[2] });
+        if (res != BoxId_NULL) break;
+
+        int axis = t_max[0] < t_max[1] ? (t_max[0] < t_max[2] ? 0 : 2)
+                                        : (t_max[1] < t_max[2] ? 1 : 2);
+        t = t_max[axis];
+        t_max[axis] += t_delta[axis];
+        cell[axis] += step[axis];
+    }
+#endif
 
-    if (res != BoxId_NULL && face != NULL)
-        *face = box_ray_face(res_ro, rd, vec3_f(0.5f));
+    if (res != BoxId_NULL && face != NULL) {
+        Vec3 ro = sub3(p, add3_f(box_pos_to_vec3(isl->boxes[res].pos), 0.5f));
+        *face = box_ray_face(ro, rd, vec3_f(0.5f));
+    }
     return res;
 }
+
+/* how close box_sweep lets things get to a box, so something that's stopped
+   against one never rounds its way into it */
+#define BOX_SWEEP_SKIN (0.001f)
+
+/* How far something lo..hi (in isl's grid) can go along axis, up to d, before
+   it runs into a box. The cells it would go into are checked a layer at a time,
+   nearest first, so however fast it's going it can't skip over one. Cells it's
+   already in the middle of (somebody put a box down on top of it) don't count,
+   so it can always get back out. */
+static float box_sweep(Island *isl, Vec3 lo, Vec3 hi, int axis, float d) {
+    float l[3] = { lo.x, lo.y, lo.z }, h[3] = { hi.x, hi.y, hi.z };
+    int u = axis == 0 ? 1 : 0, v = axis == 2 ? 1 : 2;
+    if (d == 0.0f) return 0.0f;
+
+    /* the layers of cells it'd go into, in the order it gets to them */
+    int16_t first, last, step;
+    if (d > 0.0f) {
+        first = (int16_t) -floorf(-h[axis]);
+        last = (int16_t) -floorf(-(h[axis] + d)) - 1;
+        step = 1;
+    } else {
+        first = (int16_t) floorf(l[axis]) - 1;
+        last = (int16_t) floorf(l[axis] + d);
+        step = -1;
+    }
+    int16_t u_lo = (int16_t) floorf(l[u]), u_hi = (int16_t) -floorf(-h[u]) - 1;
+    int16_t v_lo = (int16_t) floorf(l[v]), v_hi = (int16_t) -floorf(-h[v]) - 1;
+
+    for (int16_t c = first; step > 0 ? c <= last : c >= last; c += step)
+        for (int16_t cu = u_lo; cu <= u_hi; cu++)
+            for (int16_t cv = v_lo; cv <= v_hi; cv++) {
+                int16_t cell[3];
+                cell[axis] = c;
+                cell[u] = cu;
+                cell[v] = cv;
+                if (!box_occupied(isl, (BoxPos) { cell[0], cell[1], cell[2] })) continue;
+
+                /* right up to it, less the skin, but never backwards */
+                return d > 0.0f ? m_max(0.0f, (float) c - h[axis] - BOX_SWEEP_SKIN)
+                                : m_min(0.0f, (float) (c + 1) - l[axis] + BOX_SWEEP_SKIN);
+            }
+    return d;
+}
+
+/* what an island's boxes are actually costing us, measured instead of estimated.
+   everything's in bytes. see box_mem_report. */
+typedef struct {
+    uint32_t box_count;
+    /* position and kind of every occupied box */
+    uint64_t box_bytes;
+    /* the touching[] links of every occupied box */
+    uint64_t link_bytes;
+    /* lookup structures on top of the arena: BOX_BACKEND's, and the occupancy bits */
+    uint64_t index_bytes;
+    /* vertex and index buffer space the boxes' geometry occupies */
+    uint64_t mesh_bytes;
+    /* the whole arena, occupied or not */
+    uint64_t arena_bytes;
+    /* what 16x16x16 dense chunks storing a one byte kind would have cost,
+       for the chunks these boxes touch */
+    uint64_t dense_chunk_bytes;
+    /* occupied boxes / volume of their bounding box */
+    float fill;
+} BoxMemReport;
+
+/* mesh_bytes is left for the renderer to fill in */
+static BoxMemReport box_mem_report(Island *isl) {
+    BoxMemReport r = {0};
+    uint64_t mark = arena_mark(&arena_frame);
+    /* the chunk each box is in */
+    uint64_t *chunk_of = arena_push(&arena_frame, MAX_BOXES * sizeof(uint64_t));
+    if (chunk_of == NULL) return r;
+    BoxPos lo = { INT16_MAX, INT16_MAX, INT16_MAX },
+           hi = { INT16_MIN, INT16_MIN, INT16_MIN };
+
+    for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id])) {
+        BoxPos p = isl->boxes[id].pos;
+        lo = (BoxPos) { min(lo.x, p.x), min(lo.y, p.y), min(lo.z, p.z) };
+        hi = (BoxPos) { max(hi.x, p.x), max(hi.y, p.y), max(hi.z, p.z) };
+
+        BoxPos c = box_chunk_pos(p);
+        chunk_of[r.box_count++] = ((uint64_t) (uint16_t) c.x << 32)
+                                       | ((uint64_t) (uint16_t) c.y << 16)
+                                       |  (uint64_t) (uint16_t) c.z;
+    }
+
+#if BOX_BACKEND == BoxBackend_Linked
+    r.box_bytes = r.box_count * (sizeof(Box) - sizeof(isl->boxes->touching));
+    r.link_bytes = r.box_count * sizeof(isl->boxes->touching);
+#else
+    r.box_bytes = r.box_count * sizeof(Box);
+#endif
+    r.index_bytes = box_index_bytes(isl) + sizeof(isl->occ_slots)
+                  + pos_map_count(&isl->occ_map) * sizeof(BoxOcc);
+    r.arena_bytes = sizeof(isl->boxes);
+
+    sort_u64(chunk_of, r.box_count);
+    uint32_t chunks = 0;
+    for (uint32_t i = 0; i < r.box_count; i++)
+        chunks += i == 0 || chunk_of[i] != chunk_of[i - 1];
+    r.dense_chunk_bytes = (uint64_t) chunks * 16 * 16 * 16;
+
+    if (r.box_count) {
+        float volume = (float) (hi.x - lo.x + 1)
+                     * (float) (hi.y - lo.y + 1)
+                     * (float) (hi.z - lo.z + 1);
+        r.fill = (float) r.box_count / volume;
+    }
+    arena_pop(&arena_frame, mark);
+    return r;
+}
+
+static void box_mem_log(const char *island, BoxMemReport r) {
+    char buf[256];
+    Fmt f = { buf, 0, sizeof(buf) };
+    uint64_t used = r.box_bytes + r.link_bytes + r.index_bytes + r.mesh_bytes;
+
+    fmt_str(&f, island);
+    fmt_str(&f, ": ");
+    fmt_u64(&f, r.box_count);
+    fmt_str(&f, " boxes, fill ");
+    fmt_f32(&f, r.fill * 100.0f, 1);
+    fmt_str(&f, "%");
+    log_fmt(&f);
+
+    fmt_str(&f, "  records ");    fmt_u64(&f, r.box_bytes);
+    fmt_str(&f, "B, links ");     fmt_u64(&f, r.link_bytes);
+    fmt_str(&f, "B, indices ");   fmt_u64(&f, r.index_bytes);
+    fmt_str(&f, "B, mesh ");      fmt_u64(&f, r.mesh_bytes);
+    fmt_str(&f, "B");
+    log_fmt(&f);
+
+    fmt_str(&f, "  ");
+    fmt_f32(&f, r.box_count ? (float) (int64_t) used / (float) r.box_count : 0.0f, 1);
+    fmt_str(&f, "B per box (");
+    fmt_f32(&f, r.box_count ? (float) (int64_t) (used - r.mesh_bytes) / (float) r.box_count : 0.0f, 1);
+    fmt_str(&f, "B without mesh), arena reserves ");
+    fmt_u64(&f, r.arena_bytes);
+    fmt_str(&f, "B, dense chunks would be ");
+    fmt_u64(&f, r.dense_chunk_bytes);
+    fmt_str(&f, "B");
+    log_fmt(&f);
+}
@@ -24,6 +24,7 @@ pushd build
 
 :: build shaders
 fxc.exe /nologo /T vs_4_0 /E vs /O3 /WX /Zpc /Ges /Fh d3d11_vshader.h /Vn d3d11_vshader /Qstrip_reflect /Qstrip_debug /Qstrip_priv ../shader.hlsl
+fxc.exe /nologo /T vs_4_0 /E vs_particle /O3 /WX /Zpc /Ges /Fh d3d11_particle_vshader.h /Vn d3d11_particle_vshader /Qstrip_reflect /Qstrip_debug /Qstrip_priv ../shader.hlsl
 fxc.exe /nologo /T ps_4_0 /E ps /O3 /WX /Zpc /Ges /Fh d3d11_pshader.h /Vn d3d11_pshader /Qstrip_reflect /Qstrip_debug /Qstrip_priv ../shader.hlsl
 
 :: build bootleg C runtime
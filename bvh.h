@@ -0,0 +1,228 @@
+/* A dynamic AABB tree, for finding which of a bunch of things that move
+   around are near a box or a ray without looking at every one of them.
+
+   Each thing is a leaf; every other node has two children and the box
+   around both. Leaves are kept a little bigger than what they're for, by
+   BVH_MARGIN, so something that only moves a bit (or gets a box put on
+   it) doesn't have to touch the tree at all. Once it's out of its leaf's
+   box, the leaf is taken out and put back in, going down from the root
+   toward whichever side would grow the least, the way Box2D does it. */
+
+typedef struct { Vec3 lo, hi; } Aabb;
+
+static Aabb aabb_union(Aabb a, Aabb b) {
+    return (Aabb) {
+        { m_min(a.lo.x, b.lo.x), m_min(a.lo.y, b.lo.y), m_min(a.lo.z, b.lo.z) },
+        { m_max(a.hi.x, b.hi.x), m_max(a.hi.y, b.hi.y), m_max(a.hi.z, b.hi.z) },
+    };
+}
+
+/* half the surface area, which is what it costs to have to look in a box */
+static float aabb_cost(Aabb a) {
+    Vec3 d = sub3(a.hi, a.lo);
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static int aabb_contains(Aabb outer, Aabb inner) {
+    return outer.lo.x <= inner.lo.x && outer.lo.y <= inner.lo.y && outer.lo.z <= inner.lo.z &&
+           outer.hi.x >= inner.hi.x && outer.hi.y >= inner.hi.y && outer.hi.z >= inner.hi.z;
+}
+
+static int aabb_overlaps(Aabb a, Aabb b) {
+    return a.lo.x <= b.hi.x && a.hi.x >= b.lo.x &&
+           a.lo.y <= b.hi.y && a.hi.y >= b.lo.y &&
+           a.lo.z <= b.hi.z && a.hi.z >= b.lo.z;
+}
+
+/* whether p + rd * t is in a for some t in 0..reach */
+static int aabb_ray(Aabb a, Vec3 p, Vec3 rd, float reach) {
+    float o[3] = { p.x, p.y, p.z }, d[3] = { rd.x, rd.y, rd.z };
+    float lo[3] = { a.lo.x, a.lo.y, a.lo.z }, hi[3] = { a.hi.x, a.hi.y, a.hi.z };
+    float t_near = 0.0f, t_far = reach;
+    for (int i = 0; i < 3; i++) {
+        if (d[i] == 0.0f) {
+            if (o[i] < lo[i] || o[i] > hi[i]) return 0;
+            continue;
+        }
+        float t0 = (lo[i] - o[i]) / d[i], t1 = (hi[i] - o[i]) / d[i];
+        t_near = m_max(t_near, m_min(t0, t1));
+        t_far = m_min(t_far, m_max(t0, t1));
+    }
+    return t_near <= t_far;
+}
+
+/* how much bigger than what they hold leaves are kept */
+#define BVH_MARGIN (1.0f)
+
+/* index 0 is never handed out, so it can mean "none" */
+#define BVH_NULL (0)
+typedef struct {
+    Aabb box;
+    /* a leaf if kids[0] is BVH_NULL. parent doubles as the free list. */
+    uint16_t parent, kids[2];
+    /* for leaves, whatever it was put in for */
+    uint32_t user;
+} BvhNode;
+
+typedef struct {
+    BvhNode *nodes;
+    uint16_t cap, root, free;
+} Bvh;
+
+/* a tree with room for cap - 1 nodes, which is cap / 2 leaves */
+static void bvh_init(Bvh *tree, BvhNode *nodes, uint16_t cap) {
+    *tree = (Bvh) { nodes, cap, BVH_NULL, BVH_NULL };
+    for (uint16_t i = cap - 1; i > 0; i--) {
+        nodes[i] = (BvhNode) { .parent = tree->free };
+        tree->free = i;
+    }
+}
+
+static uint16_t bvh_node_alloc(Bvh *tree) {
+    uint16_t n = tree->free;
+    if (n == BVH_NULL) {
+        log_err("Out of bvh nodes");
+        return BVH_NULL;
+    }
+    tree->free = tree->nodes[n].parent;
+    tree->nodes[n] = (BvhNode) {0};
+    return n;
+}
+
+static void bvh_node_free(Bvh *tree, uint16_t n) {
+    tree->nodes[n] = (BvhNode) { .parent = tree->free };
+    tree->free = n;
+}
+
+/* fixes up the boxes of n and everything above it */
+static void bvh_refit(Bvh *tree, uint16_t n) {
+    for (; n != BVH_NULL; n = tree->nodes[n].parent) {
+        BvhNode *node = tree->nodes + n;
+        node->box = aabb_union(tree->nodes[node->kids[0]].box, tree->nodes[node->kids[1]].box);
+    }
+}
+
+/* hangs an unattached leaf back in the tree */
+static void bvh_attach(Bvh *tree, uint16_t leaf) {
+    BvhNode *nodes = tree->nodes;
+    if (tree->root == BVH_NULL) {
+        tree->root = leaf;
+        nodes[leaf].parent = BVH_NULL;
+        return;
+    }
+
+    /* go down whichever side it makes grow the least, until it's
+       cheaper to pair up with the node we're at than to go further */
+    Aabb box = nodes[leaf].box;
+    uint16_t at = tree->root;
+    while (nodes[at].kids[0] != BVH_NULL) {
+        float joined = aabb_cost(aabb_union(nodes[at].box, box));
+        float cost = 2.0f * joined;
+        /* what going further down costs everything above it */
+        float push = 2.0f * (joined - aabb_cost(nodes[at].box));
+
+        float kid_cost[2];
+        for (int k = 0; k < 2; k++) {
+            BvhNode *kid = nodes + nodes[at].kids[k];
+            float grown = aabb_cost(aabb_union(kid->box, box));
+            kid_cost[k] = push + (kid->kids[0] == BVH_NULL ? grown : grown - aabb_cost(kid->box));
+        }
+        if (cost < kid_cost[0] && cost < kid_cost[1]) break;
+        at = nodes[at].kids[kid_cost[1] < kid_cost[0]];
+    }
+
+    uint16_t parent = bvh_node_alloc(tree), above = nodes[at].parent;
+    if (parent == BVH_NULL) return;
+    nodes[parent].parent = above;
+    nodes[parent].kids[0] = at;
+    nodes[parent].kids[1] = leaf;
+    nodes[at].parent = nodes[leaf].parent = parent;
+    if (above == BVH_NULL) tree->root = parent;
+    else nodes[above].kids[nodes[above].kids[1] == at] = parent;
+    bvh_refit(tree, parent);
+}
+
+/* takes a leaf out of the tree without freeing it */
+static void bvh_detach(Bvh *tree, uint16_t leaf) {
+    BvhNode *nodes = tree->nodes;
+    if (tree->root == leaf) {
+        tree->root = BVH_NULL;
+        return;
+    }
+
+    /* its sibling takes its parent's place */
+    uint16_t parent = nodes[leaf].parent, above = nodes[parent].parent;
+    uint16_t sibling = nodes[parent].kids[nodes[parent].kids[0] == leaf];
+    nodes[sibling].parent = above;
+    if (above == BVH_NULL) tree->root = sibling;
+    else nodes[above].kids[nodes[above].kids[1] == parent] = sibling;
+    bvh_node_free(tree, parent);
+    bvh_refit(tree, above);
+}
+
+/* returns the new leaf, or BVH_NULL if the tree's full */
+static uint16_t bvh_insert(Bvh *tree, Aabb box, uint32_t user) {
+    uint16_t leaf = bvh_node_alloc(tree);
+    if (leaf == BVH_NULL) return BVH_NULL;
+    tree->nodes[leaf].box = (Aabb) { add3_f(box.lo, -BVH_MARGIN), add3_f(box.hi, BVH_MARGIN) };
+    tree->nodes[leaf].user = user;
+    bvh_attach(tree, leaf);
+    return leaf;
+}
+
+static void bvh_remove(Bvh *tree, uint16_t leaf) {
+    bvh_detach(tree, leaf);
+    bvh_node_free(tree, leaf);
+}
+
+/* for when what a leaf is for has moved or changed shape. returns 1 if
+   it had gone far enough to have to be put back in somewhere else. */
+static int bvh_move(Bvh *tree, uint16_t leaf, Aabb box) {
+    if (aabb_contains(tree->nodes[leaf].box, box)) return 0;
+    bvh_detach(tree, leaf);
+    tree->nodes[leaf].box = (Aabb) { add3_f(box.lo, -BVH_MARGIN), add3_f(box.hi, BVH_MARGIN) };
+    bvh_attach(tree, leaf);
+    return 1;
+}
+
+/* enough for any tree with fewer than 2^16 nodes that's anywhere near balanced */
+#define BVH_STACK 64
+
+/* writes the user of every leaf overlapping box into out, up to out_cap
+   of them, and returns how many it wrote */
+static uint32_t bvh_query(Bvh *tree, Aabb box, uint32_t *out, uint32_t out_cap) {
+    uint16_t stack[BVH_STACK];
+    uint32_t depth = 0, count = 0;
+    if (tree->root != BVH_NULL) stack[depth++] = tree->root;
+
+    while (depth) {
+        BvhNode *node = tree->nodes + stack[--depth];
+        if (!aabb_overlaps(node->box, box)) continue;
+        if (node->kids[0] == BVH_NULL) {
+            if (count < out_cap) out[count++] = node->user;
+        } else if (depth + 2 <= BVH_STACK) {
+            stack[depth++] = node->kids[0];
+            stack[depth++] = node->kids[1];
+        }
+    }
+    return count;
+}
+
+/* bvh_query, but for every leaf the ray p + rd * t passes through, t in 0..reach */
+static uint32_t bvh_ray(Bvh *tree, Vec3 p, Vec3 rd, float reach, uint32_t *out, uint32_t out_cap) {
+    uint16_t stack[BVH_STACK];
+    uint32_t depth = 0, count = 0;
+    if (tree->root != BVH_NULL) stack[depth++] = tree->root;
+
+    while (depth) {
+        BvhNode *node = tree->nodes + stack[--depth];
+        if (!aabb_ray(node->box, p, rd, reach)) continue;
+        if (node->kids[0] == BVH_NULL) {
+            if (count < out_cap) out[count++] = node->user;
+        } else if (depth + 2 <= BVH_STACK) {
+            stack[depth++] = node->kids[0];
+            stack[depth++] = node->kids[1];
+        }
+    }
+    return count;
+}
@@ -0,0 +1,224 @@
+/* Everything that gets pushed around by the same physics as the player:
+   mobs, dropped boxes, other players.
+
+   The player is one Body, stepped on its own by body_step. Everything
+   else lives in entities, where every field is its own array (SoA), so a
+   step over thousands of them streams through memory a field at a time
+   instead of dragging whole structs through the cache.
+
+   Bodies don't bump into each other, only into boxes, so how any one of
+   them moves depends on nothing but itself and the islands. That makes
+   a step easy to split across cores (see jobs.h): each tick they're
+   bucketed by which ENTITY_CELL of the world they're in, so bodies near
+   each other land in the same batch and share what's in the cache, and
+   the batches get handed out to the workers. Which thread steps which
+   batch can't change anything, so it all comes out the same as a
+   single-threaded step, and replays still line up.
+
+   entity_kill moves the last entity into the hole, so an index is only
+   good until the next kill. */
+
+typedef struct {
+    Vec3 pos, vel;
+    int8_t jump_cooldown, ground_cooldown;
+} Body;
+
+/* moves b by its velocity, and down, sliding along whatever boxes are in
+   the way (see island_sweep). its box goes up from its feet, half_width
+   out to either side.
+
+   only reads the islands, as long as island_broad_update has been run
+   since they last changed, so any number of these can go at once. */
+static void body_step(Body *b, float half_width, float height) {
+    /* falls faster the longer it's been off the ground */
+    float boost = (float) sat_i8(b->ground_cooldown - 10) / 100.0f;
+    float fall = 0.03f + 0.1f * max(0.0f, min(1.0f, boost));
+
+    b->jump_cooldown = sat_i8(b->jump_cooldown + 1);
+    if (b->jump_cooldown < 50)
+        b->vel.y += 0.0675f * (1.0f - (b->jump_cooldown / 50.0f));
+    b->vel = mul3_f(b->vel, 0.65f);
+
+    Aabb box = {
+        vec3(b->pos.x - half_width, b->pos.y, b->pos.z - half_width),
+        vec3(b->pos.x + half_width, b->pos.y + height, b->pos.z + half_width),
+    };
+    IslandStops stops;
+    Vec3 move = add3(b->vel, vec3(0.0f, -fall, 0.0f));
+    b->pos = add3(b->pos, island_sweep(box, move, &stops));
+
+    int touched_tile = 0;
+    for (uint32_t i = 0; i < stops.count; i++) {
+        Vec3 n = stops.normals[i];
+        /* whatever we were going into that box with is gone */
+        b->vel = sub3(b->vel, mul3_f(n, min(0.0f, dot3(b->vel, n))));
+
+        if (n.y > 0.7f)
+            touched_tile = 1;
+        else if (n.y < -0.7f)
+            /* ya done bumped ya head, go down faster! */
+            b->jump_cooldown = sat_i8(b->jump_cooldown + 5);
+    }
+    if (touched_tile)
+        b->ground_cooldown = min(0, sat_i8(b->ground_cooldown - 1));
+    else
+        b->ground_cooldown = max(0, sat_i8(b->ground_cooldown + 1));
+}
+
+#define MAX_ENTITIES (1 << 14)
+/* how many get stepped per job */
+#define ENTITY_BATCH (256)
+/* how big a square of the world gets bucketed together */
+#define ENTITY_CELL (16.0f)
+#define ENTITY_BUCKETS (256)
+
+static struct {
+    uint32_t count;
+    float pos_x[MAX_ENTITIES], pos_y[MAX_ENTITIES], pos_z[MAX_ENTITIES];
+    float vel_x[MAX_ENTITIES], vel_y[MAX_ENTITIES], vel_z[MAX_ENTITIES];
+    int8_t jump_cooldown[MAX_ENTITIES], ground_cooldown[MAX_ENTITIES];
+    float half_width[MAX_ENTITIES], height[MAX_ENTITIES];
+
+    /* the order they're stepped in, grouped by cell; redone every step */
+    uint16_t order[MAX_ENTITIES];
+} entities;
+
+/* where it can't be put anywhere, MAX_ENTITIES */
+static uint32_t entity_spawn(Vec3 pos, float half_width, float height) {
+    if (entities.count == MAX_ENTITIES) {
+        log_err("Out of entities, bump MAX_ENTITIES");
+        return MAX_ENTITIES;
+    }
+    uint32_t i = entities.count++;
+    entities.pos_x[i] = pos.x;
+    entities.pos_y[i] = pos.y;
+    entities.pos_z[i] = pos.z;
+    entities.vel_x[i] = entities.vel_y[i] = entities.vel_z[i] = 0.0f;
+    /* a jump_cooldown of 0 is the start of a jump */
+    entities.jump_cooldown[i] = INT8_MAX;
+    entities.ground_cooldown[i] = 0;
+    entities.half_width[i] = half_width;
+    entities.height[i] = height;
+    return i;
+}
+
+static void entity_kill(uint32_t i) {
+    uint32_t last = --entities.count;
+    if (i == last) return;
+    entities.pos_x[i] = entities.pos_x[last];
+    entities.pos_y[i] = entities.pos_y[last];
+    entities.pos_z[i] = entities.pos_z[last];
+    entities.vel_x[i] = entities.vel_x[last];
+    entities.vel_y[i] = entities.vel_y[last];
+    entities.vel_z[i] = entities.vel_z[last];
+    entities.jump_cooldown[i] = entities.jump_cooldown[last];
+    entities.ground_cooldown[i] = entities.ground_cooldown[last];
+    entities.half_width[i] = entities.half_width[last];
+    entities.height[i] = entities.height[last];
+}
+
+static Vec3 entity_pos(uint32_t i) {
+    return vec3(entities.pos_x[i], entities.pos_y[i], entities.pos_z[i]);
+}
+
+/* a counting sort of entities.order by cell, which keeps them in index
+   order inside each bucket */
+static void entity_bucket(void) {
+    uint8_t bucket_of[MAX_ENTITIES];
+    uint32_t start[ENTITY_BUCKETS + 1] = {0};
+    for (uint32_t i = 0; i < entities.count; i++) {
+        int32_t cx = (int32_t) floorf(entities.pos_x[i] / ENTITY_CELL);
+        int32_t cz = (int32_t) floorf(entities.pos_z[i] / ENTITY_CELL);
+        uint32_t h = ((uint32_t) cx * 0x9E3779B1u) ^ ((uint32_t) cz * 0x85EBCA77u);
+        bucket_of[i] = (uint8_t) (h >> 24);
+        start[bucket_of[i] + 1]++;
+    }
+    for (uint32_t b = 0; b < ENTITY_BUCKETS; b++)
+        start[b + 1] += start[b];
+    for (uint32_t i = 0; i < entities.count; i++)
+        entities.order[start[bucket_of[i]]++] = (uint16_t) i;
+}
+
+static void entity_step_batch(void *user, uint32_t batch) {
+    PROF_ZONE(ProfZone_EntityBatch) {
+        uint32_t end = min((batch + 1) * ENTITY_BATCH, entities.count);
+        for (uint32_t k = batch * ENTITY_BATCH; k < end; k++) {
+            uint16_t i = entities.order[k];
+            Body b = {
+                .pos = vec3(entities.pos_x[i], entities.pos_y[i], entities.pos_z[i]),
+                .vel = vec3(entities.vel_x[i], entities.vel_y[i], entities.vel_z[i]),
+                .jump_cooldown = entities.jump_cooldown[i],
+                .ground_cooldown = entities.ground_cooldown[i],
+            };
+            body_step(&b, entities.half_width[i], entities.height[i]);
+            entities.pos_x[i] = b.pos.x;
+            entities.pos_y[i] = b.pos.y;
+            entities.pos_z[i] = b.pos.z;
+            entities.vel_x[i] = b.vel.x;
+            entities.vel_y[i] = b.vel.y;
+            entities.vel_z[i] = b.vel.z;
+            entities.jump_cooldown[i] = b.jump_cooldown;
+            entities.ground_cooldown[i] = b.ground_cooldown;
+        }
+    }
+}
+
+/* steps every entity, across however many cores there are if parallel */
+static void entity_step(int parallel) {
+    if (entities.count == 0) return;
+    /* after this every island_near just reads the tree, so the jobs can share it */
+    island_broad_update();
+    entity_bucket();
+
+    uint32_t batches = (entities.count + ENTITY_BATCH - 1) / ENTITY_BATCH;
+    if (parallel)
+        jobs_run(entity_step_batch, NULL, batches);
+    else for (uint32_t b = 0; b < batches; b++)
+        entity_step_batch(NULL, b);
+}
+
+static uint64_t entity_hash(uint64_t h) {
+    uint32_t n = entities.count;
+    h = replay_hash_bytes(h, &n, sizeof(n));
+    h = replay_hash_bytes(h, entities.pos_x, n * sizeof(float));
+    h = replay_hash_bytes(h, entities.pos_y, n * sizeof(float));
+    h = replay_hash_bytes(h, entities.pos_z, n * sizeof(float));
+    h = replay_hash_bytes(h, entities.vel_x, n * sizeof(float));
+    h = replay_hash_bytes(h, entities.vel_y, n * sizeof(float));
+    h = replay_hash_bytes(h, entities.vel_z, n * sizeof(float));
+    h = replay_hash_bytes(h, entities.jump_cooldown, n);
+    h = replay_hash_bytes(h, entities.ground_cooldown, n);
+    return h;
+}
+
+/* the live ones, for the start of a recording; see replay.h */
+static void entity_record(void) {
+    uint32_t n = entities.count;
+    replay_put(&n, sizeof(n));
+    replay_put(entities.pos_x, n * sizeof(float));
+    replay_put(entities.pos_y, n * sizeof(float));
+    replay_put(entities.pos_z, n * sizeof(float));
+    replay_put(entities.vel_x, n * sizeof(float));
+    replay_put(entities.vel_y, n * sizeof(float));
+    replay_put(entities.vel_z, n * sizeof(float));
+    replay_put(entities.jump_cooldown, n);
+    replay_put(entities.ground_cooldown, n);
+    replay_put(entities.half_width, n * sizeof(float));
+    replay_put(entities.height, n * sizeof(float));
+}
+
+static int entity_replay(void) {
+    uint32_t n = 0;
+    if (!replay_get(&n, sizeof(n)) || n > MAX_ENTITIES) return 0;
+    entities.count = n;
+    return replay_get(entities.pos_x, n * sizeof(float))
+        && replay_get(entities.pos_y, n * sizeof(float))
+        && replay_get(entities.pos_z, n * sizeof(float))
+        && replay_get(entities.vel_x, n * sizeof(float))
+        && replay_get(entities.vel_y, n * sizeof(float))
+        && replay_get(entities.vel_z, n * sizeof(float))
+        && replay_get(entities.jump_cooldown, n)
+        && replay_get(entities.ground_cooldown, n)
+        && replay_get(entities.half_width, n * sizeof(float))
+        && replay_get(entities.height, n * sizeof(float));
+}
@@ -0,0 +1,334 @@
+/* Reading boxes from threads other than the sim thread, without locks.
+
+   Islands get edited in place on the sim thread, so nothing else can
+   look at them while a tick is going. What other threads get instead are
+   BoxViews: a read only copy of one occupancy chunk, with the kind of
+   every cell in it. After every tick, box_view_publish catches each
+   island's views up on its version log (see box.h). A chunk that changed
+   gets copied into a new view and the changes go into that, the ones
+   that didn't are shared, and all of them go into a new BoxViewSet that's
+   swapped in for the island's old one in one go. Nothing that's been
+   published ever changes again, so a reader sees every chunk of an
+   island as of the same tick.
+
+   The old set, and views it had that the new one doesn't, can't be reused
+   while somebody might still be reading them. That's what the epoch is
+   for:
+
+     uint32_t r = epoch_join();   once per thread
+     epoch_pin(r);
+     BoxViewSet *s = box_view_set(island);
+     ... read s, and any view in it ...
+     epoch_unpin(r);
+
+   Pinning notes which epoch the reader started in. Anything the sim thread
+   takes out of use gets retired at the epoch it's at, and the epoch only
+   goes up once every pinned reader has caught up to it, so by the time
+   it's two past something's retirement everyone who could've seen it has
+   unpinned, and it goes back in its pool. Don't stay pinned across
+   anything long: nothing retired since gets freed until you're done. */
+
+#define EPOCH_MAX_READERS 32
+#define EPOCH_MAX_RETIRED 4096
+
+typedef void EpochFree(void *p);
+
+static struct {
+    /* starts at 1 so a reader's 0 can mean it isn't pinned. at a tick
+       apiece that's a year before it'd wrap. */
+    volatile LONG global;
+    volatile LONG readers;
+    volatile LONG pinned[EPOCH_MAX_READERS];
+
+    /* the sim thread's alone, oldest first */
+    uint32_t retired_head, retired_count;
+    struct { void *p; EpochFree *free; LONG epoch; } retired[EPOCH_MAX_RETIRED];
+} epoch = { .global = 1 };
+
+/* EPOCH_MAX_READERS if there's no room for another */
+static uint32_t epoch_join(void) {
+    LONG r = InterlockedIncrement(&epoch.readers) - 1;
+    if (r >= EPOCH_MAX_READERS) {
+        log_err("Out of epoch readers, bump EPOCH_MAX_READERS");
+        return EPOCH_MAX_READERS;
+    }
+    return (uint32_t) r;
+}
+
+static void epoch_pin(uint32_t r) {
+    /* the exchange is a full barrier, so nothing read after this can have
+       been read before the pin shows */
+    InterlockedExchange(epoch.pinned + r, InterlockedCompareExchange(&epoch.global, 0, 0));
+}
+
+static void epoch_unpin(uint32_t r) {
+    InterlockedExchange(epoch.pinned + r, 0);
+}
+
+/* frees whatever nobody can be reading anymore. returns how many are still
+   waiting. sim thread only. */
+static uint32_t epoch_collect(void) {
+    /* readers' compare exchanges count as writes, so even reading what
+       only this thread changes goes through one */
+    LONG global = InterlockedCompareExchange(&epoch.global, 0, 0);
+    int behind = 0;
+    LONG readers = min(InterlockedCompareExchange(&epoch.readers, 0, 0), EPOCH_MAX_READERS);
+    for (LONG r = 0; r < readers; r++) {
+        LONG pin = InterlockedCompareExchange(epoch.pinned + r, 0, 0);
+        behind |= pin != 0 && pin != global;
+    }
+    if (!behind) global = InterlockedIncrement(&epoch.global);
+
+    while (epoch.retired_count) {
+        uint32_t i = epoch.retired_head;
+        if (epoch.retired[i].epoch + 2 > global) break;
+        epoch.retired[i].free(epoch.retired[i].p);
+        epoch.retired_head = (i + 1) % EPOCH_MAX_RETIRED;
+        epoch.retired_count--;
+    }
+    return epoch.retired_count;
+}
+
+/* p has to be unreachable for anybody who pins from here on. sim thread only. */
+static void epoch_retire(void *p, EpochFree *free) {
+    /* full up with things readers are hanging on to; wait them out */
+    while (epoch.retired_count == EPOCH_MAX_RETIRED) {
+        epoch_collect();
+        YieldProcessor();
+    }
+    uint32_t i = (epoch.retired_head + epoch.retired_count++) % EPOCH_MAX_RETIRED;
+    epoch.retired[i].p = p;
+    epoch.retired[i].free = free;
+    epoch.retired[i].epoch = InterlockedCompareExchange(&epoch.global, 0, 0);
+}
+
+typedef struct {
+    BoxPos pos;
+    uint16_t count;
+    uint64_t cols[BOX_CHUNK_SIZE][BOX_CHUNK_SIZE / 4];
+    /* by box_chunk_index */
+    uint8_t kinds[BOX_CHUNK_SIZE * BOX_CHUNK_SIZE * BOX_CHUNK_SIZE];
+} BoxView;
+
+typedef struct {
+    /* which island, and how far along its log */
+    uint32_t uid, version;
+    uint16_t count;
+    BoxView *views[MAX_BOX_OCCS];
+    /* chunk pos to 1 + where it is in views */
+    PosMapSlot slots[MAX_BOX_OCCS * 2];
+} BoxViewSet;
+
+#define MAX_BOX_VIEWS (MAX_ISLANDS * MAX_BOX_OCCS * 2)
+#define MAX_BOX_VIEW_SETS (MAX_ISLANDS * 8)
+
+static struct {
+    /* what readers see */
+    BoxViewSet *volatile sets[MAX_ISLANDS];
+
+    /* the rest is the sim thread's */
+    int started;
+    BoxView views[MAX_BOX_VIEWS];
+    BoxViewSet view_sets[MAX_BOX_VIEW_SETS];
+    uint16_t free_views[MAX_BOX_VIEWS], free_view_count;
+    uint16_t free_sets[MAX_BOX_VIEW_SETS], free_set_count;
+} box_views;
+
+static PosMap box_view_map(BoxViewSet *s) {
+    return (PosMap) { s->slots, _countof(s->slots) - 1 };
+}
+
+/* the island's latest, or NULL if it isn't there. only good while pinned. */
+static BoxViewSet *box_view_set(uint32_t island) {
+    return InterlockedCompareExchangePointer((void *volatile *) (box_views.sets + island), NULL, NULL);
+}
+
+static BoxView *box_view_chunk(BoxViewSet *s, BoxPos chunk_pos) {
+    PosMap map = box_view_map(s);
+    uint16_t i = pos_map_get(&map, chunk_pos);
+    return i ? s->views[i - 1] : NULL;
+}
+
+static BoxKind box_view_kind(BoxViewSet *s, BoxPos p) {
+    BoxView *v = box_view_chunk(s, box_chunk_pos(p));
+    return v ? (BoxKind) v->kinds[box_chunk_index(p)] : BoxKind_Unoccupied;
+}
+
+static void box_view_free(void *p) {
+    box_views.free_views[box_views.free_view_count++] = (uint16_t) ((BoxView *) p - box_views.views);
+}
+
+static void box_view_set_free(void *p) {
+    box_views.free_sets[box_views.free_set_count++] = (uint16_t) ((BoxViewSet *) p - box_views.view_sets);
+}
+
+/* when a pool's out, whatever's retired is on its way back, so wait for it */
+static BoxView *box_view_alloc(void) {
+    while (box_views.free_view_count == 0 && epoch_collect()) YieldProcessor();
+    if (box_views.free_view_count == 0) {
+        log_err("Out of box views, bump MAX_BOX_VIEWS");
+        return NULL;
+    }
+    return box_views.views + box_views.free_views[--box_views.free_view_count];
+}
+
+static BoxViewSet *box_view_set_alloc(void) {
+    while (box_views.free_set_count == 0 && epoch_collect()) YieldProcessor();
+    if (box_views.free_set_count == 0) {
+        log_err("Out of box view sets, bump MAX_BOX_VIEW_SETS");
+        return NULL;
+    }
+    return box_views.view_sets + box_views.free_sets[--box_views.free_set_count];
+}
+
+static void box_view_init(void) {
+    box_views.started = 1;
+    for (uint32_t i = 0; i < MAX_BOX_VIEWS; i++)
+        box_views.free_views[box_views.free_view_count++] = (uint16_t) (MAX_BOX_VIEWS - 1 - i);
+    for (uint32_t i = 0; i < MAX_BOX_VIEW_SETS; i++)
+        box_views.free_sets[box_views.free_set_count++] = (uint16_t) (MAX_BOX_VIEW_SETS - 1 - i);
+}
+
+/* puts v in s; returns where, or -1 if it's full */
+static int box_view_add(BoxViewSet *s, BoxView *v) {
+    PosMap map = box_view_map(s);
+    if (s->count == MAX_BOX_OCCS || !pos_map_set(&map, v->pos, s->count + 1)) return -1;
+    s->views[s->count] = v;
+    return s->count++;
+}
+
+static void box_view_apply(BoxView *v, BoxChange c) {
+    uint64_t *col = &v->cols[c.pos.x & 15][(c.pos.z & 15) >> 2], bit = box_occ_bit(c.pos);
+    if (c.kind != BoxKind_Unoccupied && !(*col & bit)) v->count++;
+    if (c.kind == BoxKind_Unoccupied && (*col & bit)) v->count--;
+    *col = c.kind != BoxKind_Unoccupied ? *col | bit : *col & ~bit;
+    v->kinds[box_chunk_index(c.pos)] = (uint8_t) c.kind;
+}
+
+/* copies over every chunk from scratch */
+static int box_view_build(BoxViewSet *s, Island *isl) {
+    for (uint16_t occ = 1; occ < MAX_BOX_OCCS; occ++) if (isl->occs[occ].count) {
+        BoxView *v = box_view_alloc();
+        if (v == NULL) return 0;
+        v->pos = isl->occs[occ].pos;
+        v->count = isl->occs[occ].count;
+        memcpy(v->cols, isl->occs[occ].cols, sizeof(v->cols));
+        memset(v->kinds, 0, sizeof(v->kinds));
+        if (box_view_add(s, v) < 0) {
+            box_view_free(v);
+            return 0;
+        }
+    }
+    for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id])) {
+        BoxView *v = box_view_chunk(s, box_chunk_pos(isl->boxes[id].pos));
+        if (v) v->kinds[box_chunk_index(isl->boxes[id].pos)] = (uint8_t) isl->boxes[id].kind;
+    }
+    return 1;
+}
+
+/* s starts out sharing old's views; a chunk that's changed since gets
+   copied the first time it's touched, and those copies get the changes.
+   the views that were copied are written to replaced. */
+static int box_view_catch_up(BoxViewSet *s, BoxViewSet *old, Island *isl,
+                             BoxView **replaced, uint32_t *replaced_count) {
+    uint64_t fresh = 0;
+    for (uint32_t v = old->version; v != isl->version; v++) {
+        BoxChange c = isl->log[v % BOX_LOG_SIZE];
+        PosMap map = box_view_map(s);
+        BoxPos cp = box_chunk_pos(c.pos);
+        int i = (int) pos_map_get(&map, cp) - 1;
+
+        if (i < 0 || !(fresh & ((uint64_t) 1 << i))) {
+            BoxView *copy = box_view_alloc();
+            if (copy == NULL) return 0;
+            if (i < 0) {
+                memset(copy, 0, sizeof(BoxView));
+                copy->pos = cp;
+                if ((i = box_view_add(s, copy)) < 0) {
+                    box_view_free(copy);
+                    return 0;
+                }
+            } else {
+                memcpy(copy, s->views[i], sizeof(BoxView));
+                replaced[(*replaced_count)++] = s->views[i];
+                s->views[i] = copy;
+            }
+            fresh |= (uint64_t) 1 << i;
+        }
+        box_view_apply(s->views[i], c);
+    }
+
+    /* the ones that emptied out were all copied, so nobody's seen them;
+       moving the last into the hole keeps them packed */
+    for (int i = s->count - 1; i >= 0; i--) if (s->views[i]->count == 0) {
+        PosMap map = box_view_map(s);
+        pos_map_del(&map, s->views[i]->pos);
+        box_view_free(s->views[i]);
+        s->views[i] = s->views[--s->count];
+        if (i != s->count) pos_map_set(&map, s->views[i]->pos, (uint16_t) (i + 1));
+    }
+    return 1;
+}
+
+static void box_view_retire_set(BoxViewSet *s, int with_views) {
+    if (with_views)
+        for (uint16_t i = 0; i < s->count; i++)
+            epoch_retire(s->views[i], box_view_free);
+    epoch_retire(s, box_view_set_free);
+}
+
+/* catches every island's BoxViewSet up on its edits, and frees whatever
+   readers are done with. sim thread only, after a tick.
+
+   until some thread's joined there's nobody to publish to, so it doesn't.
+   nothing's been published then either, so the first tick after a join
+   finds every set missing and builds them all from scratch. */
+static void box_view_publish(void) {
+    if (InterlockedCompareExchange(&epoch.readers, 0, 0) == 0) return;
+    if (!box_views.started) box_view_init();
+
+    for (uint32_t i = 0; i < MAX_ISLANDS; i++) {
+        Island *isl = islands + i;
+        BoxViewSet *old = box_view_set(i);
+        if (!island_used[i]) {
+            if (old == NULL) continue;
+            InterlockedExchangePointer((void *volatile *) (box_views.sets + i), NULL);
+            box_view_retire_set(old, 1);
+            continue;
+        }
+        if (old && old->uid == isl->uid && old->version == isl->version) continue;
+
+        BoxViewSet *s = box_view_set_alloc();
+        if (s == NULL) continue;
+        BoxView *replaced[MAX_BOX_OCCS];
+        uint32_t replaced_count = 0;
+        int ok, incremental = old && old->uid == isl->uid && box_log_has(isl, old->version);
+        if (incremental) {
+            memcpy(s, old, sizeof(BoxViewSet));
+            ok = box_view_catch_up(s, old, isl, replaced, &replaced_count);
+        } else {
+            memset(s, 0, sizeof(BoxViewSet));
+            ok = box_view_build(s, isl);
+        }
+        s->uid = isl->uid;
+        s->version = isl->version;
+
+        if (!ok) {
+            /* whatever it got through that old doesn't have is nobody else's */
+            for (uint16_t v = 0; v < s->count; v++) {
+                int shared = 0;
+                for (uint16_t o = 0; old && o < old->count && !shared; o++)
+                    shared = old->views[o] == s->views[v];
+                if (!shared) box_view_free(s->views[v]);
+            }
+            box_view_set_free(s);
+            continue;
+        }
+
+        InterlockedExchangePointer((void *volatile *) (box_views.sets + i), s);
+        if (old) box_view_retire_set(old, !incremental);
+        for (uint32_t r = 0; r < replaced_count; r++)
+            epoch_retire(replaced[r], box_view_free);
+    }
+    epoch_collect();
+}
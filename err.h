@@ -13,6 +13,62 @@ static void log_err(const char *msg) {
     #endif
 }
 
+/* no sprintf without a CRT, so debug text gets built up by hand in one of these */
+typedef struct { char *buf; uint32_t len, cap; } Fmt;
+
+static void fmt_str(Fmt *f, const char *s) {
+    while (*s && f->len < f->cap)
+        f->buf[f->len++] = *s++;
+}
+
+static void fmt_u64(Fmt *f, uint64_t u) {
+    char digits[20];
+    int n = 0;
+    do digits[n++] = (char) ('0' + u % 10); while (u /= 10);
+    while (n && f->len < f->cap)
+        f->buf[f->len++] = digits[--n];
+}
+
+static void fmt_i64(Fmt *f, int64_t i) {
+    /* negated unsigned, so INT64_MIN doesn't overflow */
+    uint64_t u = (uint64_t) i;
+    if (i < 0) {
+        fmt_str(f, "-");
+        u = 0 - u;
+    }
+    fmt_u64(f, u);
+}
+
+/* fixed point, which is plenty for timings and byte counts */
+static void fmt_f32(Fmt *f, float x, int decimals) {
+    if (x < 0.0f) {
+        fmt_str(f, "-");
+        x = -x;
+    }
+    int64_t scale = 1;
+    for (int i = 0; i < decimals; i++) scale *= 10;
+    /* int64_t, not uint64_t: unsigned float conversion calls into the CRT */
+    int64_t fixed = (int64_t) (x * (float) scale + 0.5f);
+    fmt_u64(f, (uint64_t) (fixed / scale));
+    if (decimals == 0) return;
+
+    fmt_str(f, ".");
+    int64_t frac = fixed % scale;
+    for (int64_t s = scale / 10; s > 0; s /= 10)
+        fmt_u64(f, (uint64_t) ((frac / s) % 10));
+}
+
+/* dumps the Fmt, with a newline, the same place log_err goes */
+static void log_fmt(Fmt *f) {
+    #if USE_DEBUG_MODE
+    if (f->len == f->cap) f->len--;
+    f->buf[f->len] = '\0';
+    OutputDebugStringA(f->buf);
+    OutputDebugStringA("\n");
+    #endif
+    f->len = 0;
+}
+
 static void log_win32_err(DWORD err, const char *msg) {
     #if USE_DEBUG_MODE
     log_err(msg);
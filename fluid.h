@@ -0,0 +1,493 @@
+/* Water and sand, flowing around the island grid a cell at a time.
+
+   Sand falls straight down if it can, sinks through water by trading places
+   with it, and otherwise slides down a diagonal. Water falls the same way,
+   and runs sideways too, but only while there's more water on top of it
+   pushing; a puddle with nothing on it stays put, so it all settles.
+   Anything falling out the bottom of its island is gone. Both are just
+   boxes, moved with box_move_batch, so they keep their ids, and mesh,
+   light and go out over the network off of the box log like anything else.
+   They're LOOSE though, so they don't hold islands together (island.h).
+
+   Only active cells get looked at. A cell's active for a tick if it moved
+   last tick or something next to it changed: a fluid leaving or landing
+   (found through the links it had, so no lookups) or any other edit, which
+   fluid_wake catches up on out of the box logs. One that tried everything
+   and had nowhere to go drops out until something around it changes again.
+
+   A tick goes a chunk at a time, in 8 passes, one for each way a chunk's
+   x, y and z can be odd or even. Chunks in a pass are two apart, and
+   nothing moves more than a cell, so none of them can reach anything
+   another one does, and jobs_run does a pass's chunks all at once. Each
+   only reads the grid, and works out its moves bottom up against what it's
+   vacated and claimed itself, so a column can fall together; the moves are
+   applied between passes, a pass's all in one batch. The active list is
+   double buffered: this tick's comes out of one, next tick's goes into the
+   other.
+
+   Which way a cell tries first comes off of a hash of the tick and where it
+   is, not an rng, so it doesn't matter which job gets there first. Replays
+   only keep the tick; everything loose wakes up on the first one, and
+   anything that couldn't move before still can't. */
+
+#define FLUID_MAX_ACTIVE (MAX_ISLANDS * MAX_BOXES)
+/* changes around which things get woken up, per tick; past this, everything
+   loose in the islands they'd have woken wakes up */
+#define FLUID_MAX_WAKES 128
+/* passes with fewer cells than this aren't worth waking the workers for */
+#define FLUID_PARALLEL_MIN 256
+
+typedef struct { uint32_t uid; BoxPos pos; BoxId id; } FluidCell;
+
+typedef enum { FluidDo_Stay, FluidDo_Move, FluidDo_Swap, FluidDo_Fall } FluidDo;
+/* what a cell's job worked out for it. FluidDo_Swap trades places with
+   other, which is what's at to. */
+typedef struct { BoxId id, other; BoxPos to; uint8_t what; } FluidMove;
+
+static struct {
+    /* starts at 1, so a 0 stamp never matches */
+    uint32_t tick;
+
+    FluidCell active[2][FLUID_MAX_ACTIVE];
+    uint32_t count[2];
+    /* active[cur] is this tick's */
+    uint32_t cur;
+
+    /* which island each slot had, and how far through its log fluid_wake got */
+    uint32_t seen_uid[MAX_ISLANDS], seen_version[MAX_ISLANDS];
+    /* the tick a box was last put on a list for, and where on it, and the
+       tick it last moved on */
+    uint32_t queued[MAX_ISLANDS][MAX_BOXES], moved[MAX_ISLANDS][MAX_BOXES];
+    uint16_t queued_at[MAX_ISLANDS][MAX_BOXES];
+
+    /* where things changed, by which island's loose boxes shouldn't bother
+       (MAX_ISLANDS for none) */
+    BoxPos wake_at[FLUID_MAX_WAKES];
+    uint8_t wake_skip[FLUID_MAX_WAKES];
+    uint32_t wake_count;
+    uint8_t wake_all[MAX_ISLANDS];
+
+    /* running totals, for bench.h */
+    uint64_t looked_at, moves, fell;
+} fluid = { .tick = 1 };
+
+/* every cell a change at the middle one can give somewhere to go: the ones
+   above and beside it, and the ones diagonally above */
+static const BoxPos fluid_wake_offsets[11] = {
+    { 0, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 },
+    { 1, 0, 0 }, { -1, 0, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+    { 1, 1, 0 }, { -1, 1, 0 }, { 0, 1, 1 }, { 0, 1, -1 },
+};
+static const Face fluid_sides[4] = { Face_Left, Face_Front, Face_Right, Face_Back };
+
+static PosMapSlot fluid_wake_slots[MAX_BOXES * 2];
+
+/* puts a loose box on the list for tick stamp, which is this one or the
+   next, or if it's already on it, where it's got to since */
+static void fluid_queue(int i, BoxId id, uint32_t stamp) {
+    Island *isl = islands + i;
+    if (id == BoxId_NULL || !LOOSE(isl->boxes[id])) return;
+    uint32_t list = fluid.cur ^ (stamp != fluid.tick);
+    if (fluid.queued[i][id] == stamp) {
+        fluid.active[list][fluid.queued_at[i][id]].pos = isl->boxes[id].pos;
+        return;
+    }
+    fluid.queued[i][id] = stamp;
+    fluid.queued_at[i][id] = (uint16_t) fluid.count[list];
+    fluid.active[list][fluid.count[list]++] = (FluidCell) { isl->uid, isl->boxes[id].pos, id };
+}
+
+static void fluid_wake_near(BoxPos p, int skip) {
+    if (fluid.wake_count == FLUID_MAX_WAKES) {
+        for (int i = 0; i < MAX_ISLANDS; i++)
+            if (i != skip) fluid.wake_all[i] = 1;
+        return;
+    }
+    fluid.wake_at[fluid.wake_count] = p;
+    fluid.wake_skip[fluid.wake_count++] = (uint8_t) skip;
+}
+
+/* works out this tick's list: last tick's, less whatever got moved or
+   renumbered out from under it, plus everything loose near a change made
+   since (other than fluid_tick's own, which it already woke up) */
+static void fluid_wake(void) {
+    for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+        Island *isl = islands + i;
+        if (isl->uid != fluid.seen_uid[i]) {
+            /* anything stamped was for whatever had the slot before */
+            memset(fluid.queued[i], 0, sizeof(fluid.queued[i]));
+            fluid.seen_uid[i] = isl->uid;
+            fluid.wake_all[i] = 1;
+            continue;
+        }
+        if (!box_log_has(isl, fluid.seen_version[i])) {
+            fluid.wake_all[i] = 1;
+            continue;
+        }
+        for (uint32_t v = fluid.seen_version[i]; v != isl->version; v++)
+            fluid_wake_near(isl->log[v % BOX_LOG_SIZE].pos, MAX_ISLANDS);
+    }
+
+    /* the ones that aren't where they were get looked up by where that was */
+    FluidCell *cells = fluid.active[fluid.cur];
+    uint32_t n = fluid.count[fluid.cur], kept = 0;
+    uint64_t mark = arena_mark(&arena_frame);
+    BoxPos *lost = arena_push(&arena_frame, n * sizeof(BoxPos));
+    uint8_t *lost_in = arena_push(&arena_frame, n);
+    uint32_t lost_count = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        FluidCell c = cells[k];
+        int i = 0;
+        while (i < MAX_ISLANDS && !(island_used[i] && islands[i].uid == c.uid)) i++;
+        if (i < MAX_ISLANDS && eq_bp(islands[i].boxes[c.id].pos, c.pos) && LOOSE(islands[i].boxes[c.id])) {
+            fluid.queued_at[i][c.id] = (uint16_t) kept;
+            cells[kept++] = c;
+            continue;
+        }
+        if (i < MAX_ISLANDS) fluid.queued[i][c.id] = 0;
+        Island *now = island_at(c.pos);
+        if (now == NULL) continue;
+        if (lost == NULL || lost_in == NULL) fluid.wake_all[now - islands] = 1;
+        else {
+            lost[lost_count] = c.pos;
+            lost_in[lost_count++] = (uint8_t) (now - islands);
+        }
+    }
+    fluid.count[fluid.cur] = kept;
+
+    PosMap map = { fluid_wake_slots, _countof(fluid_wake_slots) - 1 };
+    for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+        Island *isl = islands + i;
+        /* the map's never let get more than half full */
+        uint32_t set = 0;
+        for (uint32_t w = 0; w < fluid.wake_count && set < MAX_BOXES && !fluid.wake_all[i]; w++) {
+            if (fluid.wake_skip[w] == i) continue;
+            if (set == 0) memset(fluid_wake_slots, 0, sizeof(fluid_wake_slots));
+            for (int o = 0; o < _countof(fluid_wake_offsets); o++, set++)
+                pos_map_set(&map, add_bp(fluid.wake_at[w], fluid_wake_offsets[o]), 1);
+        }
+        for (uint32_t l = 0; l < lost_count && set < MAX_BOXES && !fluid.wake_all[i]; l++) {
+            if (lost_in[l] != i) continue;
+            if (set == 0) memset(fluid_wake_slots, 0, sizeof(fluid_wake_slots));
+            pos_map_set(&map, lost[l], 1);
+            set++;
+        }
+        if (set >= MAX_BOXES) fluid.wake_all[i] = 1;
+
+        if (fluid.wake_all[i] || set)
+            for (BoxId id = 1; id < MAX_BOXES; id++)
+                if (LOOSE(isl->boxes[id]) && (fluid.wake_all[i] || pos_map_get(&map, isl->boxes[id].pos)))
+                    fluid_queue(i, id, fluid.tick);
+        fluid.wake_all[i] = 0;
+        fluid.seen_version[i] = isl->version;
+    }
+    fluid.wake_count = 0;
+    arena_pop(&arena_frame, mark);
+}
+
+/* which way to try first */
+static uint32_t fluid_first_side(BoxPos p) {
+    uint32_t h = fluid.tick * 0x9E3779B1u ^ (uint16_t) p.x * 0x85EBCA77u
+               ^ (uint16_t) p.y * 0xC2B2AE3Du ^ (uint16_t) p.z * 0x27D4EB2Fu;
+    return h ^ (h >> 15);
+}
+
+/* A job's view of the grid: everything in its chunk and a cell around it,
+   going by the grid as it was when the pass started, with what the job's
+   already moved out of and into on top. */
+#define FLUID_VIEW (BOX_CHUNK_SIZE + 2)
+#define FLUID_VIEW_WORDS ((FLUID_VIEW * FLUID_VIEW * FLUID_VIEW + 63) / 64)
+typedef struct {
+    BoxPos lo;
+    uint64_t vacated[FLUID_VIEW_WORDS], claimed[FLUID_VIEW_WORDS];
+} FluidView;
+
+static uint32_t fluid_view_bit(FluidView *v, BoxPos p) {
+    return ((p.y - v->lo.y) * FLUID_VIEW + (p.z - v->lo.z)) * FLUID_VIEW + (p.x - v->lo.x);
+}
+static int fluid_view_has(uint64_t *bits, uint32_t b) {
+    return (int) (bits[b >> 6] >> (b & 63)) & 1;
+}
+static int fluid_free(FluidView *v, BoxPos p) {
+    uint32_t b = fluid_view_bit(v, p);
+    if (fluid_view_has(v->claimed, b)) return 0;
+    return fluid_view_has(v->vacated, b) || island_at(p) == NULL;
+}
+static void fluid_view_move(FluidView *v, BoxPos from, BoxPos to) {
+    uint32_t f = fluid_view_bit(v, from), t = fluid_view_bit(v, to);
+    v->vacated[f >> 6] |= (uint64_t) 1 << (f & 63);
+    v->claimed[t >> 6] |= (uint64_t) 1 << (t & 63);
+}
+
+typedef struct {
+    Island *isl;
+    int i;
+    /* nothing's under the bottom of the island's lowest chunk */
+    int16_t bottom;
+    /* sorted, bottom up in each chunk; the low bits are where in the list */
+    uint64_t *keys;
+    FluidMove *out;
+    /* where each chunk's cells start in keys, and one past the last */
+    uint32_t *starts;
+} FluidPass;
+#define FLUID_KEY_INDEX(key) ((uint32_t) ((key) & 0xFFFFFF))
+
+/* one chunk of a pass; runs as a job, so it only reads the grid, and only
+   writes to its own cells' out and moved stamps, and to the moved stamp of
+   any water it sinks sand through, which nothing else in the pass can reach */
+static void fluid_chunk(void *user, uint32_t j) {
+    FluidPass *pass = user;
+    Island *isl = pass->isl;
+    FluidCell *cells = fluid.active[fluid.cur];
+    uint32_t start = pass->starts[j], end = pass->starts[j + 1];
+
+    FluidView v;
+    memset(&v, 0, sizeof(v));
+    BoxPos chunk = box_chunk_pos(cells[FLUID_KEY_INDEX(pass->keys[start])].pos);
+    v.lo = (BoxPos) { chunk.x * BOX_CHUNK_SIZE - 1, chunk.y * BOX_CHUNK_SIZE - 1, chunk.z * BOX_CHUNK_SIZE - 1 };
+
+    for (uint32_t k = start; k < end; k++) {
+        FluidCell *c = cells + FLUID_KEY_INDEX(pass->keys[k]);
+        FluidMove *m = pass->out + k;
+        *m = (FluidMove) { c->id, BoxId_NULL, c->pos, FluidDo_Stay };
+        /* sand already sank through it this tick */
+        if (fluid.moved[pass->i][c->id] == fluid.tick) continue;
+
+        BoxPos p = c->pos, below = add_bp(p, face_offset[Face_Below]);
+        BoxKind kind = isl->boxes[c->id].kind;
+        if (below.y < pass->bottom && fluid_free(&v, below)) {
+            uint32_t at = fluid_view_bit(&v, p);
+            v.vacated[at >> 6] |= (uint64_t) 1 << (at & 63);
+            m->what = FluidDo_Fall;
+            continue;
+        }
+        if (fluid_free(&v, below)) {
+            m->what = FluidDo_Move;
+            m->to = below;
+            fluid_view_move(&v, p, below);
+            continue;
+        }
+
+        uint32_t b = fluid_view_bit(&v, below);
+        BoxId under = box_neighbor(isl, c->id, Face_Below);
+        if (kind == BoxKind_Sand && under && isl->boxes[under].kind == BoxKind_Water &&
+            !fluid_view_has(v.claimed, b) && !fluid_view_has(v.vacated, b) &&
+            fluid.moved[pass->i][under] != fluid.tick) {
+            fluid.moved[pass->i][under] = fluid.tick;
+            *m = (FluidMove) { c->id, under, below, FluidDo_Swap };
+            fluid_view_move(&v, p, below);
+            fluid_view_move(&v, below, p);
+            continue;
+        }
+
+        uint32_t first = fluid_first_side(p);
+        for (uint32_t s = 0; s < 4 && m->what == FluidDo_Stay; s++) {
+            BoxPos side = add_bp(p, face_offset[fluid_sides[(first + s) & 3]]);
+            BoxPos down = add_bp(side, face_offset[Face_Below]);
+            if (fluid_free(&v, side) && fluid_free(&v, down)) {
+                m->what = FluidDo_Move;
+                m->to = down;
+            }
+        }
+
+        BoxId over = box_neighbor(isl, c->id, Face_Above);
+        if (kind == BoxKind_Water && m->what == FluidDo_Stay && over && isl->boxes[over].kind == BoxKind_Water)
+            for (uint32_t s = 0; s < 4 && m->what == FluidDo_Stay; s++) {
+                BoxPos side = add_bp(p, face_offset[fluid_sides[(first + s) & 3]]);
+                if (fluid_free(&v, side)) {
+                    m->what = FluidDo_Move;
+                    m->to = side;
+                }
+            }
+
+        if (m->what == FluidDo_Move) fluid_view_move(&v, p, m->to);
+    }
+}
+
+/* applies what a pass's jobs worked out, all in one batch, and puts
+   whatever that moved or woke up on next tick's list */
+static void fluid_apply(FluidPass *pass, uint32_t start, uint32_t end) {
+    Island *isl = pass->isl;
+    int i = pass->i, others = 0;
+    for (int o = 0; o < MAX_ISLANDS; o++) others += island_used[o] && o != i;
+
+    uint64_t mark = arena_mark(&arena_frame);
+    uint32_t n = end - start;
+    BoxId *ids = arena_push(&arena_frame, 2 * n * sizeof(BoxId));
+    BoxPos *to = arena_push(&arena_frame, 2 * n * sizeof(BoxPos));
+    BoxId *woke = arena_push(&arena_frame, 9 * n * sizeof(BoxId));
+    if (ids == NULL || to == NULL || woke == NULL) {
+        /* they'll all get another go next tick */
+        arena_pop(&arena_frame, mark);
+        for (uint32_t k = start; k < end; k++)
+            fluid_queue(i, pass->out[k].id, fluid.tick + 1);
+        return;
+    }
+
+    /* trading places goes first, the way journal_move_batch wants it */
+    uint32_t count = 0, woke_count = 0;
+    for (uint32_t k = start; k < end; k++) {
+        FluidMove *m = pass->out + k;
+        if (m->what != FluidDo_Swap) continue;
+        BoxPos from = isl->boxes[m->id].pos;
+        if (others) {
+            fluid_wake_near(from, i);
+            fluid_wake_near(m->to, i);
+        }
+        ids[count] = m->id;
+        to[count++] = m->to;
+        ids[count] = m->other;
+        to[count++] = from;
+    }
+    uint32_t swaps = count / 2;
+
+    for (uint32_t k = start; k < end; k++) {
+        FluidMove *m = pass->out + k;
+        if (m->what == FluidDo_Stay || m->what == FluidDo_Swap) continue;
+        BoxPos from = isl->boxes[m->id].pos;
+        if (others) {
+            fluid_wake_near(from, i);
+            fluid_wake_near(m->to, i);
+        }
+
+        /* whatever could go where this was */
+        BoxId over = box_neighbor(isl, m->id, Face_Above);
+        woke[woke_count++] = over;
+        for (int s = 0; s < 4; s++) {
+            BoxId side = box_neighbor(isl, m->id, fluid_sides[s]);
+            woke[woke_count++] = side;
+            if (side) woke[woke_count++] = box_neighbor(isl, side, Face_Above);
+        }
+
+        if (m->what == FluidDo_Fall) {
+            /* not island_rem_box; a loose box isn't holding anything together */
+            rem_box(isl, m->id);
+            journal_append(((JournalRecord) { JournalOp_Rem, 0, 0, 0, from }), NULL, 0);
+            fluid.fell++;
+            continue;
+        }
+        ids[count] = m->id;
+        to[count++] = m->to;
+    }
+
+    uint32_t moved = count ? journal_move_batch(isl, ids, to, count, swaps) : 0;
+    fluid.moves += moved;
+    for (uint32_t w = 0; w < woke_count; w++)
+        fluid_queue(i, woke[w], fluid.tick + 1);
+    /* and whatever landing here could set off: sand onto water, or water
+       onto water, pushing it */
+    for (uint32_t k = 0; k < moved; k++) {
+        fluid.moved[i][ids[k]] = fluid.tick;
+        fluid_queue(i, ids[k], fluid.tick + 1);
+        fluid_queue(i, box_neighbor(isl, ids[k], Face_Above), fluid.tick + 1);
+        fluid_queue(i, box_neighbor(isl, ids[k], Face_Below), fluid.tick + 1);
+    }
+
+    if (isl->box_count == 0) {
+        if (island_split.isl == isl) island_split.isl = NULL;
+        island_used[i] = 0;
+    }
+    fluid.seen_version[i] = isl->version;
+    arena_pop(&arena_frame, mark);
+}
+
+/* sorts keys on the 24 bits above the index, 12 at a time, least first */
+static void fluid_sort(uint64_t *keys, uint64_t *tmp, uint32_t n) {
+    static uint32_t at[1 << 12];
+    for (int shift = 40; shift < 64; shift += 12) {
+        memset(at, 0, sizeof(at));
+        for (uint32_t k = 0; k < n; k++)
+            at[(keys[k] >> shift) & 0xFFF]++;
+        for (uint32_t b = 0, sum = 0; b < _countof(at); b++) {
+            uint32_t c = at[b];
+            at[b] = sum;
+            sum += c;
+        }
+        for (uint32_t k = 0; k < n; k++)
+            tmp[at[(keys[k] >> shift) & 0xFFF]++] = keys[k];
+        uint64_t *swap = keys;
+        keys = tmp;
+        tmp = swap;
+    }
+}
+
+/* steps every active cell, across however many cores there are if parallel */
+static void fluid_tick(int parallel) {
+    fluid_wake();
+
+    FluidCell *cells = fluid.active[fluid.cur];
+    uint32_t n = fluid.count[fluid.cur];
+    uint64_t mark = arena_mark(&arena_frame);
+    uint64_t *keys = arena_push(&arena_frame, n * sizeof(uint64_t));
+    uint64_t *sorting = arena_push(&arena_frame, n * sizeof(uint64_t));
+    FluidMove *out = arena_push(&arena_frame, n * sizeof(FluidMove));
+    uint32_t *starts = arena_push(&arena_frame, (n + 1) * sizeof(uint32_t));
+    if (n && (keys == NULL || sorting == NULL || out == NULL || starts == NULL)) {
+        arena_pop(&arena_frame, mark);
+        return;
+    }
+
+    /* island, pass, chunk, then bottom up through the chunk */
+    for (uint32_t k = 0; k < n; k++) {
+        FluidCell *c = cells + k;
+        int i = 0;
+        while (islands[i].uid != c->uid || !island_used[i]) i++;
+        BoxPos cp = box_chunk_pos(c->pos);
+        uint64_t pass = (cp.x & 1) | (cp.y & 1) << 1 | (cp.z & 1) << 2;
+        uint64_t occ = pos_map_get(&islands[i].occ_map, cp);
+        uint64_t cell = (c->pos.y & 15) << 8 | (c->pos.z & 15) << 4 | (c->pos.x & 15);
+        keys[k] = (uint64_t) i << 61 | pass << 58 | occ << 52 | cell << 40 | k;
+    }
+    fluid_sort(keys, sorting, n);
+    fluid.looked_at += n;
+
+    for (uint32_t at = 0; at < n;) {
+        int i = (int) (keys[at] >> 61);
+        Island *isl = islands + i;
+        FluidPass pass = { isl, i, INT16_MAX, keys, out, starts };
+        for (uint16_t occ = 1; occ < MAX_BOX_OCCS; occ++) if (isl->occs[occ].count)
+            pass.bottom = (int16_t) min(pass.bottom, isl->occs[occ].pos.y * BOX_CHUNK_SIZE);
+
+        while (at < n && (int) (keys[at] >> 61) == i) {
+            /* a pass's chunks, each a run of the same key above the cell */
+            uint32_t pass_start = at, chunks = 0;
+            uint64_t which = keys[at] >> 58;
+            for (; at < n && keys[at] >> 58 == which; at++)
+                if (at == pass_start || keys[at] >> 52 != keys[at - 1] >> 52)
+                    starts[chunks++] = at;
+            starts[chunks] = at;
+            if (!island_used[i]) continue;
+
+            if (parallel && at - pass_start >= FLUID_PARALLEL_MIN) jobs_run(fluid_chunk, &pass, chunks);
+            else for (uint32_t j = 0; j < chunks; j++) fluid_chunk(&pass, j);
+            fluid_apply(&pass, pass_start, at);
+        }
+    }
+    arena_pop(&arena_frame, mark);
+
+    fluid.count[fluid.cur] = 0;
+    fluid.cur ^= 1;
+    fluid.tick++;
+}
+
+/* starts everything over; the next tick wakes up everything loose */
+static void fluid_reset(void) {
+    fluid.count[0] = fluid.count[1] = fluid.wake_count = 0;
+    memset(fluid.seen_uid, 0, sizeof(fluid.seen_uid));
+    memset(fluid.queued, 0, sizeof(fluid.queued));
+    memset(fluid.moved, 0, sizeof(fluid.moved));
+    memset(fluid.wake_all, 0, sizeof(fluid.wake_all));
+}
+
+static void fluid_record(void) {
+    replay_put(&fluid.tick, sizeof(fluid.tick));
+}
+
+static int fluid_replay(void) {
+    fluid_reset();
+    return replay_get(&fluid.tick, sizeof(fluid.tick));
+}
+
+static uint64_t fluid_hash(uint64_t h) {
+    return replay_hash_bytes(h, &fluid.tick, sizeof(fluid.tick));
+}
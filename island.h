@@ -0,0 +1,718 @@
+/* Keeps each island one connected piece.
+
+   Putting a box down up against another island merges the two, the smaller
+   one's boxes moving over into the bigger one's arena. Taking a box out
+   might cut its island in two, which is found out by a flood fill from each
+   of the boxes that were touching it, all stepped in lockstep. Whenever two
+   of those fills run into each other they're unioned, and if only one is
+   left the island's still in one piece. A fill that runs dry before meeting
+   the others has covered a whole piece, and since they all go the same speed
+   it's the smaller piece, so that's the one that moves out into its own island.
+
+   The fills only get ISLAND_SPLIT_BUDGET boxes of work per edit and per
+   island_tick, so a big island getting cut just shows up as two islands a
+   few frames later instead of hitching.
+
+   Water and sand (LOOSE) don't count for any of this. The fills go around
+   them, so they hold nothing together, and they stay behind in whatever
+   island they were in when it splits, to fall or flow off of it (fluid.h). */
+
+#define MAX_ISLANDS 8
+static Island islands[MAX_ISLANDS];
+static uint8_t island_used[MAX_ISLANDS];
+
+#define ISLAND_SPLIT_BUDGET 1024
+
+static uint32_t island_next_uid = 1;
+
+/* Where each island is in the world. Its boxes' BoxPos are in the grid it's
+   built in, and to_world turns and moves that grid to wherever the island
+   really is. Islands start out where they were built, and anything split off
+   of one stays where it was, so moving an island moves all of it.
+
+   Edits (and so the journal and the network) still only talk about cells of
+   the grid islands are built in, so a box put up against a moved island joins
+   whatever's next to it in that grid, not whatever it looks like it's next to.
+   Where islands have been moved to isn't saved or sent yet either. */
+typedef struct {
+    Mat4 to_world, to_local;
+    /* goes up every island_move, so island_broad knows to refit */
+    uint32_t moves;
+} IslandXform;
+static IslandXform island_xform[MAX_ISLANDS];
+
+/* a fresh island in slot i, which has to be free */
+static Island *island_alloc_at(int i, uint32_t uid) {
+    island_used[i] = 1;
+    island_clear(islands + i);
+    islands[i].uid = uid;
+    island_xform[i] = (IslandXform) { ident4x4(), ident4x4(), 0 };
+    return islands + i;
+}
+
+static Island *island_alloc(void) {
+    for (int i = 0; i < MAX_ISLANDS; i++)
+        if (!island_used[i]) return island_alloc_at(i, island_next_uid++);
+    log_err("Out of islands");
+    return NULL;
+}
+
+/* to_world can only turn and move, see invert_rigid4x4 */
+static void island_move(Island *isl, Mat4 to_world) {
+    IslandXform *xf = island_xform + (isl - islands);
+    xf->to_world = to_world;
+    xf->to_local = invert_rigid4x4(to_world);
+    xf->moves++;
+}
+
+static Vec3 island_to_local(Island *isl, Vec3 p) {
+    return mul4x4_pos(island_xform[isl - islands].to_local, p);
+}
+static Vec3 island_to_world(Island *isl, Vec3 p) {
+    return mul4x4_pos(island_xform[isl - islands].to_world, p);
+}
+
+/* Every island has a leaf in a dynamic AABB tree (see bvh.h), around all of
+   its boxes wherever it's been moved to, so asking what's near the player
+   only looks at islands that are. It's caught up lazily, before each
+   question, by refitting the leaves of islands that have been edited or
+   moved since. */
+static struct {
+    Bvh tree;
+    BvhNode nodes[MAX_ISLANDS * 2];
+    /* what each island's leaf was last fit to */
+    uint16_t leaf[MAX_ISLANDS];
+    uint32_t uid[MAX_ISLANDS], version[MAX_ISLANDS], moves[MAX_ISLANDS];
+} island_broad;
+
+/* the box around everything in isl, in the world */
+static Aabb island_bounds(Island *isl) {
+    Vec3 lo = vec3_f(INFINITY), hi = vec3_f(-INFINITY);
+    for (uint16_t occ = 1; occ < MAX_BOX_OCCS; occ++) if (isl->occs[occ].count) {
+        BoxOcc *chunk = isl->occs + occ;
+        int x_lo = BOX_CHUNK_SIZE, x_hi = 0, z_lo = BOX_CHUNK_SIZE, z_hi = 0;
+        uint32_t ys = 0;
+        for (int x = 0; x < BOX_CHUNK_SIZE; x++)
+            for (int z = 0; z < BOX_CHUNK_SIZE; z++) {
+                uint32_t col = (uint16_t) (chunk->cols[x][z >> 2] >> ((z & 3) * 16));
+                if (col == 0) continue;
+                x_lo = m_min(x_lo, x); x_hi = x;
+                z_lo = m_min(z_lo, z); z_hi = m_max(z_hi, z);
+                ys |= col;
+            }
+        int y_lo = ctz64(ys), y_hi = BOX_CHUNK_SIZE - 1;
+        while (!(ys >> y_hi)) y_hi--;
+
+        Vec3 corner = mul3_f(box_pos_to_vec3(chunk->pos), BOX_CHUNK_SIZE);
+        lo = vec3(m_min(lo.x, corner.x + x_lo), m_min(lo.y, corner.y + y_lo), m_min(lo.z, corner.z + z_lo));
+        hi = vec3(m_max(hi.x, corner.x + x_hi + 1), m_max(hi.y, corner.y + y_hi + 1),
+                  m_max(hi.z, corner.z + z_hi + 1));
+    }
+
+    /* wherever the corners of that end up */
+    Aabb res = { vec3_f(INFINITY), vec3_f(-INFINITY) };
+    for (int k = 0; k < 8; k++) {
+        Vec3 p = island_to_world(isl, vec3(k & 1 ? hi.x : lo.x, k & 2 ? hi.y : lo.y, k & 4 ? hi.z : lo.z));
+        res = aabb_union(res, (Aabb) { p, p });
+    }
+    return res;
+}
+
+static void island_broad_update(void) {
+    if (island_broad.tree.nodes == NULL)
+        bvh_init(&island_broad.tree, island_broad.nodes, _countof(island_broad.nodes));
+
+    for (int i = 0; i < MAX_ISLANDS; i++) {
+        Island *isl = islands + i;
+        uint16_t *leaf = island_broad.leaf + i;
+        if (!island_used[i] || isl->box_count == 0) {
+            if (*leaf) bvh_remove(&island_broad.tree, *leaf);
+            *leaf = BVH_NULL;
+            continue;
+        }
+        if (*leaf && island_broad.uid[i] == isl->uid && island_broad.version[i] == isl->version &&
+            island_broad.moves[i] == island_xform[i].moves) continue;
+
+        Aabb box = island_bounds(isl);
+        if (*leaf) bvh_move(&island_broad.tree, *leaf, box);
+        else *leaf = bvh_insert(&island_broad.tree, box, (uint32_t) i);
+        island_broad.uid[i] = isl->uid;
+        island_broad.version[i] = isl->version;
+        island_broad.moves[i] = island_xform[i].moves;
+    }
+}
+
+/* every island with boxes anywhere in or near box, which is in the world.
+   near needs room for MAX_ISLANDS; returns how many it wrote. they come out
+   in islands[] order, so the answer doesn't depend on how the tree's laid out. */
+static uint32_t island_near(Aabb box, Island **near) {
+    island_broad_update();
+    uint32_t found[MAX_ISLANDS];
+    uint32_t count = bvh_query(&island_broad.tree, box, found, MAX_ISLANDS);
+    for (uint32_t n = 0; n < count; n++) {
+        uint32_t j = n;
+        for (; j > 0 && near[j - 1] > islands + found[n]; j--) near[j] = near[j - 1];
+        near[j] = islands + found[n];
+    }
+    return count;
+}
+
+/* every island the box at p could be in shares the grid they're built in,
+   so this is how to ask about a cell without knowing which island you're after */
+static Island *island_at(BoxPos p) {
+    for (int i = 0; i < MAX_ISLANDS; i++)
+        if (island_used[i] && box_occupied(islands + i, p))
+            return islands + i;
+    return NULL;
+}
+
+/* one fill per box that was touching a removed one */
+#define ISLAND_MAX_FRONTS 16
+static struct {
+    /* NULL if there's nothing left to check */
+    Island *isl;
+    uint8_t seed_count;
+    BoxPos seeds[ISLAND_MAX_FRONTS];
+
+    /* the fill in progress; all of it gets thrown out if isl is edited */
+    int running;
+    uint8_t front_count;
+    uint8_t parent[ISLAND_MAX_FRONTS], done[ISLAND_MAX_FRONTS];
+    uint16_t head[ISLAND_MAX_FRONTS], tail[ISLAND_MAX_FRONTS];
+    /* everything a front has visited stays in its queue, for moving it out */
+    BoxId queue[ISLAND_MAX_FRONTS][MAX_BOXES];
+    /* which front got to a box first, plus one */
+    uint8_t mark[MAX_BOXES];
+} island_split;
+
+static uint8_t island_front_root(uint8_t f) {
+    while (island_split.parent[f] != f)
+        f = island_split.parent[f] = island_split.parent[island_split.parent[f]];
+    return f;
+}
+
+static void island_split_start(void) {
+    Island *isl = island_split.isl;
+    memset(island_split.mark, 0, sizeof(island_split.mark));
+    island_split.front_count = 0;
+
+    for (uint8_t s = 0; s < island_split.seed_count; s++) {
+        BoxId id = box_index_find(isl, island_split.seeds[s]);
+        if (id == BoxId_NULL || LOOSE(isl->boxes[id]) || island_split.mark[id]) continue;
+
+        uint8_t f = island_split.front_count++;
+        island_split.parent[f] = f;
+        island_split.done[f] = 0;
+        island_split.head[f] = 0;
+        island_split.tail[f] = 1;
+        island_split.queue[f][0] = id;
+        island_split.mark[id] = f + 1;
+    }
+    island_split.running = 1;
+}
+
+/* moves everything the fills unioned under root into a new island */
+static int island_split_out(uint8_t root) {
+    Island *from = island_split.isl, *to = island_alloc();
+    if (to == NULL) return 0;
+    island_xform[to - islands] = island_xform[from - islands];
+
+    for (uint8_t f = 0; f < island_split.front_count; f++) {
+        if (island_front_root(f) != root) continue;
+        island_split.done[f] = 1;
+        for (uint16_t i = 0; i < island_split.tail[f]; i++) {
+            Box *b = from->boxes + island_split.queue[f][i];
+            if (box_insert(to, b->pos, b->kind) == BoxId_NULL)
+                log_err("Couldn't move box into split off island");
+            rem_box(from, island_split.queue[f][i]);
+        }
+    }
+    return 1;
+}
+
+/* advances the fills by up to budget boxes. returns 1 once there's
+   nothing left to check. */
+static int island_split_step(int budget) {
+    if (island_split.isl == NULL) return 1;
+    if (!island_split.running) island_split_start();
+
+    for (;;) {
+        /* pieces still growing, and whether any of them has stopped */
+        int roots = 0, dry_root = -1;
+        for (uint8_t f = 0; f < island_split.front_count; f++) {
+            if (island_split.done[f] || island_front_root(f) != f) continue;
+            roots++;
+
+            int dry = 1;
+            for (uint8_t g = 0; g < island_split.front_count; g++)
+                if (island_front_root(g) == f && island_split.head[g] < island_split.tail[g])
+                    dry = 0;
+            if (dry) dry_root = f;
+        }
+
+        if (roots > 1 && dry_root >= 0) {
+            if (island_split_out((uint8_t) dry_root)) continue;
+            /* no island to put it in, so it stays stuck on for now */
+            roots = 1;
+        }
+        if (roots <= 1) {
+            island_split.isl = NULL;
+            island_split.seed_count = 0;
+            island_split.running = 0;
+            return 1;
+        }
+        if (budget <= 0) return 0;
+
+        for (uint8_t f = 0; f < island_split.front_count; f++) {
+            if (island_split.done[f] || island_split.head[f] == island_split.tail[f]) continue;
+            BoxId id = island_split.queue[f][island_split.head[f]++];
+            budget--;
+
+            for (Face face = 0; face < Face_COUNT; face++) {
+                BoxId n = box_neighbor(island_split.isl, id, face);
+                if (n == BoxId_NULL || LOOSE(island_split.isl->boxes[n])) continue;
+
+                uint8_t m = island_split.mark[n];
+                if (m == 0) {
+                    island_split.mark[n] = f + 1;
+                    island_split.queue[f][island_split.tail[f]++] = n;
+                } else {
+                    uint8_t a = island_front_root(f), b = island_front_root(m - 1);
+                    if (a != b) island_split.parent[b] = a;
+                }
+            }
+        }
+    }
+}
+
+/* moves all of src's boxes into dst. returns 0 if they wouldn't fit. */
+static int island_merge(Island *dst, Island *src) {
+    if (dst->box_count + src->box_count >= MAX_BOXES) {
+        log_err("Islands too big to merge");
+        return 0;
+    }
+
+    for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(src->boxes[id]))
+        if (box_insert(dst, src->boxes[id].pos, src->boxes[id].kind) == BoxId_NULL)
+            log_err("Couldn't move box into merged island");
+
+    /* the cells a split check cares about are the same in either island */
+    if (island_split.isl == src || island_split.isl == dst) {
+        island_split.isl = dst;
+        island_split.running = 0;
+    }
+    island_used[src - islands] = 0;
+    return 1;
+}
+
+/* add_box, and then merging with any island the new box is touching.
+   returns the island the new box ended up in, or NULL if it couldn't be added. */
+static Island *island_add_box(Island *isl, BoxId onto_id, Face face, BoxKind kind) {
+    if (!OCCUPIED(isl->boxes[onto_id])) return NULL;
+    BoxPos pos = add_bp(isl->boxes[onto_id].pos, face_offset[face]);
+    if (island_at(pos)) return NULL;
+    if (add_box(isl, onto_id, face, kind) == BoxId_NULL) return NULL;
+    if (island_split.isl == isl) island_split.running = 0;
+
+    for (Face f = 0; f < Face_COUNT; f++) {
+        BoxPos n = add_bp(pos, face_offset[f]);
+        Island *other = island_at(n);
+        if (other == NULL || other == isl) continue;
+
+        /* smaller into bigger, so less gets moved */
+        Island *big = other->box_count > isl->box_count ? other : isl;
+        Island *small = big == isl ? other : isl;
+        if (island_merge(big, small)) isl = big;
+    }
+    return isl;
+}
+
+/* rem_box, and then checking whether that cut isl in two */
+static void island_rem_box(Island *isl, BoxId id) {
+    if (!OCCUPIED(isl->boxes[id])) return;
+    BoxPos pos = isl->boxes[id].pos;
+    rem_box(isl, id);
+
+    if (isl->box_count == 0) {
+        if (island_split.isl == isl) island_split.isl = NULL;
+        island_used[isl - islands] = 0;
+        return;
+    }
+
+    BoxPos touching[Face_COUNT];
+    uint8_t touch_count = 0;
+    for (Face f = 0; f < Face_COUNT; f++) {
+        BoxPos n = add_bp(pos, face_offset[f]);
+        if (box_occupied(isl, n)) touching[touch_count++] = n;
+    }
+    if (island_split.isl == isl) island_split.running = 0;
+    /* it was only hanging off of one box, so nothing's been cut off */
+    if (touch_count < 2) return;
+
+    /* only one island gets checked at a time, so finish the last one up */
+    if ((island_split.isl && island_split.isl != isl) ||
+        island_split.seed_count + touch_count > ISLAND_MAX_FRONTS)
+        island_split_step(MAX_BOXES);
+
+    island_split.isl = isl;
+    for (uint8_t i = 0; i < touch_count; i++)
+        island_split.seeds[island_split.seed_count++] = touching[i];
+    island_split_step(ISLAND_SPLIT_BUDGET);
+}
+
+/* Compaction. box_insert puts a box in the first free slot it finds, so
+   after enough editing, boxes next to each other in the grid are all over
+   the arena, and anything walking from a box to its neighbors hops around
+   memory. Once an island has had ISLAND_COMPACT_AFTER edits, its boxes get
+   sorted by box_morton and swapped into that order from id 1 up, which
+   packs them in at the front with the ones close together in the grid
+   close together in the arena.
+
+   It only gets ISLAND_COMPACT_BUDGET swaps per island_tick. An edit in the
+   middle of it means sorting again, but whatever's already in order stays
+   put. Only box ids change, so nothing keyed by position cares. The split
+   check holds on to ids across ticks, and it gets them rewritten. So do
+   scheduled updates (UpdateScheduled.id in update.h) and queued fluids
+   (FluidCell.id in fluid.h), which don't: both keep the position next to
+   the id and only trust the id while the box there is still at that
+   position, falling back to looking it up by position when it isn't. */
+#define ISLAND_COMPACT_BUDGET 256
+#define ISLAND_COMPACT_AFTER 256
+
+static struct {
+    /* NULL when there's nothing being compacted */
+    Island *isl;
+    /* where isl was when it was sorted */
+    uint32_t uid, version;
+    /* slots from next up to count still need filling */
+    uint16_t count, next;
+    /* the slot the box that belongs in slot k + 1 is in now, and the other
+       way around: one plus where the box in a slot belongs, 0 for empty */
+    uint16_t plan[MAX_BOXES], rank[MAX_BOXES];
+
+    /* where each island was when it was last done */
+    uint32_t done_uid[MAX_ISLANDS], done_version[MAX_ISLANDS];
+    uint8_t turn;
+} island_compact;
+
+static int island_compact_plan(Island *isl) {
+    uint64_t mark = arena_mark(&arena_frame);
+    uint64_t *keys = arena_push(&arena_frame, MAX_BOXES * sizeof(uint64_t));
+    if (keys == NULL) return 0;
+
+    uint16_t count = 0;
+    for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id]))
+        keys[count++] = (box_morton(isl->boxes[id].pos) << 16) | id;
+    sort_u64(keys, count);
+
+    memset(island_compact.rank, 0, sizeof(island_compact.rank));
+    for (uint16_t k = 0; k < count; k++) {
+        island_compact.plan[k] = (uint16_t) keys[k];
+        island_compact.rank[(uint16_t) keys[k]] = k + 1;
+    }
+    island_compact.isl = isl;
+    island_compact.uid = isl->uid;
+    island_compact.version = isl->version;
+    island_compact.count = count;
+    island_compact.next = 1;
+    arena_pop(&arena_frame, mark);
+    return 1;
+}
+
+/* the split check's ids, after the boxes in from[slot] moved to slot */
+static void island_compact_fix_split(uint16_t *from) {
+    uint64_t mark = arena_mark(&arena_frame);
+    uint16_t *moved_to = arena_push(&arena_frame, MAX_BOXES * sizeof(uint16_t));
+    uint8_t *marks = arena_push(&arena_frame, MAX_BOXES);
+    if (moved_to == NULL || marks == NULL) {
+        /* it can always start over */
+        island_split.running = 0;
+        arena_pop(&arena_frame, mark);
+        return;
+    }
+    for (BoxId slot = 0; slot < MAX_BOXES; slot++)
+        moved_to[from[slot]] = slot;
+
+    for (uint8_t f = 0; f < island_split.front_count; f++)
+        for (uint16_t i = 0; i < island_split.tail[f]; i++)
+            island_split.queue[f][i] = moved_to[island_split.queue[f][i]];
+    for (BoxId id = 0; id < MAX_BOXES; id++)
+        marks[moved_to[id]] = island_split.mark[id];
+    memcpy(island_split.mark, marks, MAX_BOXES);
+    arena_pop(&arena_frame, mark);
+}
+
+/* up to budget more swaps, on whichever island's due. returns 1 once
+   nothing's left to do. */
+static int island_compact_step(int budget) {
+    Island *isl = island_compact.isl;
+    if (isl && (!island_used[isl - islands] || isl->uid != island_compact.uid))
+        isl = island_compact.isl = NULL;
+
+    if (isl == NULL) {
+        for (int j = 0; j < MAX_ISLANDS && isl == NULL; j++) {
+            int i = (island_compact.turn + j) % MAX_ISLANDS;
+            if (island_used[i] && (islands[i].uid != island_compact.done_uid[i] ||
+                islands[i].version - island_compact.done_version[i] >= ISLAND_COMPACT_AFTER)) {
+                isl = islands + i;
+                island_compact.turn = (uint8_t) (i + 1);
+            }
+        }
+        if (isl == NULL || !island_compact_plan(isl)) return 1;
+    } else if (isl->version != island_compact.version && !island_compact_plan(isl)) {
+        return 1;
+    }
+
+    /* the slice-start id of whatever's in each slot, if the split check's
+       going to need telling */
+    uint64_t mark = arena_mark(&arena_frame);
+    uint16_t *from = NULL;
+    if (island_split.isl == isl && island_split.running &&
+        (from = arena_push(&arena_frame, MAX_BOXES * sizeof(uint16_t))) != NULL)
+        for (BoxId slot = 0; slot < MAX_BOXES; slot++) from[slot] = slot;
+
+    uint16_t *plan = island_compact.plan, *rank = island_compact.rank;
+    for (; island_compact.next <= island_compact.count && budget > 0; island_compact.next++) {
+        BoxId t = island_compact.next, s = plan[t - 1];
+        if (s == t) continue;
+
+        box_swap(isl, t, s);
+        uint16_t displaced = rank[t];
+        plan[t - 1] = t;
+        rank[t] = t;
+        if (displaced) plan[displaced - 1] = s;
+        rank[s] = displaced;
+        if (from) {
+            uint16_t was = from[t];
+            from[t] = from[s];
+            from[s] = was;
+        }
+        budget--;
+    }
+
+    if (from) island_compact_fix_split(from);
+    else if (island_split.isl == isl) island_split.running = 0;
+    arena_pop(&arena_frame, mark);
+
+    if (island_compact.next <= island_compact.count) return 0;
+    island_compact.done_uid[isl - islands] = isl->uid;
+    island_compact.done_version[isl - islands] = isl->version;
+    island_compact.isl = NULL;
+    return 1;
+}
+
+/* picks up any split check an edit didn't have the budget to finish, and
+   carries on compacting */
+static void island_tick(void) {
+    island_split_step(ISLAND_SPLIT_BUDGET);
+    island_compact_step(ISLAND_COMPACT_BUDGET);
+}
+
+/* box_under_ray, but for the nearest box across every island the ray goes
+   near, each of them asked in its own grid */
+static BoxId island_under_ray(Vec3 p, Vec3 rd, Face *face, Island **hit) {
+    island_broad_update();
+    uint32_t near[MAX_ISLANDS];
+    uint32_t near_count = bvh_ray(&island_broad.tree, p, rd, BOX_RAY_REACH, near, MAX_ISLANDS);
+
+    BoxId res = BoxId_NULL;
+    float res_dist = INFINITY;
+    for (uint32_t n = 0; n < near_count; n++) {
+        IslandXform *xf = island_xform + near[n];
+        Vec3 lp = mul4x4_pos(xf->to_local, p), lrd = mul4x4_dir(xf->to_local, rd);
+        Face this_face;
+        BoxId id = box_under_ray(islands + near[n], lp, lrd, &this_face);
+        if (id == BoxId_NULL) continue;
+
+        /* turning doesn't change how long rd is, so distances in every grid line up */
+        Vec3 pos = box_pos_to_vec3(islands[near[n]].boxes[id].pos);
+        float this_dist = box_ray_dist(sub3(lp, add3_f(pos, 0.5f)), lrd, vec3_f(0.5f));
+        if (this_dist < res_dist) {
+            res_dist = this_dist;
+            res = id;
+            *hit = islands + near[n];
+            if (face != NULL) *face = this_face;
+        }
+    }
+    return res;
+}
+
+/* the ways island_sweep got pushed back, out of the boxes it ran into, in the world */
+typedef struct {
+    Vec3 normals[3 * MAX_ISLANDS];
+    uint32_t count;
+} IslandStops;
+
+/* Moves box (in the world) by as much of move as it can before it runs
+   into a box, and returns how far it got. It goes y first, then x, then z,
+   and each of those is swept against every island near enough before the
+   next one starts, so no island gets a say after the box has already been
+   moved past another one somewhere it wasn't checked. Islands are asked
+   in their own grids, with the box keeping its size, so it turns with
+   whatever island it's up against; in one that's been turned, a step
+   along the world's x or z is two steps in its grid, and however much of
+   that step the island allows goes for both. */
+static Vec3 island_sweep(Aabb box, Vec3 move, IslandStops *stops) {
+    Aabb swept = aabb_union(box, (Aabb) { add3(box.lo, move), add3(box.hi, move) });
+    Island *near[MAX_ISLANDS];
+    uint32_t near_count = island_near(swept, near);
+    stops->count = 0;
+
+    Vec3 half = mul3_f(sub3(box.hi, box.lo), 0.5f), mid = add3(box.lo, half);
+    float want[3] = { move.x, move.y, move.z }, got[3] = { 0.0f, 0.0f, 0.0f };
+    static const int order[3] = { 1, 0, 2 };
+    for (int k = 0; k < 3; k++) {
+        int axis = order[k];
+        if (want[axis] == 0.0f) continue;
+        Vec3 step = vec3(axis == 0 ? want[axis] : 0.0f, axis == 1 ? want[axis] : 0.0f,
+                         axis == 2 ? want[axis] : 0.0f);
+
+        /* how much of step each island lets through, and the way the one
+           that let through the least pushed back */
+        float keep = 1.0f, keeps[MAX_ISLANDS];
+        Vec3 backs[MAX_ISLANDS];
+        for (uint32_t n = 0; n < near_count; n++) {
+            IslandXform *xf = island_xform + (near[n] - islands);
+            Vec3 local_mid = mul4x4_pos(xf->to_local, mid), local_step = mul4x4_dir(xf->to_local, step);
+            Vec3 lo = sub3(local_mid, half), hi = add3(local_mid, half);
+
+            float m[3] = { local_step.x, local_step.y, local_step.z };
+            keeps[n] = 1.0f;
+            for (int k2 = 0; k2 < 3; k2++) {
+                int local_axis = order[k2];
+                /* turning leaves crumbs on the other axes; they aren't moves */
+                if (fabsf(m[local_axis]) < 1e-6f) continue;
+                float g = box_sweep(near[n], lo, hi, local_axis, m[local_axis]);
+                if (g != m[local_axis] && g / m[local_axis] < keeps[n]) {
+                    float back[3] = { 0.0f, 0.0f, 0.0f };
+                    back[local_axis] = m[local_axis] > 0.0f ? -1.0f : 1.0f;
+                    keeps[n] = g / m[local_axis];
+                    backs[n] = mul4x4_dir(xf->to_world, vec3(back[0], back[1], back[2]));
+                }
+                Vec3 by = vec3(local_axis == 0 ? g : 0.0f, local_axis == 1 ? g : 0.0f,
+                               local_axis == 2 ? g : 0.0f);
+                lo = add3(lo, by);
+                hi = add3(hi, by);
+            }
+            keep = m_min(keep, keeps[n]);
+        }
+        if (keep < 1.0f)
+            for (uint32_t n = 0; n < near_count; n++)
+                if (keeps[n] == keep) stops->normals[stops->count++] = backs[n];
+
+        got[axis] = want[axis] * keep;
+        mid = add3(mid, mul3_f(step, keep));
+    }
+    return vec3(got[0], got[1], got[2]);
+}
+
+/* splits isl up into its connected pieces all at once, leaving the biggest
+   piece where it is. for bulk edits, which can cut an island up any which way.
+   pieces go by the lowest box_morton of their boxes, for breaking ties and
+   for which gets an island first, so it comes out the same whatever ids
+   the boxes have (a replay's are packed, the live world's aren't). */
+static void island_separate(Island *isl) {
+    BoxId *queue = island_split.queue[0];
+    uint16_t pieces = 0, biggest = 0, biggest_size = 0;
+
+    /* which piece each box is in, and each piece's lowest box_morton and
+       number, to sort by */
+    uint64_t mark = arena_mark(&arena_frame);
+    uint16_t *piece_of = arena_push_zero(&arena_frame, MAX_BOXES * sizeof(uint16_t));
+    uint64_t *keys = arena_push(&arena_frame, MAX_BOXES * sizeof(uint64_t));
+    if (piece_of == NULL || keys == NULL) {
+        arena_pop(&arena_frame, mark);
+        return;
+    }
+
+    for (BoxId start = 1; start < MAX_BOXES; start++) {
+        if (!OCCUPIED(isl->boxes[start]) || LOOSE(isl->boxes[start]) || piece_of[start]) continue;
+
+        uint16_t piece = ++pieces, head = 0, tail = 0;
+        uint64_t lowest = UINT64_MAX;
+        piece_of[start] = piece;
+        queue[tail++] = start;
+        while (head < tail) {
+            BoxId id = queue[head++];
+            uint64_t morton = box_morton(isl->boxes[id].pos);
+            if (morton < lowest) lowest = morton;
+            for (Face f = 0; f < Face_COUNT; f++) {
+                BoxId n = box_neighbor(isl, id, f);
+                if (n == BoxId_NULL || LOOSE(isl->boxes[n]) || piece_of[n]) continue;
+                piece_of[n] = piece;
+                queue[tail++] = n;
+            }
+        }
+        keys[piece - 1] = lowest << 16 | piece;
+        if (tail > biggest_size || (tail == biggest_size && keys[piece - 1] < keys[biggest - 1])) {
+            biggest = piece;
+            biggest_size = tail;
+        }
+    }
+    sort_u64(keys, pieces);
+
+    for (uint16_t k = 0; k < pieces; k++) {
+        uint16_t piece = (uint16_t) (keys[k] & 0xFFFF);
+        if (piece == biggest) continue;
+        Island *to = island_alloc();
+        if (to == NULL) break;
+        island_xform[to - islands] = island_xform[isl - islands];
+
+        for (BoxId id = 1; id < MAX_BOXES; id++) if (piece_of[id] == piece) {
+            if (box_insert(to, isl->boxes[id].pos, isl->boxes[id].kind) == BoxId_NULL)
+                log_err("Couldn't move box into separated island");
+            rem_box(isl, id);
+        }
+    }
+    arena_pop(&arena_frame, mark);
+}
+
+/* box_fill, across islands. Every island near s gets merged into one first so
+   there's a single grid to fill, then whatever that leaves disconnected is
+   split back up. returns the island s ended up in, or NULL if those islands
+   were too big to merge. */
+static Island *island_fill(BoxShape *s, BoxKind kind) {
+    /* a check left over from an edit is about to be out of date */
+    island_split_step(MAX_BOXES);
+
+    BoxShape near = box_shape_aabb(add_bp(s->lo, (BoxPos) { -1, -1, -1 }),
+                                   add_bp(s->hi, (BoxPos) {  1,  1,  1 }));
+    Island *dst = NULL;
+    for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+        Island *isl = islands + i;
+        int is_near = 0;
+        for (BoxId id = 1; id < MAX_BOXES && !is_near; id++)
+            is_near = OCCUPIED(isl->boxes[id]) && box_shape_has(&near, isl->boxes[id].pos);
+        if (!is_near) continue;
+
+        if (dst == NULL) dst = isl;
+        else {
+            Island *big = isl->box_count > dst->box_count ? isl : dst;
+            Island *small = big == isl ? dst : isl;
+            if (!island_merge(big, small)) return NULL;
+            dst = big;
+        }
+    }
+    if (dst == NULL && (dst = island_alloc()) == NULL) return NULL;
+
+    box_fill(dst, s, kind);
+    if (dst->box_count == 0) {
+        island_used[dst - islands] = 0;
+        return NULL;
+    }
+    island_separate(dst);
+    return dst;
+}
+
+/* box_carve, across islands, splitting up whatever it cuts apart */
+static void island_carve(BoxShape *s) {
+    island_split_step(MAX_BOXES);
+
+    for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+        Island *isl = islands + i;
+        if (box_carve(isl, s) == 0) continue;
+
+        if (isl->box_count == 0) island_used[i] = 0;
+        else island_separate(isl);
+    }
+}
@@ -0,0 +1,89 @@
+/* A pool of worker threads, one for each core past the first, for
+   splitting a loop up across all of them.
+
+     jobs_run(fn, user, count);
+
+   calls fn(user, i) for every i below count, on whichever threads get to
+   it first (the one calling jobs_run included), and returns once every
+   one of them is done. Which thread runs which i isn't up to you, so
+   nothing fn does should depend on that, and it can't touch arena_frame
+   or anything else that isn't safe from two threads at once.
+
+   The workers sleep on a semaphore in between, so an idle pool costs
+   nothing, and the first jobs_run starts them. */
+
+#define JOBS_MAX_THREADS 16
+
+typedef void JobFn(void *user, uint32_t i);
+
+static struct {
+    int started;
+    /* workers, not counting whoever calls jobs_run */
+    uint32_t thread_count;
+    HANDLE wake;
+
+    JobFn *fn;
+    void *user;
+    LONG count;
+    volatile LONG next, done;
+    /* workers woken up for this run that haven't gone back to sleep yet;
+       jobs_run waits for them too, so none can wander into the next one */
+    volatile LONG awake;
+} jobs;
+
+static void jobs_work(void) {
+    for (;;) {
+        LONG i = InterlockedIncrement(&jobs.next) - 1;
+        if (i >= jobs.count) return;
+        jobs.fn(jobs.user, (uint32_t) i);
+        InterlockedIncrement(&jobs.done);
+    }
+}
+
+static DWORD WINAPI jobs_worker(LPVOID arg) {
+    for (;;) {
+        WaitForSingleObject(jobs.wake, INFINITE);
+        jobs_work();
+        InterlockedDecrement(&jobs.awake);
+    }
+    return 0;
+}
+
+static void jobs_init(void) {
+    jobs.started = 1;
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    jobs.thread_count = min(info.dwNumberOfProcessors, JOBS_MAX_THREADS) - 1;
+    jobs.wake = CreateSemaphoreA(NULL, 0, JOBS_MAX_THREADS, NULL);
+    if (jobs.wake == NULL) {
+        log_win32_last_err("Couldn't make the job semaphore");
+        jobs.thread_count = 0;
+        return;
+    }
+
+    for (uint32_t t = 0; t < jobs.thread_count; t++)
+        if (CreateThread(NULL, 0, jobs_worker, NULL, 0, NULL) == NULL) {
+            log_win32_last_err("Couldn't start a job thread");
+            jobs.thread_count = t;
+            break;
+        }
+}
+
+static void jobs_run(JobFn *fn, void *user, uint32_t count) {
+    if (!jobs.started) jobs_init();
+    if (count == 0) return;
+
+    jobs.fn = fn;
+    jobs.user = user;
+    jobs.count = (LONG) count;
+    jobs.next = jobs.done = 0;
+
+    /* no point waking more than there's work for */
+    LONG wake = (LONG) min(count - 1, jobs.thread_count);
+    jobs.awake = wake;
+    if (wake) ReleaseSemaphore(jobs.wake, wake, NULL);
+
+    jobs_work();
+    while (jobs.done < jobs.count || jobs.awake)
+        YieldProcessor();
+}
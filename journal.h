@@ -0,0 +1,509 @@
+/* Saving the world without rewriting all of it every time it changes.
+
+   Every edit made through the journal_ functions below gets appended to
+   "<name>.journal" as a 16 byte record. They pile up in memory over a tick
+   and journal_tick writes and flushes them all at once. Every
+   JOURNAL_CHECKPOINT_EDITS edits the whole world gets written out to
+   "<name>.snap" instead, and the journal starts over.
+
+   Loading is the snapshot, then replaying the journal on top of it, so a
+   crash loses at most the last tick of edits. Both files carry a generation
+   number that goes up with every checkpoint, so a journal that a crash kept
+   from being truncated never gets replayed over a snapshot that already has
+   its edits in it.
+
+   None of this is compiled in if USE_JOURNAL (top of main.c) is 0; the
+   journal_ edits just go straight to island.h. */
+
+typedef enum {
+    /* a: the new box, arg: which Face of the box under it it went on */
+    JournalOp_Add = 1,
+    /* a: the box that was removed */
+    JournalOp_Rem,
+    /* arg: BoxShapeKind. a, b: lo and hi, or for a sphere, the center and
+       the radius in b.x. masks are followed by their bytes, padded to 16 */
+    JournalOp_Fill,
+    JournalOp_Carve,
+    /* a: the box, kind: what it was turned into */
+    JournalOp_Kind,
+    /* a: where a box was, b: where it went. arg: JournalMoveFlags. a batch
+       of them ends with JournalMove_Last, and they all happen at once, the
+       way box_move_batch does them */
+    JournalOp_Move,
+} JournalOp;
+
+typedef enum {
+    /* the box at b went to a at the same time */
+    JournalMove_Swap = 1,
+    JournalMove_Last = 2,
+} JournalMoveFlags;
+
+typedef struct {
+    uint8_t op, kind, arg;
+    /* hash of everything else in the record, so one a crash tore is noticed */
+    uint8_t check;
+    BoxPos a, b;
+} JournalRecord;
+
+/* bigger brushes just get checkpointed */
+#define JOURNAL_MAX_MASK (1 << 16)
+
+#define JOURNAL_MAGIC 0x324E524A
+
+/* Snapshots are kept outside of USE_JOURNAL, since replay.h
+   starts its recordings with one too. Islands go back in the same slots
+   of islands[] with the same uids, holes and all, since updates and
+   fluids go through them in slot order and a replay has to as well. */
+typedef struct { uint32_t magic, generation, island_count, next_uid; } JournalSnapHeader;
+typedef struct { uint32_t slot, uid, box_count; } JournalSnapIsland;
+typedef struct { BoxPos pos; uint16_t kind; } JournalBox;
+
+static uint8_t journal_snap[sizeof(JournalSnapHeader)
+                            + MAX_ISLANDS * (sizeof(JournalSnapIsland) + MAX_BOXES * sizeof(JournalBox))];
+
+/* writes every island into journal_snap, and returns how much of it that took */
+static uint32_t journal_snap_build(uint32_t generation) {
+    /* everything in islands[] gets settled before it's written down */
+    island_split_step(MAX_BOXES);
+
+    JournalSnapHeader *header = (JournalSnapHeader *) journal_snap;
+    *header = (JournalSnapHeader) { JOURNAL_MAGIC, generation, 0, island_next_uid };
+    uint32_t len = sizeof(JournalSnapHeader);
+    for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+        Island *isl = islands + i;
+        header->island_count++;
+        JournalSnapIsland saved = { (uint32_t) i, isl->uid, isl->box_count };
+        memcpy(journal_snap + len, &saved, sizeof(saved));
+        len += sizeof(saved);
+
+        for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id])) {
+            JournalBox box = { isl->boxes[id].pos, (uint16_t) isl->boxes[id].kind };
+            memcpy(journal_snap + len, &box, sizeof(box));
+            len += sizeof(box);
+        }
+    }
+    return len;
+}
+
+/* replaces islands[] with the len bytes in journal_snap.
+   the islands come back in the same slots they went in from. */
+static int journal_snap_load(uint32_t len) {
+    JournalSnapHeader *header = (JournalSnapHeader *) journal_snap;
+    if (len < sizeof(JournalSnapHeader) || header->magic != JOURNAL_MAGIC) {
+        log_err("Snapshot is garbled");
+        return 0;
+    }
+
+    for (int i = 0; i < MAX_ISLANDS; i++) island_used[i] = 0;
+    uint32_t at = sizeof(JournalSnapHeader);
+    for (uint32_t i = 0; i < header->island_count && at + sizeof(JournalSnapIsland) <= len; i++) {
+        JournalSnapIsland saved;
+        memcpy(&saved, journal_snap + at, sizeof(saved));
+        at += sizeof(saved);
+
+        Island *isl = saved.slot < MAX_ISLANDS && !island_used[saved.slot]
+            ? island_alloc_at((int) saved.slot, saved.uid) : NULL;
+        if (isl == NULL) log_err("Snapshot has two islands in one slot");
+        for (uint32_t b = 0; b < saved.box_count && at + sizeof(JournalBox) <= len; b++) {
+            JournalBox box;
+            memcpy(&box, journal_snap + at, sizeof(box));
+            at += sizeof(box);
+            if (isl) box_insert(isl, box.pos, (BoxKind) box.kind);
+        }
+    }
+    island_next_uid = header->next_uid;
+    return 1;
+}
+
+#if USE_JOURNAL
+
+#define JOURNAL_CHECKPOINT_EDITS (1 << 16)
+
+typedef struct { uint32_t magic, generation; } JournalHeader;
+
+static struct {
+    HANDLE file;
+    char path[MAX_PATH], snap_path[MAX_PATH], tmp_path[MAX_PATH];
+    uint32_t generation;
+    uint32_t edits, checkpoint_every;
+    /* written since the last flush */
+    int dirty;
+    uint32_t len;
+    uint8_t buf[JOURNAL_MAX_MASK * 2];
+} journal;
+
+static uint8_t journal_check(JournalRecord r, const uint8_t *extra, uint32_t extra_len) {
+    r.check = 0;
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < sizeof(r); i++)
+        h = (h ^ ((uint8_t *) &r)[i]) * 16777619u;
+    for (uint32_t i = 0; i < extra_len; i++)
+        h = (h ^ extra[i]) * 16777619u;
+    return (uint8_t) (h ^ (h >> 8) ^ (h >> 16) ^ (h >> 24));
+}
+
+static void journal_write(void) {
+    DWORD written;
+    if (journal.len && !WriteFile(journal.file, journal.buf, journal.len, &written, NULL))
+        log_win32_last_err("Couldn't write to journal");
+    journal.len = 0;
+    journal.dirty = 1;
+}
+
+static void journal_append(JournalRecord r, const uint8_t *extra, uint32_t extra_len) {
+    if (journal.file == NULL) return;
+    r.check = journal_check(r, extra, extra_len);
+
+    uint32_t padded = (extra_len + 15) & ~15u;
+    if (journal.len + sizeof(r) + padded > sizeof(journal.buf))
+        journal_write();
+    memcpy(journal.buf + journal.len, &r, sizeof(r));
+    journal.len += sizeof(r);
+    memcpy(journal.buf + journal.len, extra, extra_len);
+    memset(journal.buf + journal.len + extra_len, 0, padded - extra_len);
+    journal.len += padded;
+    journal.edits++;
+}
+
+static void journal_start(void) {
+    JournalHeader header = { JOURNAL_MAGIC, journal.generation };
+    DWORD written;
+    SetFilePointer(journal.file, 0, NULL, FILE_BEGIN);
+    SetEndOfFile(journal.file);
+    WriteFile(journal.file, &header, sizeof(header), &written, NULL);
+    FlushFileBuffers(journal.file);
+    journal.len = 0;
+    journal.edits = 0;
+    journal.dirty = 0;
+}
+
+/* writes the whole world out, then empties the journal */
+static void journal_checkpoint(void) {
+    if (journal.file == NULL) return;
+    uint32_t len = journal_snap_build(journal.generation + 1);
+
+    /* written off to the side and swapped in, so there's always a whole one */
+    HANDLE file = CreateFileA(journal.tmp_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        log_win32_last_err("Couldn't open snapshot file");
+        return;
+    }
+    DWORD written;
+    BOOL ok = WriteFile(file, journal_snap, len, &written, NULL) && written == len;
+    ok = FlushFileBuffers(file) && ok;
+    CloseHandle(file);
+    if (!ok || !MoveFileExA(journal.tmp_path, journal.snap_path,
+                            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        log_win32_last_err("Couldn't write snapshot");
+        return;
+    }
+
+    journal.generation++;
+    journal_start();
+}
+
+/* flushes this tick's edits out to disk */
+static void journal_tick(void) {
+    if (journal.file == NULL) return;
+    if (journal.edits >= journal.checkpoint_every) {
+        journal_checkpoint();
+        return;
+    }
+    if (journal.len) journal_write();
+    if (journal.dirty) FlushFileBuffers(journal.file);
+    journal.dirty = 0;
+}
+
+static int journal_load_snapshot(void) {
+    HANDLE file = CreateFileA(journal.snap_path, GENERIC_READ, 0, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+    DWORD len = 0;
+    ReadFile(file, journal_snap, sizeof(journal_snap), &len, NULL);
+    CloseHandle(file);
+
+    if (!journal_snap_load(len)) return 0;
+    journal.generation = ((JournalSnapHeader *) journal_snap)->generation;
+    return 1;
+}
+
+static BoxShape journal_shape(JournalRecord *r, const uint8_t *mask) {
+    switch (r->arg) {
+    case BoxShape_Sphere: return box_shape_sphere(r->a, r->b.x);
+    case BoxShape_Mask:   return box_shape_mask(r->a, r->b, mask);
+    default:              return box_shape_aabb(r->a, r->b);
+    }
+}
+
+static uint32_t journal_mask_len(JournalRecord *r) {
+    if (r->op != JournalOp_Fill && r->op != JournalOp_Carve) return 0;
+    if (r->arg != BoxShape_Mask) return 0;
+    if (r->b.x < r->a.x || r->b.y < r->a.y || r->b.z < r->a.z) return JOURNAL_MAX_MASK + 1;
+    return (uint32_t) (r->b.x - r->a.x + 1) * (r->b.y - r->a.y + 1) * (r->b.z - r->a.z + 1);
+}
+
+/* a batch of JournalOp_Moves, saved up until its last one */
+static struct {
+    Island *isl;
+    uint32_t n;
+    BoxId ids[MAX_BOXES];
+    BoxPos to[MAX_BOXES];
+    uint8_t ok[MAX_BOXES];
+} journal_moves;
+static PosMapSlot journal_move_slots[2][MAX_BOXES * 2];
+
+/* makes the saved up moves, all at once. any that don't fit the world as
+   it is (going somewhere that's taken and isn't being left) get dropped,
+   rather than letting two boxes end up in one cell. */
+static void journal_replay_moves(void) {
+    Island *isl = journal_moves.isl;
+    uint32_t n = journal_moves.n;
+    journal_moves.n = 0;
+    if (n == 0) return;
+
+    /* where each one's coming from and going to, plus one */
+    memset(journal_move_slots, 0, sizeof(journal_move_slots));
+    PosMap from = { journal_move_slots[0], MAX_BOXES * 2 - 1 };
+    PosMap to = { journal_move_slots[1], MAX_BOXES * 2 - 1 };
+    for (uint32_t i = 0; i < n; i++) {
+        journal_moves.ok[i] = !pos_map_get(&from, isl->boxes[journal_moves.ids[i]].pos)
+                           && !pos_map_get(&to, journal_moves.to[i]);
+        if (!journal_moves.ok[i]) continue;
+        pos_map_set(&from, isl->boxes[journal_moves.ids[i]].pos, (uint16_t) (i + 1));
+        pos_map_set(&to, journal_moves.to[i], (uint16_t) (i + 1));
+    }
+
+    /* dropping one can leave another with nowhere to go, so until nothing changes */
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (uint32_t i = 0; i < n; i++) if (journal_moves.ok[i]) {
+            BoxPos p = journal_moves.to[i];
+            uint16_t leaving = pos_map_get(&from, p);
+            if (leaving ? journal_moves.ok[leaving - 1] : !island_at(p)) continue;
+            journal_moves.ok[i] = 0;
+            changed = 1;
+        }
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < n; i++) if (journal_moves.ok[i]) {
+        journal_moves.ids[kept] = journal_moves.ids[i];
+        journal_moves.to[kept++] = journal_moves.to[i];
+    }
+    box_move_batch(isl, journal_moves.ids, journal_moves.to, kept);
+}
+
+static void journal_replay_record(JournalRecord *r, const uint8_t *mask) {
+    if (r->op != JournalOp_Move) journal_replay_moves();
+
+    switch (r->op) {
+    case JournalOp_Add: {
+        BoxPos onto = add_bp(r->a, face_offset[face_opposite[r->arg]]);
+        Island *isl = island_at(onto);
+        if (isl) island_add_box(isl, box_index_find(isl, onto), (Face) r->arg, (BoxKind) r->kind);
+    } break;
+    case JournalOp_Rem: {
+        Island *isl = island_at(r->a);
+        if (isl) island_rem_box(isl, box_index_find(isl, r->a));
+    } break;
+    case JournalOp_Fill: {
+        BoxShape s = journal_shape(r, mask);
+        island_fill(&s, (BoxKind) r->kind);
+    } break;
+    case JournalOp_Carve: {
+        BoxShape s = journal_shape(r, mask);
+        island_carve(&s);
+    } break;
+    case JournalOp_Kind: {
+        Island *isl = island_at(r->a);
+        if (isl) box_set_kind(isl, box_index_find(isl, r->a), (BoxKind) r->kind);
+    } break;
+    case JournalOp_Move: {
+        Island *isl = island_at(r->a);
+        if (isl != journal_moves.isl) journal_replay_moves();
+        BoxId id = isl ? box_index_find(isl, r->a) : BoxId_NULL;
+        BoxId other = isl && (r->arg & JournalMove_Swap) && box_occupied(isl, r->b)
+            ? box_index_find(isl, r->b) : BoxId_NULL;
+        if (id && (other || !(r->arg & JournalMove_Swap)) && journal_moves.n + 2 <= MAX_BOXES) {
+            journal_moves.isl = isl;
+            journal_moves.ids[journal_moves.n] = id;
+            journal_moves.to[journal_moves.n++] = r->b;
+            if (other) {
+                journal_moves.ids[journal_moves.n] = other;
+                journal_moves.to[journal_moves.n++] = r->a;
+            }
+        }
+        if (r->arg & JournalMove_Last) journal_replay_moves();
+    } break;
+    }
+}
+
+/* replays every whole record in the journal, and cuts off anything after */
+static void journal_replay(void) {
+    DWORD got = 0;
+    JournalHeader header;
+    ReadFile(journal.file, &header, sizeof(header), &got, NULL);
+    if (got != sizeof(header) || header.magic != JOURNAL_MAGIC ||
+        header.generation != journal.generation) {
+        /* brand new, or left over from before the snapshot was taken */
+        journal_start();
+        return;
+    }
+
+    uint32_t have = 0, at = 0, valid_end = sizeof(header), edits = 0;
+    int eof = 0;
+    for (;;) {
+        if (!eof && have - at < sizeof(JournalRecord) + JOURNAL_MAX_MASK) {
+            for (uint32_t i = at; i < have; i++)
+                journal.buf[i - at] = journal.buf[i];
+            have -= at;
+            at = 0;
+            ReadFile(journal.file, journal.buf + have, sizeof(journal.buf) - have, &got, NULL);
+            have += got;
+            eof = got == 0;
+        }
+        if (have - at < sizeof(JournalRecord)) break;
+
+        JournalRecord r;
+        memcpy(&r, journal.buf + at, sizeof(r));
+        uint32_t mask_len = journal_mask_len(&r);
+        uint32_t padded = (mask_len + 15) & ~15u;
+        if (mask_len > JOURNAL_MAX_MASK || have - at - sizeof(r) < padded) break;
+
+        const uint8_t *mask = journal.buf + at + sizeof(r);
+        if (r.op < JournalOp_Add || r.op > JournalOp_Move ||
+            r.check != journal_check(r, mask, mask_len)) break;
+
+        journal_replay_record(&r, mask);
+        at += sizeof(r) + padded;
+        valid_end += sizeof(r) + padded;
+        edits++;
+    }
+    /* in case a crash cut a batch of moves short */
+    journal_replay_moves();
+    island_split_step(MAX_BOXES);
+
+    /* drop whatever a crash left half written, and carry on after the rest */
+    SetFilePointer(journal.file, valid_end, NULL, FILE_BEGIN);
+    SetEndOfFile(journal.file);
+    journal.len = 0;
+    journal.edits = edits;
+}
+
+/* loads "<name>.snap" and replays "<name>.journal" over it, then keeps the
+   journal open for new edits. returns 0 if there wasn't a world to load, in
+   which case the caller should make one and journal_checkpoint it. */
+static int journal_open(const char *name) {
+    Fmt f = { journal.path, 0, MAX_PATH - 1 };
+    fmt_str(&f, name); fmt_str(&f, ".journal");
+    journal.path[f.len] = '\0';
+    f = (Fmt) { journal.snap_path, 0, MAX_PATH - 1 };
+    fmt_str(&f, name); fmt_str(&f, ".snap");
+    journal.snap_path[f.len] = '\0';
+    f = (Fmt) { journal.tmp_path, 0, MAX_PATH - 1 };
+    fmt_str(&f, name); fmt_str(&f, ".snap.tmp");
+    journal.tmp_path[f.len] = '\0';
+
+    journal.checkpoint_every = JOURNAL_CHECKPOINT_EDITS;
+    journal.generation = 0;
+    int loaded = journal_load_snapshot();
+
+    journal.file = CreateFileA(journal.path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                               OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (journal.file == INVALID_HANDLE_VALUE) {
+        log_win32_last_err("Couldn't open journal");
+        journal.file = NULL;
+        return loaded;
+    }
+
+    /* without a snapshot, there's nothing for the journal to be replayed onto */
+    if (loaded) journal_replay();
+    else journal_start();
+    return loaded;
+}
+
+static void journal_close(void) {
+    if (journal.file == NULL) return;
+    journal_tick();
+    CloseHandle(journal.file);
+    journal.file = NULL;
+}
+
+#else
+
+#define journal_append(r, extra, extra_len)
+#define journal_checkpoint()
+#define journal_tick()
+#define journal_open(name) (0)
+#define journal_close()
+
+#endif
+
+/* island_add_box, journaled */
+static Island *journal_add_box(Island *isl, BoxId onto_id, Face face, BoxKind kind) {
+    BoxPos pos = add_bp(isl->boxes[onto_id].pos, face_offset[face]);
+    Island *res = island_add_box(isl, onto_id, face, kind);
+    if (res) journal_append(((JournalRecord) { JournalOp_Add, kind, face, 0, pos }), NULL, 0);
+    return res;
+}
+
+/* island_rem_box, journaled */
+static void journal_rem_box(Island *isl, BoxId id) {
+    if (!OCCUPIED(isl->boxes[id])) return;
+    BoxPos pos = isl->boxes[id].pos;
+    island_rem_box(isl, id);
+    journal_append(((JournalRecord) { JournalOp_Rem, 0, 0, 0, pos }), NULL, 0);
+}
+
+/* box_set_kind, journaled */
+static void journal_set_kind(Island *isl, BoxId id, BoxKind kind) {
+    if (!OCCUPIED(isl->boxes[id]) || kind == BoxKind_Unoccupied || isl->boxes[id].kind == kind) return;
+    box_set_kind(isl, id, kind);
+    journal_append(((JournalRecord) { JournalOp_Kind, kind, 0, 0, isl->boxes[id].pos }), NULL, 0);
+}
+
+/* box_move_batch, journaled. the first swaps pairs of ids are boxes
+   trading places, ids[2k] going where ids[2k + 1] is and back, which only
+   need the one record; the rest just move. */
+static uint32_t journal_move_batch(Island *isl, BoxId *ids, BoxPos *to, uint32_t n, uint32_t swaps) {
+    uint32_t last = n - 1 - (n == 2 * swaps);
+    for (uint32_t i = 0; i < n; i++) {
+        int swap = i < 2 * swaps;
+        if (swap && (i & 1)) continue;
+        uint8_t flags = (uint8_t) ((swap ? JournalMove_Swap : 0) | (i == last ? JournalMove_Last : 0));
+        journal_append(((JournalRecord) { JournalOp_Move, 0, flags, 0, isl->boxes[ids[i]].pos, to[i] }), NULL, 0);
+    }
+    return box_move_batch(isl, ids, to, n);
+}
+
+static void journal_shape_edit(JournalOp op, BoxShape *s, BoxKind kind) {
+    JournalRecord r = { op, kind, s->kind, 0, s->lo, s->hi };
+    if (s->kind == BoxShape_Sphere) {
+        r.a = s->center;
+        r.b = (BoxPos) { s->radius };
+    }
+    if (s->kind != BoxShape_Mask) {
+        journal_append(r, NULL, 0);
+        return;
+    }
+
+    uint32_t mask_len = (uint32_t) (s->hi.x - s->lo.x + 1)
+                      * (s->hi.y - s->lo.y + 1)
+                      * (s->hi.z - s->lo.z + 1);
+    if (mask_len > JOURNAL_MAX_MASK) journal_checkpoint();
+    else journal_append(r, s->mask, mask_len);
+}
+
+/* island_fill, journaled */
+static Island *journal_fill(BoxShape *s, BoxKind kind) {
+    Island *res = island_fill(s, kind);
+    if (res) journal_shape_edit(JournalOp_Fill, s, kind);
+    return res;
+}
+
+/* island_carve, journaled */
+static void journal_carve(BoxShape *s) {
+    island_carve(s);
+    journal_shape_edit(JournalOp_Carve, s, BoxKind_Unoccupied);
+}
@@ -0,0 +1,342 @@
+/* Flood fill lighting.
+
+   Every empty cell near an island has two light levels, 0..15: sky light,
+   which comes straight down at full strength from open sky and fades by one
+   a step any other way, and block light, which comes from lamps and fades
+   by one a step every way. Boxes stop both. Outside of what's kept, it's
+   open sky.
+
+   What's kept is every chunk with boxes in it and every chunk next to one,
+   per island. The first time, and whenever an edit puts boxes in a chunk
+   that didn't have any (or empties one out), it's all lit from scratch.
+   Otherwise, the island's version log (see box.h) says which cells changed:
+   the light those cells had gets taken back out, by flood filling away
+   anything dimmer than it that could've come from it, and then whatever's
+   left shining on the edges of that hole floods back in. That only touches
+   the cells whose light actually changed. */
+
+#define LIGHT_MAX 15
+#define LIGHT_LAMP 14
+#define MAX_LIGHT_CHUNKS 256
+
+typedef struct {
+    BoxPos pos;
+    /* the island's occupancy chunk for pos, 0 if it has no boxes here */
+    uint16_t occ;
+    /* the chunk across each face, 0 if that's outside */
+    uint16_t next[Face_COUNT];
+    /* by box_chunk_index, sky light << 4 | block light */
+    uint8_t cells[BOX_CHUNK_SIZE * BOX_CHUNK_SIZE * BOX_CHUNK_SIZE];
+} LightChunk;
+
+typedef struct {
+    /* which island this was lit from, and how far along its log */
+    uint32_t uid, version;
+    /* more chunks than would fit; everything's just lit like open sky */
+    int overflow;
+    uint16_t chunk_count;
+    LightChunk chunks[MAX_LIGHT_CHUNKS];
+    PosMapSlot chunk_slots[MAX_LIGHT_CHUNKS * 2];
+    PosMap chunk_map;
+} BoxLight;
+
+/* one for each of islands[], in arena_world */
+static BoxLight *island_light;
+
+/* Queued cells are chunk << 12 | cell, plus the channel (sky or block) at
+   bit 20, plus the level being taken out at bit 21 for the removal queue.
+   Both get used as rings. */
+#define LIGHT_QUEUE_SIZE (1 << 20)
+#define LIGHT_SKY (1u << 20)
+static uint32_t light_queue[LIGHT_QUEUE_SIZE], light_unqueue[LIGHT_QUEUE_SIZE];
+static uint32_t light_head, light_tail, light_unhead, light_untail;
+
+static void light_push(uint32_t entry) {
+    if (light_tail - light_head == LIGHT_QUEUE_SIZE) {
+        log_err("Light queue full");
+        return;
+    }
+    light_queue[light_tail++ % LIGHT_QUEUE_SIZE] = entry;
+}
+
+static void light_unpush(uint32_t entry) {
+    if (light_untail - light_unhead == LIGHT_QUEUE_SIZE) {
+        log_err("Light removal queue full");
+        return;
+    }
+    light_unqueue[light_untail++ % LIGHT_QUEUE_SIZE] = entry;
+}
+
+static uint8_t light_get(LightChunk *c, uint32_t cell, uint32_t sky) {
+    return sky ? c->cells[cell] >> 4 : c->cells[cell] & 15;
+}
+
+static void light_set(LightChunk *c, uint32_t cell, uint32_t sky, uint8_t level) {
+    c->cells[cell] = sky ? (uint8_t) ((c->cells[cell] & 15) | level << 4)
+                         : (uint8_t) ((c->cells[cell] & 0xF0) | level);
+}
+
+static int light_occupied(Island *isl, LightChunk *c, uint32_t cell) {
+    if (c->occ == 0) return 0;
+    uint32_t x = cell & 15, y = (cell >> 4) & 15, z = cell >> 8;
+    return (isl->occs[c->occ].cols[x][z >> 2] >> ((z & 3) * 16 + y)) & 1;
+}
+
+/* the cell across face f from cell in chunk c. returns 0 if that's outside. */
+static uint16_t light_step(BoxLight *light, uint16_t c, uint32_t cell, Face f, uint32_t *out) {
+    int x = cell & 15, y = (cell >> 4) & 15, z = cell >> 8;
+    BoxPos o = face_offset[f];
+    x += o.x, y += o.y, z += o.z;
+    if ((x | y | z) & ~15) c = light->chunks[c].next[f];
+    *out = (uint32_t) ((x & 15) | (y & 15) << 4 | (z & 15) << 8);
+    return c;
+}
+
+/* how much light comes in across face f from outside, into a cell on the edge */
+static uint8_t light_inflow(Face f, uint32_t sky) {
+    if (!sky) return 0;
+    return f == Face_Above ? LIGHT_MAX : LIGHT_MAX - 1;
+}
+
+/* what a cell at level gives the one across face f from it */
+static uint8_t light_spread(uint8_t level, Face f, uint32_t sky) {
+    if (sky && f == Face_Below && level == LIGHT_MAX) return LIGHT_MAX;
+    return level ? level - 1 : 0;
+}
+
+/* floods everything queued with light_push out as far as it goes */
+static void light_flood(BoxLight *light, Island *isl) {
+    while (light_head != light_tail) {
+        uint32_t entry = light_queue[light_head++ % LIGHT_QUEUE_SIZE];
+        uint16_t c = (uint16_t) ((entry >> 12) & 0xFF);
+        uint32_t cell = entry & 0xFFF, sky = entry & LIGHT_SKY;
+        uint8_t level = light_get(light->chunks + c, cell, sky);
+        if (level <= 1) continue;
+
+        for (Face f = 0; f < Face_COUNT; f++) {
+            uint32_t ncell;
+            uint16_t nc = light_step(light, c, cell, f, &ncell);
+            if (nc == 0 || light_occupied(isl, light->chunks + nc, ncell)) continue;
+            uint8_t give = light_spread(level, f, sky);
+            if (give > light_get(light->chunks + nc, ncell, sky)) {
+                light_set(light->chunks + nc, ncell, sky, give);
+                light_push((uint32_t) nc << 12 | ncell | sky);
+            }
+        }
+    }
+}
+
+/* takes the light queued with light_unpush back out, along with anything
+   dimmer around it that it could have been lighting. whatever brighter is
+   left on the edges gets queued to flood back in. */
+static void light_unflood(BoxLight *light, Island *isl) {
+    while (light_unhead != light_untail) {
+        uint32_t entry = light_unqueue[light_unhead++ % LIGHT_QUEUE_SIZE];
+        uint16_t c = (uint16_t) ((entry >> 12) & 0xFF);
+        uint32_t cell = entry & 0xFFF, sky = entry & LIGHT_SKY;
+        uint8_t level = (uint8_t) (entry >> 21);
+
+        for (Face f = 0; f < Face_COUNT; f++) {
+            uint32_t ncell;
+            uint16_t nc = light_step(light, c, cell, f, &ncell);
+            LightChunk *n = light->chunks + nc;
+
+            /* the outside keeps on shining in */
+            if (nc == 0) {
+                uint8_t in = light_inflow(f, sky);
+                if (in > light_get(light->chunks + c, cell, sky) &&
+                    !light_occupied(isl, light->chunks + c, cell)) {
+                    light_set(light->chunks + c, cell, sky, in);
+                    light_push((uint32_t) c << 12 | cell | sky);
+                }
+                continue;
+            }
+            /* boxes are either dark, or lamps, which stay lit and shine back in */
+            if (light_occupied(isl, n, ncell)) {
+                if (light_get(n, ncell, sky)) light_push((uint32_t) nc << 12 | ncell | sky);
+                continue;
+            }
+
+            uint8_t has = light_get(n, ncell, sky);
+            if (has == 0) continue;
+            if (has < level || (sky && f == Face_Below && level == LIGHT_MAX && has == LIGHT_MAX)) {
+                light_set(n, ncell, sky, 0);
+                light_unpush((uint32_t) has << 21 | (uint32_t) nc << 12 | ncell | sky);
+            } else {
+                light_push((uint32_t) nc << 12 | ncell | sky);
+            }
+        }
+    }
+}
+
+static LightChunk *light_chunk(BoxLight *light, BoxPos chunk_pos) {
+    uint16_t c = pos_map_get(&light->chunk_map, chunk_pos);
+    return c ? light->chunks + c : NULL;
+}
+
+/* works out which chunks get kept, then lights them from scratch */
+static void light_relight(BoxLight *light, Island *isl) {
+    light->chunk_count = 1;
+    light->overflow = 0;
+    memset(light->chunk_slots, 0, sizeof(light->chunk_slots));
+    light->chunk_map = (PosMap) { light->chunk_slots, _countof(light->chunk_slots) - 1 };
+
+    for (uint16_t occ = 1; occ < MAX_BOX_OCCS; occ++) if (isl->occs[occ].count)
+        for (int dz = -1; dz <= 1; dz++)
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++) {
+                    BoxPos cp = add_bp(isl->occs[occ].pos, (BoxPos) { dx, dy, dz });
+                    if (pos_map_get(&light->chunk_map, cp)) continue;
+                    if (light->chunk_count == MAX_LIGHT_CHUNKS) {
+                        log_err("Island too spread out to light");
+                        light->overflow = 1;
+                        return;
+                    }
+                    uint16_t c = light->chunk_count++;
+                    light->chunks[c].pos = cp;
+                    pos_map_set(&light->chunk_map, cp, c);
+                }
+
+    for (uint16_t c = 1; c < light->chunk_count; c++) {
+        LightChunk *lc = light->chunks + c;
+        lc->occ = pos_map_get(&isl->occ_map, lc->pos);
+        for (Face f = 0; f < Face_COUNT; f++)
+            lc->next[f] = pos_map_get(&light->chunk_map, add_bp(lc->pos, face_offset[f]));
+        memset(lc->cells, 0, sizeof(lc->cells));
+    }
+
+    /* straight down from open sky, a run of chunks at a time */
+    for (uint16_t top = 1; top < light->chunk_count; top++) {
+        if (light->chunks[top].next[Face_Above]) continue;
+        /* bit x of open[z] for each column that hasn't hit a box yet */
+        uint16_t open[BOX_CHUNK_SIZE];
+        for (int z = 0; z < BOX_CHUNK_SIZE; z++) open[z] = 0xFFFF;
+
+        for (uint16_t c = top; c; c = light->chunks[c].next[Face_Below]) {
+            LightChunk *lc = light->chunks + c;
+            for (int y = BOX_CHUNK_SIZE - 1; y >= 0; y--)
+                for (int z = 0; z < BOX_CHUNK_SIZE; z++)
+                    for (int x = 0; x < BOX_CHUNK_SIZE; x++) {
+                        if (!(open[z] >> x & 1)) continue;
+                        uint32_t cell = (uint32_t) (x | y << 4 | z << 8);
+                        if (light_occupied(isl, lc, cell)) open[z] &= ~(1u << x);
+                        else lc->cells[cell] = LIGHT_MAX << 4;
+                    }
+        }
+    }
+
+    /* in from the sides, and from below */
+    for (uint16_t c = 1; c < light->chunk_count; c++) {
+        LightChunk *lc = light->chunks + c;
+        for (Face f = 0; f < Face_COUNT; f++) {
+            if (f == Face_Above || lc->next[f]) continue;
+            BoxPos o = face_offset[f];
+            for (int i = 0; i < BOX_CHUNK_SIZE; i++)
+                for (int j = 0; j < BOX_CHUNK_SIZE; j++) {
+                    /* i and j run along the two axes the face doesn't face along */
+                    int x = o.x ? (o.x > 0 ? 15 : 0) : i;
+                    int y = o.y ? (o.y > 0 ? 15 : 0) : (o.x ? i : j);
+                    int z = o.z ? (o.z > 0 ? 15 : 0) : j;
+                    uint32_t cell = (uint32_t) (x | y << 4 | z << 8);
+                    if (!light_occupied(isl, lc, cell) && light_get(lc, cell, LIGHT_SKY) < LIGHT_MAX - 1)
+                        light_set(lc, cell, LIGHT_SKY, LIGHT_MAX - 1);
+                }
+        }
+    }
+
+    /* then spread out into the dark from whatever's lit around it. most of
+       what's kept is open sky, with nowhere to spread to. */
+    for (uint16_t c = 1; c < light->chunk_count; c++) {
+        LightChunk *lc = light->chunks + c;
+        for (uint32_t cell = 0; cell < _countof(lc->cells); cell++) {
+            if (lc->cells[cell] >> 4 || light_occupied(isl, lc, cell)) continue;
+            for (Face f = 0; f < Face_COUNT; f++) {
+                uint32_t ncell;
+                uint16_t nc = light_step(light, c, cell, f, &ncell);
+                if (nc && light_get(light->chunks + nc, ncell, LIGHT_SKY) > 1)
+                    light_push((uint32_t) nc << 12 | ncell | LIGHT_SKY);
+            }
+        }
+    }
+
+    for (BoxId id = 1; id < MAX_BOXES; id++)
+        if (isl->boxes[id].kind == BoxKind_Lamp) {
+            BoxPos p = isl->boxes[id].pos;
+            uint16_t c = pos_map_get(&light->chunk_map, box_chunk_pos(p));
+            light_set(light->chunks + c, box_chunk_index(p), 0, LIGHT_LAMP);
+            light_push((uint32_t) c << 12 | box_chunk_index(p));
+        }
+
+    light_flood(light, isl);
+}
+
+/* catches light up with isl, which it's kept for */
+static void light_update(BoxLight *light, Island *isl) {
+    int relight = light->uid != isl->uid || !box_log_has(isl, light->version);
+
+    /* every changed cell has to be somewhere already kept, with the same
+       chunks having boxes in them as last time */
+    for (uint32_t v = light->version; !relight && v != isl->version; v++) {
+        BoxPos cp = box_chunk_pos(isl->log[v % BOX_LOG_SIZE].pos);
+        LightChunk *lc = light_chunk(light, cp);
+        relight = lc == NULL || lc->occ != pos_map_get(&isl->occ_map, cp);
+    }
+
+    if (relight) {
+        light_relight(light, isl);
+    } else if (!light->overflow) {
+        /* take out whatever light the changed cells had */
+        for (uint32_t v = light->version; v != isl->version; v++) {
+            BoxPos p = isl->log[v % BOX_LOG_SIZE].pos;
+            uint16_t c = pos_map_get(&light->chunk_map, box_chunk_pos(p));
+            uint32_t cell = box_chunk_index(p);
+            for (uint32_t sky = 0; sky <= LIGHT_SKY; sky += LIGHT_SKY) {
+                uint8_t had = light_get(light->chunks + c, cell, sky);
+                if (had == 0) continue;
+                light_set(light->chunks + c, cell, sky, 0);
+                light_unpush((uint32_t) had << 21 | (uint32_t) c << 12 | cell | sky);
+            }
+        }
+        light_unflood(light, isl);
+
+        /* then light them back up, from a lamp or from around them */
+        for (uint32_t v = light->version; v != isl->version; v++) {
+            BoxPos p = isl->log[v % BOX_LOG_SIZE].pos;
+            uint16_t c = pos_map_get(&light->chunk_map, box_chunk_pos(p));
+            LightChunk *lc = light->chunks + c;
+            uint32_t cell = box_chunk_index(p);
+
+            if (light_occupied(isl, lc, cell)) {
+                if (isl->boxes[box_index_find(isl, p)].kind != BoxKind_Lamp) continue;
+                light_set(lc, cell, 0, LIGHT_LAMP);
+                light_push((uint32_t) c << 12 | cell);
+                continue;
+            }
+
+            for (uint32_t sky = 0; sky <= LIGHT_SKY; sky += LIGHT_SKY) {
+                uint8_t best = light_get(lc, cell, sky);
+                for (Face f = 0; f < Face_COUNT; f++) {
+                    uint32_t ncell;
+                    uint16_t nc = light_step(light, c, cell, f, &ncell);
+                    uint8_t got = nc == 0 ? light_inflow(f, sky)
+                                : light_spread(light_get(light->chunks + nc, ncell, sky),
+                                               face_opposite[f], sky);
+                    best = m_max(best, got);
+                }
+                light_set(lc, cell, sky, best);
+                if (best) light_push((uint32_t) c << 12 | cell | sky);
+            }
+        }
+        light_flood(light, isl);
+    }
+
+    light->uid = isl->uid;
+    light->version = isl->version;
+}
+
+/* the light in the empty cell at p, as sky << 4 | block */
+static uint8_t light_at(BoxLight *light, BoxPos p) {
+    if (light->overflow) return LIGHT_MAX << 4;
+    LightChunk *lc = light_chunk(light, box_chunk_pos(p));
+    return lc ? lc->cells[box_chunk_index(p)] : LIGHT_MAX << 4;
+}
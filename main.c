@@ -1,8 +1,29 @@
 // keep this enabled when debugging
 #define USE_DEBUG_MODE 1
 #define CONTROLLER_SUPPORT 1
+// per-zone frame timings, dumped with F3
+#define USE_PROFILER 0
+// how boxes find their neighbors; BoxBackend_Linked, _Chunks, _Hash or _Bricks (see box.h)
+#define BOX_BACKEND BoxBackend_Linked
+// how wide math.h's batch kernels go; MathSimd_Scalar, _SSE or _AVX2 (needs a CPU that has it)
+#define MATH_SIMD MathSimd_SSE
+// back arena_world with 2MB pages, if we've been granted "Lock pages in memory" (see arena.h)
+#define USE_LARGE_PAGES 1
+// run bench.h's benchmarks instead of the game, results go to the debugger
+#define RUN_BENCHMARKS 0
+// save edits to world.journal as they happen, checkpointed into world.snap
+#define USE_JOURNAL 1
+// record every tick's input (offline only) to session.replay, for RUN_REPLAY (see replay.h)
+#define USE_REPLAY 1
+// play session.replay back as fast as it'll go, with no window, instead of the game
+#define RUN_REPLAY 0
+// NetMode_Offline plays alone, NetMode_Server hosts a shared world, NetMode_Client joins one (see net.h)
+#define NET_MODE NetMode_Offline
+// ticks a second, on the sim thread; rendering goes at whatever rate presenting does
+#define SIM_HZ 60
 
 #include <stdint.h>
+#include <intrin.h>
 extern __declspec(dllimport) float sinf(float x);
 extern __declspec(dllimport) float cosf(float x);
 extern __declspec(dllimport) float fmodf(float x, float y);
@@ -30,12 +51,28 @@ extern __declspec(dllimport) float sqrtf(float x);
 #pragma comment (lib, "user32.lib")
 #pragma comment (lib, "ced_crt.lib")
 #pragma comment (lib, "kernel32.lib")
+#pragma comment (lib, "advapi32.lib")
 #pragma comment (lib, "dxgi.lib")
 #pragma comment (lib, "d3d11.lib")
 #pragma comment (lib, "dxguid.lib")
 
 #include "err.h"
+#include "arena.h"
+#include "prof.h"
+#include "bvh.h"
 #include "box.h"
+#include "island.h"
+#include "journal.h"
+#include "replay.h"
+#include "jobs.h"
+#include "epoch.h"
+#include "entity.h"
+#include "particle.h"
+#include "update.h"
+#include "fluid.h"
+#include "net.h"
+#include "ao.h"
+#include "light.h"
 
 /* based on scancodes */
 typedef enum {
@@ -44,40 +81,77 @@ typedef enum {
     Key_A = 30,
     Key_D = 32,
     Key_Space = 57,
+    Key_Q = 16,
+    Key_E = 18,
+    Key_R = 19,
 } Key;
 typedef enum { CursorGrab_Free, CursorGrab_Grabbed } CursorGrab;
 static struct {
     CursorGrab cursor_grab;
     Vec2 mouse_pos, screen_size;
+    /* as of this tick; see input_take */
     uint64_t down_keys[512 / 64];
 
-    struct {
-        Vec3 pos, vel;
-        int8_t jump_cooldown, ground_cooldown;
-    } player;
+    Body player;
 
     struct {
         float yaw, pitch;
         Vec2 turn_vel;
     } cam;
 
-    /* https://docs.microsoft.com/en-us/windows/win32/inputdev/about-raw-input */
-    struct {
-        void *data;
-        uint64_t size;
-    } raw_input;
+    /* what's come in since the last tick. the window thread piles input
+       up in here and the sim thread takes it all at once every tick, both
+       holding input_lock, which is never held for more than a copy. */
+    SRWLOCK input_lock;
+    TickInput input;
+    /* where the controller's sticks are; held like keys, so they go into
+       every tick once instead of piling up every frame */
+    Vec2 stick_move, stick_turn;
 } state;
 
 static void key_set_down(Key key) {
-    state.down_keys[key/64] |= (uint64_t)1 << (key%64);
+    AcquireSRWLockExclusive(&state.input_lock);
+    state.input.down_keys[key/64] |= (uint64_t)1 << (key%64);
+    ReleaseSRWLockExclusive(&state.input_lock);
 }
 static void key_set_up(Key key) {
-    state.down_keys[key/64] &= ~((uint64_t)1 << (key%64));
+    AcquireSRWLockExclusive(&state.input_lock);
+    state.input.down_keys[key/64] &= ~((uint64_t)1 << (key%64));
+    ReleaseSRWLockExclusive(&state.input_lock);
 }
 static int key_down(Key key) {
     return !!(state.down_keys[key/64] & ((uint64_t)1 << (key%64)));
 }
 
+static void input_event(TickEvent e) {
+    AcquireSRWLockExclusive(&state.input_lock);
+    tick_event(&state.input, e);
+    ReleaseSRWLockExclusive(&state.input_lock);
+}
+static void input_turn(Vec2 delta) {
+    AcquireSRWLockExclusive(&state.input_lock);
+    state.input.turn = add2(state.input.turn, delta);
+    ReleaseSRWLockExclusive(&state.input_lock);
+}
+static void input_sticks(Vec2 move, Vec2 turn) {
+    AcquireSRWLockExclusive(&state.input_lock);
+    state.stick_move = move;
+    state.stick_turn = turn;
+    ReleaseSRWLockExclusive(&state.input_lock);
+}
+
+/* everything since the last one; the keys and sticks stay down until they
+   come up */
+static void input_take(TickInput *in) {
+    AcquireSRWLockExclusive(&state.input_lock);
+    *in = state.input;
+    in->move = add2(in->move, state.stick_move);
+    in->turn = add2(in->turn, state.stick_turn);
+    state.input.turn = state.input.move = (Vec2) {0};
+    state.input.event_count = 0;
+    ReleaseSRWLockExclusive(&state.input_lock);
+}
+
 static void cam_turn(Vec2 delta) {
     delta.y *= -1.0f;
     delta = mul2_f(delta, 0.0003f);
@@ -117,110 +191,274 @@ static void player_move(Vec2 dir) {
 
 static void player_interact() {
     Face face = Face_COUNT;
-    BoxId build_onto = box_under_ray(player_eye(), cam_facing(), &face);
+    Island *isl;
+    BoxId build_onto = island_under_ray(player_eye(), cam_facing(), &face, &isl);
     if (face == Face_COUNT || build_onto == BoxId_NULL) return;
-    add_box(build_onto, face, BoxKind_Dirt);
+    /* hold Q to put down a lamp, E for water, R for sand */
+    BoxKind kind = key_down(Key_Q) ? BoxKind_Lamp
+                 : key_down(Key_E) ? BoxKind_Water
+                 : key_down(Key_R) ? BoxKind_Sand : BoxKind_Dirt;
+#if NET_MODE == NetMode_Client
+    net_request_add(isl->boxes[build_onto].pos, face, kind);
+#else
+    journal_add_box(isl, build_onto, face, kind);
+#endif
 }
 
 static void player_hit() {
-    BoxId target = box_under_ray(player_eye(), cam_facing(), NULL);
+    Island *isl;
+    BoxId target = island_under_ray(player_eye(), cam_facing(), NULL, &isl);
     if (target == BoxId_NULL) return;
-    rem_box(target);
+    particle_burst(isl, isl->boxes[target].pos, isl->boxes[target].kind, PARTICLE_BURST);
+#if NET_MODE == NetMode_Client
+    net_request_rem(isl->boxes[target].pos);
+#else
+    journal_rem_box(isl, target);
+#endif
 }
 
-float sdf_box3(Vec3 p) {
-    Vec3 d = sub3(abs3(p), vec3_f(0.5f));
-    return mag3(max3_f(d, 0.0f)) + min(max(max(d.x,d.y), d.z), 0.0f);
+/* the player's box, which goes up from their feet */
+#define PLAYER_HALF_WIDTH (0.3f)
+#define PLAYER_HEIGHT (1.8f)
+
+/* the player's a Body like any entity, just stepped on its own */
+static void player_physics() {
+    body_step(&state.player, PLAYER_HALF_WIDTH, PLAYER_HEIGHT);
 }
 
-Vec3 sdf_box_normal3(Vec3 p) {
-    float h = 0.0002f; /* TODO: make sure this is appropriate */
-    Vec2 k = vec2(1,-1);
-    Vec3   q = mul3_f(vec3( 1, -1, -1), sdf_box3(add3(p, mul3_f(vec3( 1, -1, -1), h))));
-    q = add3(q, mul3_f(vec3(-1, -1,  1), sdf_box3(add3(p, mul3_f(vec3(-1, -1,  1), h)))));
-    q = add3(q, mul3_f(vec3(-1,  1, -1), sdf_box3(add3(p, mul3_f(vec3(-1,  1, -1), h)))));
-    q = add3(q, mul3_f(vec3( 1,  1,  1), sdf_box3(add3(p, mul3_f(vec3( 1,  1,  1), h)))));
-    return norm3(q);
+static void player_try_jump() {
+    if (state.player.ground_cooldown < -15)
+        state.player.jump_cooldown = 0;
 }
 
-/* tests the player's position against all of the boxes, 
-   pushing him out if he intersects with any of them. */
-static void player_physics() {
-    typedef struct { Vec3 pos; BoxId box; float dist; } Nearest;
-    Nearest nearest = { .dist = INFINITY };
-
-    #define plyr state.player
-
-    /* center of the player's collider */
-    #define PLAYER_COLLIDER_SIZE (0.4f)
-    Vec3 plrc = plyr.pos;
-    plrc.y += PLAYER_COLLIDER_SIZE;
-
-    for (BoxId id = 1; id < MAX_BOXES; id++)
-        if (OCCUPIED(boxes[id])) {
-            Vec3 pos = box_pos_to_vec3(boxes[id].pos);
-            pos = sub3(plrc, add3_f(pos, 0.5f));
-            float this_dist = sdf_box3(pos);
-            /* but if the distance is less than 0.25f, we've probably placed a block
-               over our head, which probably shouldn't be handled by this code. */
-            if (this_dist < nearest.dist && this_dist > 0.25f)
-                nearest = (Nearest) { pos, id, this_dist };
-        }
-    
-    /* if the distance is less than 0.5f, they're inside of our collider. */
-    int touched_tile = 0;
-    if (nearest.dist < PLAYER_COLLIDER_SIZE) {
-        float depth = fabsf(nearest.dist - PLAYER_COLLIDER_SIZE);
-        Vec3 out = mul3_f(sdf_box_normal3(nearest.pos), depth * 0.65f);
-        plyr.vel = add3(plyr.vel, out);
-
-        if (boxes[nearest.box].pos.y < plyr.pos.y) {
-            plyr.ground_cooldown = min(0, sat_i8(plyr.ground_cooldown - 1));
-            touched_tile = 1;
-        } else {
-            /* ya done bumped ya head, go down faster! */
-            plyr.jump_cooldown = sat_i8(plyr.jump_cooldown + 5);
-        }
+/* turns the island you're looking at a bit, around the box you're looking at */
+static void player_turn_island() {
+    Island *isl;
+    BoxId target = island_under_ray(player_eye(), cam_facing(), NULL, &isl);
+    if (target == BoxId_NULL) return;
+    Vec3 pivot = island_to_world(isl, add3_f(box_pos_to_vec3(isl->boxes[target].pos), 0.5f));
+    Mat4 turn = mul4x4(translate4x4(pivot), mul4x4(rotate4x4(vec3_y, PI_f / 12.0f),
+                                                 translate4x4(mul3_f(pivot, -1.0f))));
+    island_move(isl, mul4x4(turn, island_xform[isl - islands].to_world));
+}
+
+/* one step of the game, going only off of in, so that replaying a
+   recording of them ends up exactly where the original did */
+static void sim_tick(TickInput *in) {
+    memcpy(state.down_keys, in->down_keys, sizeof(state.down_keys));
+    cam_turn(in->turn);
+    for (uint32_t i = 0; i < in->event_count; i++) switch (in->events[i]) {
+        case TickEvent_Interact:   player_interact();    break;
+        case TickEvent_Hit:        player_hit();         break;
+        case TickEvent_Jump:       player_try_jump();    break;
+        case TickEvent_TurnIsland: player_turn_island(); break;
     }
-    if (!touched_tile) 
-        plyr.ground_cooldown = max(0, sat_i8(plyr.ground_cooldown + 1));
 
-    float boost = (float) sat_i8(plyr.ground_cooldown - 10) / 100.0f;
-    plyr.pos.y -= 0.03f + 0.1f * max(0.0f, min(1.0f, boost));
+    if (magmag2(in->move) > 0.0f)
+        player_move(in->move);
+    Vec2 move = {0};
+    if (key_down(Key_W)) move.x += 1.0f;
+    if (key_down(Key_S)) move.x -= 1.0f;
+    if (key_down(Key_A)) move.y += 1.0f;
+    if (key_down(Key_D)) move.y -= 1.0f;
+    if (magmag2(move) > 0.0f)
+        player_move(norm2(move));
+
+    if (key_down(Key_Space))
+        player_try_jump();
+
+    cam_update();
+    PROF_ZONE(ProfZone_PlayerPhysics)
+        player_physics();
+    PROF_ZONE(ProfZone_Entities)
+        entity_step(1);
+    PROF_ZONE(ProfZone_Particles)
+        particle_step();
+#if NET_MODE != NetMode_Client
+    PROF_ZONE(ProfZone_Updates)
+        update_tick();
+    PROF_ZONE(ProfZone_Fluid)
+        fluid_tick(1);
+#endif
+    island_tick();
+    journal_tick();
+#if NET_MODE == NetMode_Server
+    net_server_tick();
+#elif NET_MODE == NetMode_Client
+    net_client_tick(state.player.pos);
+#endif
+}
+
+/* everything a replay has to end up agreeing on */
+static uint64_t sim_hash() {
+    uint64_t h = replay_world_hash();
+    h = replay_hash_bytes(h, &state.player.pos, sizeof(Vec3));
+    h = replay_hash_bytes(h, &state.player.vel, sizeof(Vec3));
+    h = replay_hash_bytes(h, &state.player.jump_cooldown, 1);
+    h = replay_hash_bytes(h, &state.player.ground_cooldown, 1);
+    h = replay_hash_bytes(h, &state.cam.yaw, sizeof(float));
+    h = replay_hash_bytes(h, &state.cam.pitch, sizeof(float));
+    h = replay_hash_bytes(h, &state.cam.turn_vel, sizeof(Vec2));
+    return fluid_hash(update_hash(entity_hash(h)));
+}
 
-    plyr.jump_cooldown = sat_i8(plyr.jump_cooldown + 1);
-    if (plyr.jump_cooldown < 50)
-        plyr.vel.y += 0.0675f * (1.0f - (plyr.jump_cooldown / 50.0f));
+#define REPLAY_PATH "session.replay"
 
-    plyr.vel = mul3_f(plyr.vel, 0.65f);
-    plyr.pos = add3(plyr.pos, plyr.vel);
+static void sim_record() {
+#if USE_REPLAY && NET_MODE == NetMode_Offline
+    if (!replay_record(REPLAY_PATH)) return;
+    replay_put(&state.player, sizeof(state.player));
+    replay_put(&state.cam, sizeof(state.cam));
+    entity_record();
+    update_record();
+    fluid_record();
+#endif
 }
 
-static void player_try_jump() {
-    if (state.player.ground_cooldown < -15)
-        state.player.jump_cooldown = 0;
+/* runs REPLAY_PATH, and says whether it came out the same */
+static void sim_replay() {
+    if (!replay_play(REPLAY_PATH)) return;
+    replay_get(&state.player, sizeof(state.player));
+    replay_get(&state.cam, sizeof(state.cam));
+    if (!entity_replay() || !update_replay() || !fluid_replay()) {
+        log_err("Replay is garbled");
+        replay_close();
+        return;
+    }
+
+    LARGE_INTEGER start, end, freq;
+    QueryPerformanceCounter(&start);
+    TickInput in;
+    uint64_t end_hash;
+    int has_end;
+    while (replay_next(&in, &end_hash, &has_end))
+        PROF_ZONE(ProfZone_Frame)
+            sim_tick(&in);
+    QueryPerformanceCounter(&end);
+    QueryPerformanceFrequency(&freq);
+    replay_close();
+
+    char buf[128];
+    Fmt f = { buf, 0, sizeof(buf) };
+    fmt_str(&f, "replayed ");
+    fmt_u64(&f, replay.ticks);
+    fmt_str(&f, " ticks in ");
+    fmt_f32(&f, (float) (end.QuadPart - start.QuadPart) * 1000.0f / (float) freq.QuadPart, 3);
+    fmt_str(&f, "ms");
+    log_fmt(&f);
+
+    if (!has_end)
+        log_err("Replay was cut off, so there's nothing to check it against");
+    else if (end_hash != sim_hash())
+        log_err("Replay came out different from the recording");
+    else {
+        fmt_str(&f, "replay matches the recording");
+        log_fmt(&f);
+    }
+#if USE_PROFILER
+    prof_log_summary();
+    prof_dump_trace("trace.json");
+#endif
 }
 
 static void init_world() {
     /* moved somewhere and pulled these values out of debugger */
-    state.player.pos = vec3(0.1f, -0.01f, 0.09f);
+    state.player.pos = vec3(0.1f, 0.0f, 0.09f);
     state.cam.yaw = 0.818;
     state.cam.pitch = -0.88;
 
-    #define ORIGIN 1
-    boxes[ORIGIN] = (Box) {
-        .kind = BoxKind_Dirt,
-        .pos.y = -1,
-    };
-    add_box(ORIGIN, Face_Left, BoxKind_Dirt);
-    add_box(ORIGIN, Face_Right, BoxKind_Dirt);
-    add_box(ORIGIN, Face_Front, BoxKind_Dirt);
-    add_box(ORIGIN, Face_Back, BoxKind_Dirt);
+#if NET_MODE == NetMode_Client
+    /* the world comes from the server */
+    net_init(0);
+    return;
+#elif NET_MODE == NetMode_Server
+    net_init(1);
+#endif
+
+    if (journal_open("world")) return;
+
+    Island *isl = island_alloc();
+    BoxId origin = box_insert(isl, (BoxPos) { .y = -1 }, BoxKind_Grass);
+    add_box(isl, origin, Face_Left, BoxKind_Grass);
+    add_box(isl, origin, Face_Right, BoxKind_Grass);
+    add_box(isl, origin, Face_Front, BoxKind_Grass);
+    add_box(isl, origin, Face_Back, BoxKind_Grass);
+    journal_checkpoint();
 }
 
 
 #include "render.h"
 
+#if RUN_BENCHMARKS
+    #include "bench.h"
+#endif
+
+/* set by the window thread, for the sim thread to pick up after its next tick */
+static volatile LONG sim_quit, sim_log_mem;
+
+static void sim_log_mem_report() {
+    for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+        char name[16];
+        Fmt f = { name, 0, sizeof(name) - 1 };
+        fmt_str(&f, "island ");
+        fmt_u64(&f, i);
+        name[f.len] = '\0';
+
+        BoxMemReport report = box_mem_report(islands + i);
+        report.mesh_bytes = render_mesh_bytes(i);
+        box_mem_log(name, report);
+    }
+    arena_log(&arena_world);
+    arena_log(&arena_frame);
+}
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+/* ticks SIM_HZ times a second, publishing a FrameSnap after each, no
+   matter how long presenting takes on the window thread */
+static DWORD WINAPI sim_thread(LPVOID arg) {
+    /* plain waitable timers only go off on the scheduler's ~15ms ticks */
+    HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (timer == NULL) timer = CreateWaitableTimerW(NULL, FALSE, NULL);
+
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    int64_t period = freq.QuadPart / SIM_HZ, next = now.QuadPart;
+
+    while (!sim_quit) {
+        arena_reset(&arena_frame);
+
+        TickInput in;
+        input_take(&in);
+        PROF_ZONE(ProfZone_SimTick) {
+            replay_tick(&in);
+            sim_tick(&in);
+            box_view_publish();
+            frame_build();
+        }
+        if (InterlockedExchange(&sim_log_mem, 0))
+            sim_log_mem_report();
+
+        next += period;
+        QueryPerformanceCounter(&now);
+        if (now.QuadPart < next) {
+            LARGE_INTEGER due = { .QuadPart = -(next - now.QuadPart) * 10000000 / freq.QuadPart };
+            if (timer && SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE))
+                WaitForSingleObject(timer, INFINITE);
+            else Sleep(1);
+        } else if (now.QuadPart - next > period * 4) {
+            /* way behind (a breakpoint, say); don't try to make it all up at once */
+            next = now.QuadPart;
+        }
+    }
+
+    if (timer) CloseHandle(timer);
+    return 0;
+}
+
 static void update_clip_rect(HWND wnd) {
     RECT clip_rect;
     GetClientRect(wnd, &clip_rect);
@@ -259,6 +497,22 @@ static LRESULT CALLBACK window_proc(HWND wnd, UINT msg, WPARAM wparam, LPARAM lp
                 #endif
             }
 
+        #if USE_PROFILER
+        if (wparam == VK_F3) {
+            prof_log_summary();
+            prof_dump_trace("trace.json");
+        }
+        #endif
+
+        #if USE_DEBUG_MODE
+        /* the islands are the sim thread's, so it does the logging */
+        if (wparam == VK_F4)
+            InterlockedExchange(&sim_log_mem, 1);
+
+        if (wparam == VK_F5)
+            input_event(TickEvent_TurnIsland);
+        #endif
+
         key_set_down(HIWORD(lparam) & (KF_EXTENDED | 0xff));
         return 0;
 
@@ -279,12 +533,12 @@ static LRESULT CALLBACK window_proc(HWND wnd, UINT msg, WPARAM wparam, LPARAM lp
             SetCursor(NULL);
             update_clip_rect(wnd);
         } else {
-            player_hit();
+            input_event(TickEvent_Hit);
         }
         return 0;
 
     case WM_RBUTTONDOWN:
-        player_interact();
+        input_event(TickEvent_Interact);
         return 0;
 
     case WM_MOUSEMOVE:
@@ -292,25 +546,17 @@ static LRESULT CALLBACK window_proc(HWND wnd, UINT msg, WPARAM wparam, LPARAM lp
         state.mouse_pos.y = GET_Y_LPARAM(lparam);
         return 0;
 
+    /* https://docs.microsoft.com/en-us/windows/win32/inputdev/about-raw-input */
     case WM_INPUT:;
-        uint32_t size = 0;
         HRAWINPUT ri_handle = (HRAWINPUT) lparam;
 
-        GetRawInputData(ri_handle, RID_INPUT, NULL, &size, sizeof(RAWINPUTHEADER));
-        if (size > (uint32_t) state.raw_input.size) {
-            state.raw_input.size = size;
-            HeapFree(GetProcessHeap(), 0, state.raw_input.data);
-            state.raw_input.data = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, size);
-            if (state.raw_input.data == NULL) {
-                log_win32_last_err("Failed to resize raw input data");
-                break;
-            }
-        }
-
-        size = state.raw_input.size;
+        /* the mouse is all that's registered, and its input is always the
+           same size; arena_frame is the sim thread's, so it goes on the stack */
+        RAWINPUT data;
+        uint32_t size = sizeof(data);
         uint32_t res = GetRawInputData(
             ri_handle, RID_INPUT,
-            state.raw_input.data,
+            &data,
             &size,
             sizeof(RAWINPUTHEADER)
         );
@@ -319,16 +565,15 @@ static LRESULT CALLBACK window_proc(HWND wnd, UINT msg, WPARAM wparam, LPARAM lp
             break;
         }
 
-        RAWINPUT* data = state.raw_input.data;
         Vec2 delta = {
-            data->data.mouse.lLastX,
-            data->data.mouse.lLastY,
+            data.data.mouse.lLastX,
+            data.data.mouse.lLastY,
         };
 
-        if (data->data.mouse.usFlags & MOUSE_MOVE_ABSOLUTE)
+        if (data.data.mouse.usFlags & MOUSE_MOVE_ABSOLUTE)
             delta = sub2(delta, state.mouse_pos);
 
-        cam_turn(delta);
+        input_turn(delta);
         state.mouse_pos = add2(state.mouse_pos, delta);
         return 0;
 
@@ -351,6 +596,18 @@ int WINAPI WinMainCRTStartup(void) {
     HINSTANCE instance = GetModuleHandle(NULL);
     INT cmd_show = TRUE;
 
+    prof_init();
+
+#if RUN_BENCHMARKS
+    bench_run();
+    ExitProcess(0);
+#endif
+
+#if RUN_REPLAY
+    sim_replay();
+    ExitProcess(0);
+#endif
+
     WNDCLASSEXW wc = {
         .cbSize = sizeof(wc),
         .lpfnWndProc = window_proc,
@@ -397,6 +654,13 @@ int WINAPI WinMainCRTStartup(void) {
 #endif
 
     init_world();
+    sim_record();
+
+    HANDLE sim = CreateThread(NULL, 0, sim_thread, NULL, 0, NULL);
+    if (sim == NULL) {
+        log_win32_last_err("Couldn't start the sim thread");
+        ExitProcess(1);
+    }
 
     for (;;) {
         MSG msg;
@@ -409,6 +673,7 @@ int WINAPI WinMainCRTStartup(void) {
         }
 
 #if CONTROLLER_SUPPORT
+        Vec2 stick_move = {0}, stick_turn = {0};
         for (uint32_t i = 0; i < controllers.device_count; i++) {
             DIJOYSTATE state;
             IDirectInputDevice8* dvi = *controllers.devices + i;
@@ -423,7 +688,7 @@ int WINAPI WinMainCRTStartup(void) {
 
                     /* camera inputs */
                     if (magmag2(lthumb) > 0.03f)
-                        cam_turn(mul2_f(lthumb, 30.0f));
+                        stick_turn = add2(stick_turn, mul2_f(lthumb, 30.0f));
                 }
 
                 {
@@ -435,7 +700,7 @@ int WINAPI WinMainCRTStartup(void) {
 
                     /* movement inputs */
                     if (magmag2(rthumb) > 0.03f)
-                        player_move(rthumb);
+                        stick_move = add2(stick_move, rthumb);
                 }
 
                 {
@@ -446,7 +711,7 @@ int WINAPI WinMainCRTStartup(void) {
                     if (triggers < 0.4f) {
                         if (!rtrigger_held) {
                             rtrigger_held = 1;
-                            player_interact();
+                            input_event(TickEvent_Interact);
                         }
                     } else rtrigger_held = 0;
 
@@ -454,38 +719,42 @@ int WINAPI WinMainCRTStartup(void) {
                     if (triggers > 0.6f) {
                         if (!ltrigger_held) {
                             ltrigger_held = 1;
-                            player_hit();
+                            input_event(TickEvent_Hit);
                         }
                     } else ltrigger_held = 0;
                 }
 
-                if (state.rgbButtons[0])
-                    player_try_jump();
+                static int jump_held = 0;
+                if (state.rgbButtons[0]) {
+                    if (!jump_held) {
+                        jump_held = 1;
+                        input_event(TickEvent_Jump);
+                    }
+                } else jump_held = 0;
             }
         }
+        input_sticks(stick_move, stick_turn);
 #endif
 
-        Vec2 move = {0};
-        if (key_down(Key_W)) move.x += 1.0f;
-        if (key_down(Key_S)) move.x -= 1.0f;
-        if (key_down(Key_A)) move.y += 1.0f;
-        if (key_down(Key_D)) move.y -= 1.0f;
-        if (magmag2(move) > 0.0f)
-            player_move(norm2(move));
-
-        if (key_down(Key_Space))
-            player_try_jump();
+        HRESULT present_hr = S_OK;
+        PROF_ZONE(ProfZone_Frame) {
+            PROF_ZONE(ProfZone_RenderFrame)
+                render_frame(frame_acquire());
 
-        cam_update();
-        player_physics();
-
-        render_frame();
-
-        if (FAILED(render_present(wnd)))
+            PROF_ZONE(ProfZone_RenderPresent)
+                present_hr = render_present(wnd);
+        }
+        if (FAILED(present_hr))
             break;
     }
 
+    InterlockedExchange(&sim_quit, 1);
+    WaitForSingleObject(sim, INFINITE);
+    CloseHandle(sim);
+
     UnregisterClassW(wc.lpszClassName, wc.hInstance);
+    replay_stop(sim_hash());
+    journal_close();
 
     ExitProcess(0);
 }
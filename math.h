@@ -13,6 +13,11 @@ static float fabsf(float f) {
     return (f < 0.0f) ? -f : f;
 }
 
+static float floorf(float f) {
+    float i = (float) (int32_t) f;
+    return (f < i) ? i - 1.0f : i;
+}
+
 static float sign(float f) {
     if (f > 0.0) return -1.0f;
     if (f < 0.0) return  1.0f;
@@ -23,6 +28,31 @@ static float step(float edge, float x) {
     return (x < edge) ? 0.0f : 1.0f;
 }
 
+/* index of the lowest set bit; x can't be 0 */
+static uint32_t ctz64(uint64_t x) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return i;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+/* xorshift32; state must start out nonzero */
+static uint32_t rand_u32(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/* 0..1 */
+static float rand_f(uint32_t *state) {
+    return (float) (rand_u32(state) >> 8) / (float) (1 << 24);
+}
+
 typedef struct { float x, y; } Vec2;
 static Vec2 vec2(float x, float y) {
     return (Vec2) { x, y };
@@ -252,6 +282,33 @@ static Mat4 rotate4x4(Vec3 axis, float angle) {
     return res;
 }
 
+/* undoes m, which can only turn and move things, not scale or skew them */
+static Mat4 invert_rigid4x4(Mat4 m) {
+    Mat4 res = ident4x4();
+    for (int c = 0; c < 3; ++c)
+        for (int r = 0; r < 3; ++r)
+            res.nums[c][r] = m.nums[r][c];
+    for (int r = 0; r < 3; ++r)
+        res.nums[3][r] = -(res.nums[0][r] * m.nums[3][0] +
+                           res.nums[1][r] * m.nums[3][1] +
+                           res.nums[2][r] * m.nums[3][2]);
+    return res;
+}
+
+/* p moved by m, as a point, so it picks up m's translation */
+static Vec3 mul4x4_pos(Mat4 m, Vec3 p) {
+    return vec3(m.nums[0][0] * p.x + m.nums[1][0] * p.y + m.nums[2][0] * p.z + m.nums[3][0],
+                m.nums[0][1] * p.x + m.nums[1][1] * p.y + m.nums[2][1] * p.z + m.nums[3][1],
+                m.nums[0][2] * p.x + m.nums[1][2] * p.y + m.nums[2][2] * p.z + m.nums[3][2]);
+}
+
+/* d turned by m, as a direction, so it doesn't */
+static Vec3 mul4x4_dir(Mat4 m, Vec3 d) {
+    return vec3(m.nums[0][0] * d.x + m.nums[1][0] * d.y + m.nums[2][0] * d.z,
+                m.nums[0][1] * d.x + m.nums[1][1] * d.y + m.nums[2][1] * d.z,
+                m.nums[0][2] * d.x + m.nums[1][2] * d.y + m.nums[2][2] * d.z);
+}
+
 /* equivalent to XMMatrixPerspectiveFovLH
    https://docs.microsoft.com/en-us/windows/win32/api/directxmath/nf-directxmath-xmmatrixperspectivefovlh
 */
@@ -290,3 +347,176 @@ static Mat4 look_at4x4(Vec3 eye, Vec3 focus, Vec3 up) {
         {   D0,   D1,   D2, 1.0f }
     }};
 }
+
+
+/* Batch versions of the above, for when there's thousands of something to do
+   instead of one: transforming an island's worth of points, testing every
+   chunk against the view, stepping lots of things at once. They take their
+   vectors as separate arrays of x, y and z ("structure of arrays"), so a SIMD
+   register's worth of x can be loaded at once; whatever's left over at the
+   end goes through the plain scalar math. MATH_SIMD (top of main.c) picks
+   how wide to go.
+
+   Every lane does the same float operations in the same order as the scalar
+   functions, with no fused multiply-adds or approximate reciprocals, so the
+   results come out the same to the bit whichever MATH_SIMD you pick. */
+#define MathSimd_Scalar 0
+#define MathSimd_SSE    1
+#define MathSimd_AVX2   2
+#ifndef MATH_SIMD
+#define MATH_SIMD MathSimd_SSE
+#endif
+
+#if MATH_SIMD == MathSimd_AVX2
+    #define SIMD_WIDTH 8
+    typedef __m256 f32xN;
+    #define f32xN_load(p)      _mm256_loadu_ps(p)
+    #define f32xN_store(p, v)  _mm256_storeu_ps(p, v)
+    #define f32xN_set(f)       _mm256_set1_ps(f)
+    #define f32xN_add(a, b)    _mm256_add_ps(a, b)
+    #define f32xN_sub(a, b)    _mm256_sub_ps(a, b)
+    #define f32xN_mul(a, b)    _mm256_mul_ps(a, b)
+    #define f32xN_div(a, b)    _mm256_div_ps(a, b)
+    #define f32xN_sqrt(a)      _mm256_sqrt_ps(a)
+    #define f32xN_abs(a)       _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a)
+    /* one bit per lane, set where a < b */
+    #define f32xN_lt(a, b)     (uint32_t) _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ))
+#elif MATH_SIMD == MathSimd_SSE
+    #define SIMD_WIDTH 4
+    typedef __m128 f32xN;
+    #define f32xN_load(p)      _mm_loadu_ps(p)
+    #define f32xN_store(p, v)  _mm_storeu_ps(p, v)
+    #define f32xN_set(f)       _mm_set1_ps(f)
+    #define f32xN_add(a, b)    _mm_add_ps(a, b)
+    #define f32xN_sub(a, b)    _mm_sub_ps(a, b)
+    #define f32xN_mul(a, b)    _mm_mul_ps(a, b)
+    #define f32xN_div(a, b)    _mm_div_ps(a, b)
+    #define f32xN_sqrt(a)      _mm_sqrt_ps(a)
+    #define f32xN_abs(a)       _mm_andnot_ps(_mm_set1_ps(-0.0f), a)
+    #define f32xN_lt(a, b)     (uint32_t) _mm_movemask_ps(_mm_cmplt_ps(a, b))
+#endif
+
+/* n vectors, one array per component. the arrays don't have to be aligned. */
+typedef struct { float *x, *y, *z; } Vec3s;
+
+static Vec3 vec3s_get(Vec3s v, uint32_t i) {
+    return vec3(v.x[i], v.y[i], v.z[i]);
+}
+static void vec3s_set(Vec3s v, uint32_t i, Vec3 to) {
+    v.x[i] = to.x;
+    v.y[i] = to.y;
+    v.z[i] = to.z;
+}
+
+/* mul4x4_pos for n points. out can be in. */
+static void mul4x4_pos_n(Mat4 m, Vec3s in, Vec3s out, uint32_t n) {
+    uint32_t i = 0;
+#if MATH_SIMD
+    f32xN c[4][3];
+    for (int col = 0; col < 4; col++)
+        for (int row = 0; row < 3; row++)
+            c[col][row] = f32xN_set(m.nums[col][row]);
+
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+        f32xN x = f32xN_load(in.x + i), y = f32xN_load(in.y + i), z = f32xN_load(in.z + i);
+        f32xN res[3];
+        for (int row = 0; row < 3; row++)
+            res[row] = f32xN_add(f32xN_add(f32xN_add(f32xN_mul(c[0][row], x), f32xN_mul(c[1][row], y)),
+                                           f32xN_mul(c[2][row], z)), c[3][row]);
+        f32xN_store(out.x + i, res[0]);
+        f32xN_store(out.y + i, res[1]);
+        f32xN_store(out.z + i, res[2]);
+    }
+#endif
+    for (; i < n; i++)
+        vec3s_set(out, i, mul4x4_pos(m, vec3s_get(in, i)));
+}
+
+/* dot3 of each pair, into out[i] */
+static void dot3_n(Vec3s a, Vec3s b, float *out, uint32_t n) {
+    uint32_t i = 0;
+#if MATH_SIMD
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+        f32xN res = f32xN_add(f32xN_add(f32xN_mul(f32xN_load(a.x + i), f32xN_load(b.x + i)),
+                                        f32xN_mul(f32xN_load(a.y + i), f32xN_load(b.y + i))),
+                              f32xN_mul(f32xN_load(a.z + i), f32xN_load(b.z + i)));
+        f32xN_store(out + i, res);
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = dot3(vec3s_get(a, i), vec3s_get(b, i));
+}
+
+/* cross3 of each pair. out can be a or b. */
+static void cross3_n(Vec3s a, Vec3s b, Vec3s out, uint32_t n) {
+    uint32_t i = 0;
+#if MATH_SIMD
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+        f32xN ax = f32xN_load(a.x + i), ay = f32xN_load(a.y + i), az = f32xN_load(a.z + i);
+        f32xN bx = f32xN_load(b.x + i), by = f32xN_load(b.y + i), bz = f32xN_load(b.z + i);
+        f32xN_store(out.x + i, f32xN_sub(f32xN_mul(ay, bz), f32xN_mul(az, by)));
+        f32xN_store(out.y + i, f32xN_sub(f32xN_mul(az, bx), f32xN_mul(ax, bz)));
+        f32xN_store(out.z + i, f32xN_sub(f32xN_mul(ax, by), f32xN_mul(ay, bx)));
+    }
+#endif
+    for (; i < n; i++)
+        vec3s_set(out, i, cross3(vec3s_get(a, i), vec3s_get(b, i)));
+}
+
+/* norm3 of each. out can be in. */
+static void norm3_n(Vec3s in, Vec3s out, uint32_t n) {
+    uint32_t i = 0;
+#if MATH_SIMD
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+        f32xN x = f32xN_load(in.x + i), y = f32xN_load(in.y + i), z = f32xN_load(in.z + i);
+        f32xN mag = f32xN_sqrt(f32xN_add(f32xN_add(f32xN_mul(x, x), f32xN_mul(y, y)), f32xN_mul(z, z)));
+        f32xN_store(out.x + i, f32xN_div(x, mag));
+        f32xN_store(out.y + i, f32xN_div(y, mag));
+        f32xN_store(out.z + i, f32xN_div(z, mag));
+    }
+#endif
+    for (; i < n; i++)
+        vec3s_set(out, i, norm3(vec3s_get(in, i)));
+}
+
+/* whether the box lo..hi is at least partly on the inside of plane, where the
+   inside of a plane is wherever dot3(xyz, p) + w comes out positive */
+static int aabb_plane_in(Vec4 plane, Vec3 lo, Vec3 hi) {
+    Vec3 n = vec3(plane.x, plane.y, plane.z);
+    Vec3 mid = mul3_f(add3(lo, hi), 0.5f), half = mul3_f(sub3(hi, lo), 0.5f);
+    return !(dot3(n, mid) + plane.w + dot3(abs3(n), half) < 0.0f);
+}
+
+/* for each of n boxes, whether it's at least partly on the inside of every one
+   of the planes (a view frustum, say); out[i] is 1 if so */
+static void aabb_planes_n(Vec4 *planes, uint32_t plane_count, Vec3s lo, Vec3s hi, uint8_t *out, uint32_t n) {
+    uint32_t i = 0;
+#if MATH_SIMD
+    f32xN half_f = f32xN_set(0.5f), zero = f32xN_set(0.0f);
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+        f32xN lx = f32xN_load(lo.x + i), ly = f32xN_load(lo.y + i), lz = f32xN_load(lo.z + i);
+        f32xN hx = f32xN_load(hi.x + i), hy = f32xN_load(hi.y + i), hz = f32xN_load(hi.z + i);
+        f32xN mx = f32xN_mul(f32xN_add(lx, hx), half_f), ex = f32xN_mul(f32xN_sub(hx, lx), half_f);
+        f32xN my = f32xN_mul(f32xN_add(ly, hy), half_f), ey = f32xN_mul(f32xN_sub(hy, ly), half_f);
+        f32xN mz = f32xN_mul(f32xN_add(lz, hz), half_f), ez = f32xN_mul(f32xN_sub(hz, lz), half_f);
+
+        uint32_t outside = 0;
+        for (uint32_t p = 0; p < plane_count; p++) {
+            f32xN nx = f32xN_set(planes[p].x), ny = f32xN_set(planes[p].y), nz = f32xN_set(planes[p].z);
+            f32xN dist = f32xN_add(f32xN_add(f32xN_add(f32xN_mul(nx, mx), f32xN_mul(ny, my)),
+                                             f32xN_mul(nz, mz)), f32xN_set(planes[p].w));
+            f32xN reach = f32xN_add(f32xN_add(f32xN_mul(f32xN_abs(nx), ex), f32xN_mul(f32xN_abs(ny), ey)),
+                                    f32xN_mul(f32xN_abs(nz), ez));
+            outside |= f32xN_lt(f32xN_add(dist, reach), zero);
+        }
+        for (int k = 0; k < SIMD_WIDTH; k++)
+            out[i + k] = !((outside >> k) & 1);
+    }
+#endif
+    for (; i < n; i++) {
+        Vec3 l = vec3s_get(lo, i), h = vec3s_get(hi, i);
+        out[i] = 1;
+        for (uint32_t p = 0; p < plane_count && out[i]; p++)
+            out[i] = (uint8_t) aabb_plane_in(planes[p], l, h);
+    }
+}
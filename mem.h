@@ -1,15 +1,179 @@
+/* The CRT stand-ins. Anything under 16 bytes goes a byte at a time; past
+   that they go 16 at a time with SSE2 (which every x64 has), doing one
+   unaligned block at each end and aligned blocks in between, with the end
+   blocks overlapping the middle rather than trickling out bytes.
+
+   Between MEM_REP_MIN and MEM_STREAM_MIN it's `rep stosb`/`rep movsb`,
+   which anything from the last ten years or so does a cache line at a
+   time in microcode, faster than we can with 16 byte stores. Past
+   MEM_STREAM_MIN, which is about where a buffer stops fitting in cache,
+   stores skip the cache altogether, since nothing's going to read it
+   back before it gets evicted anyway. */
+#define MEM_REP_MIN (1 << 11)
+#define MEM_STREAM_MIN (1 << 22)
+
 void* memset(void* dest, int c, size_t count) {
     char* bytes = (char*)dest;
-    while (count--)
-        *bytes++ = (char)c;
+    if (count < 16) {
+        while (count--)
+            *bytes++ = (char)c;
+        return dest;
+    }
+    if (count >= MEM_REP_MIN && count < MEM_STREAM_MIN) {
+        __stosb((unsigned char*)dest, (unsigned char)c, count);
+        return dest;
+    }
+
+    __m128i v = _mm_set1_epi8((char)c);
+    char* end = bytes + count;
+    _mm_storeu_si128((__m128i*)bytes, v);
+    _mm_storeu_si128((__m128i*)(end - 16), v);
+
+    char* at = (char*)(((uintptr_t)bytes + 16) & ~(uintptr_t)15);
+    if (count >= MEM_STREAM_MIN) {
+        for (; at + 64 <= end; at += 64) {
+            _mm_stream_si128((__m128i*)at + 0, v);
+            _mm_stream_si128((__m128i*)at + 1, v);
+            _mm_stream_si128((__m128i*)at + 2, v);
+            _mm_stream_si128((__m128i*)at + 3, v);
+        }
+        _mm_sfence();
+    }
+    for (; at + 64 <= end; at += 64) {
+        _mm_store_si128((__m128i*)at + 0, v);
+        _mm_store_si128((__m128i*)at + 1, v);
+        _mm_store_si128((__m128i*)at + 2, v);
+        _mm_store_si128((__m128i*)at + 3, v);
+    }
+    for (; at + 16 <= end; at += 16)
+        _mm_store_si128((__m128i*)at, v);
     return dest;
 }
 
 void* memcpy(void* dest, const void* src, size_t count) {
     char* dest8 = (char*)dest;
     const char* src8 = (const char*)src;
-    while (count--)
-        *dest8++ = *src8++;
+    if (count < 16) {
+        while (count--)
+            *dest8++ = *src8++;
+        return dest;
+    }
+    if (count >= MEM_REP_MIN && count < MEM_STREAM_MIN) {
+        __movsb((unsigned char*)dest, (const unsigned char*)src, count);
+        return dest;
+    }
+
+    /* both ends get loaded before anything's stored, so this is
+       also fine for memmove when dest is well clear of src */
+    __m128i head = _mm_loadu_si128((const __m128i*)src8);
+    __m128i tail = _mm_loadu_si128((const __m128i*)(src8 + count - 16));
+
+    /* line up the stores; the loads land wherever they land */
+    size_t at = 16 - ((uintptr_t)dest8 & 15);
+    size_t end = count - 16;
+    if (count >= MEM_STREAM_MIN) {
+        for (; at + 64 <= end; at += 64) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(src8 + at) + 0);
+            __m128i b = _mm_loadu_si128((const __m128i*)(src8 + at) + 1);
+            __m128i c = _mm_loadu_si128((const __m128i*)(src8 + at) + 2);
+            __m128i d = _mm_loadu_si128((const __m128i*)(src8 + at) + 3);
+            _mm_stream_si128((__m128i*)(dest8 + at) + 0, a);
+            _mm_stream_si128((__m128i*)(dest8 + at) + 1, b);
+            _mm_stream_si128((__m128i*)(dest8 + at) + 2, c);
+            _mm_stream_si128((__m128i*)(dest8 + at) + 3, d);
+        }
+        _mm_sfence();
+    }
+    for (; at + 64 <= end; at += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src8 + at) + 0);
+        __m128i b = _mm_loadu_si128((const __m128i*)(src8 + at) + 1);
+        __m128i c = _mm_loadu_si128((const __m128i*)(src8 + at) + 2);
+        __m128i d = _mm_loadu_si128((const __m128i*)(src8 + at) + 3);
+        _mm_store_si128((__m128i*)(dest8 + at) + 0, a);
+        _mm_store_si128((__m128i*)(dest8 + at) + 1, b);
+        _mm_store_si128((__m128i*)(dest8 + at) + 2, c);
+        _mm_store_si128((__m128i*)(dest8 + at) + 3, d);
+    }
+    for (; at < end; at += 16)
+        _mm_store_si128((__m128i*)(dest8 + at), _mm_loadu_si128((const __m128i*)(src8 + at)));
+    _mm_storeu_si128((__m128i*)dest8, head);
+    _mm_storeu_si128((__m128i*)(dest8 + count - 16), tail);
+    return dest;
+}
+
+void* memmove(void* dest, const void* src, size_t count) {
+    char* dest8 = (char*)dest;
+    const char* src8 = (const char*)src;
+    /* memcpy's fine unless a block it loads could already have been written over */
+    size_t gap = dest8 > src8 ? (size_t)(dest8 - src8) : (size_t)(src8 - dest8);
+    if (gap >= count || (gap >= 64 && dest8 < src8))
+        return memcpy(dest, src, count);
+
+    /* otherwise go away from where we're writing, loading each 64 bytes
+       before storing any of it, so nothing gets read after it's been
+       stored over */
+    __m128i a, b, c, d;
+    if (dest8 < src8) {
+        size_t at = 0;
+        for (; at + 64 <= count; at += 64) {
+            a = _mm_loadu_si128((const __m128i*)(src8 + at) + 0);
+            b = _mm_loadu_si128((const __m128i*)(src8 + at) + 1);
+            c = _mm_loadu_si128((const __m128i*)(src8 + at) + 2);
+            d = _mm_loadu_si128((const __m128i*)(src8 + at) + 3);
+            _mm_storeu_si128((__m128i*)(dest8 + at) + 0, a);
+            _mm_storeu_si128((__m128i*)(dest8 + at) + 1, b);
+            _mm_storeu_si128((__m128i*)(dest8 + at) + 2, c);
+            _mm_storeu_si128((__m128i*)(dest8 + at) + 3, d);
+        }
+        for (; at + 16 <= count; at += 16)
+            _mm_storeu_si128((__m128i*)(dest8 + at), _mm_loadu_si128((const __m128i*)(src8 + at)));
+        for (; at < count; at++)
+            dest8[at] = src8[at];
+    } else {
+        size_t at = count;
+        for (; at >= 64; at -= 64) {
+            a = _mm_loadu_si128((const __m128i*)(src8 + at - 64) + 0);
+            b = _mm_loadu_si128((const __m128i*)(src8 + at - 64) + 1);
+            c = _mm_loadu_si128((const __m128i*)(src8 + at - 64) + 2);
+            d = _mm_loadu_si128((const __m128i*)(src8 + at - 64) + 3);
+            _mm_storeu_si128((__m128i*)(dest8 + at - 64) + 0, a);
+            _mm_storeu_si128((__m128i*)(dest8 + at - 64) + 1, b);
+            _mm_storeu_si128((__m128i*)(dest8 + at - 64) + 2, c);
+            _mm_storeu_si128((__m128i*)(dest8 + at - 64) + 3, d);
+        }
+        for (; at >= 16; at -= 16)
+            _mm_storeu_si128((__m128i*)(dest8 + at - 16), _mm_loadu_si128((const __m128i*)(src8 + at - 16)));
+        while (at--)
+            dest8[at] = src8[at];
+    }
     return dest;
 }
 
+int memcmp(const void* a, const void* b, size_t count) {
+    const unsigned char* a8 = (const unsigned char*)a;
+    const unsigned char* b8 = (const unsigned char*)b;
+    size_t at = 0;
+    /* find the first block with a difference in it, then the byte */
+    for (; at + 16 <= count; at += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a8 + at)),
+                                    _mm_loadu_si128((const __m128i*)(b8 + at)));
+        if (_mm_movemask_epi8(eq) != 0xFFFF) break;
+    }
+    for (; at < count; at++)
+        if (a8[at] != b8[at])
+            return a8[at] - b8[at];
+    return 0;
+}
+
+
+/* stands in for qsort; shellsort is small and plenty for debug/bookkeeping sized arrays */
+static void sort_u64(uint64_t *a, uint32_t n) {
+    for (uint32_t gap = n / 2; gap > 0; gap /= 2)
+        for (uint32_t i = gap; i < n; i++) {
+            uint64_t v = a[i];
+            uint32_t j = i;
+            for (; j >= gap && a[j - gap] > v; j -= gap)
+                a[j] = a[j - gap];
+            a[j] = v;
+        }
+}
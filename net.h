@@ -0,0 +1,549 @@
+/* Shared worlds, over UDP.
+
+   With NET_MODE (top of main.c) set to NetMode_Server, the game hosts: it
+   owns the islands like always, and every tick it sends each client what
+   they're missing of the islands within NET_INTEREST_RADIUS of them. With
+   NetMode_Client, it joins a server on NET_HOST instead, and its islands are
+   just a copy of what the server sent.
+
+   Each Island has a version that goes up with every box put in or taken out,
+   and keeps a log of the last BOX_LOG_SIZE of those changes (see box.h).
+   Clients tell the server which version of each island they have, every
+   tick. If the server's log still goes back that far, the client gets sent
+   the changes since then, delta encoded; otherwise it gets the whole island,
+   compressed. Anything that gets lost is simply sent again, since the client
+   goes on saying it has the old version.
+
+   Clients don't edit their copy of the world, they ask the server to, and see
+   the result come back. They do simulate their own player, and tell the
+   server where it is so it knows what they're interested in. */
+
+#define NetMode_Offline 0
+#define NetMode_Server  1
+#define NetMode_Client  2
+
+#if NET_MODE
+
+#include <winsock2.h>
+#pragma comment (lib, "ws2_32.lib")
+
+#define NET_HOST "127.0.0.1"
+#define NET_PORT 27960
+#define NET_MAX_CLIENTS 64
+/* an island's snapshot always has to fit in one */
+#define NET_MAX_PACKET 32768
+#define NET_INTEREST_RADIUS 64.0f
+/* ticks to wait for an ack before sending the same thing again */
+#define NET_RESEND_TICKS 4
+/* ticks without hearing from a client before it's dropped */
+#define NET_TIMEOUT_TICKS 600
+
+typedef enum {
+    /* client -> server: where the player is, what it has, what it wants changed */
+    NetMsg_Client = 1,
+    /* server -> client: every island it should have, and their versions */
+    NetMsg_Manifest,
+    /* server -> client: the whole of one island */
+    NetMsg_Snapshot,
+    /* server -> client: an island's changes between two versions */
+    NetMsg_Delta,
+} NetMsg;
+
+typedef enum { NetEdit_Add = 1, NetEdit_Rem } NetEditOp;
+typedef struct {
+    uint32_t seq;
+    uint8_t op, face, kind;
+    /* NetEdit_Add: the box to build onto. NetEdit_Rem: the box to take out. */
+    BoxPos pos;
+} NetEdit;
+
+/* packets get built up and read back out of one of these. reading past the
+   end sets bad instead of going off into the weeds. */
+typedef struct { uint8_t *buf; uint32_t len, cap; int bad; } NetBuf;
+
+static void net_put_u8(NetBuf *b, uint8_t v) {
+    if (b->len < b->cap) b->buf[b->len++] = v;
+    else b->bad = 1;
+}
+static void net_put_u32(NetBuf *b, uint32_t v) {
+    for (int i = 0; i < 4; i++) net_put_u8(b, (uint8_t) (v >> (i * 8)));
+}
+static void net_put_f32(NetBuf *b, float v) {
+    uint32_t u;
+    memcpy(&u, &v, sizeof(u));
+    net_put_u32(b, u);
+}
+/* 7 bits a byte, small numbers are small */
+static void net_put_var(NetBuf *b, uint32_t v) {
+    for (; v >= 0x80; v >>= 7) net_put_u8(b, (uint8_t) (v | 0x80));
+    net_put_u8(b, (uint8_t) v);
+}
+/* zigzag, so small negative numbers are small too */
+static void net_put_svar(NetBuf *b, int32_t v) {
+    net_put_var(b, ((uint32_t) v << 1) ^ (uint32_t) (v >> 31));
+}
+static void net_put_pos_delta(NetBuf *b, BoxPos p, BoxPos prev) {
+    net_put_svar(b, p.x - prev.x);
+    net_put_svar(b, p.y - prev.y);
+    net_put_svar(b, p.z - prev.z);
+}
+
+static uint8_t net_get_u8(NetBuf *b) {
+    if (b->len < b->cap) return b->buf[b->len++];
+    b->bad = 1;
+    return 0;
+}
+static uint32_t net_get_u32(NetBuf *b) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= (uint32_t) net_get_u8(b) << (i * 8);
+    return v;
+}
+static float net_get_f32(NetBuf *b) {
+    uint32_t u = net_get_u32(b);
+    float v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+static uint32_t net_get_var(NetBuf *b) {
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t byte = net_get_u8(b);
+        v |= (uint32_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return v;
+}
+static int32_t net_get_svar(NetBuf *b) {
+    uint32_t v = net_get_var(b);
+    return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+static BoxPos net_get_pos_delta(NetBuf *b, BoxPos prev) {
+    int16_t dx = (int16_t) net_get_svar(b), dy = (int16_t) net_get_svar(b);
+    int16_t dz = (int16_t) net_get_svar(b);
+    return add_bp(prev, (BoxPos) { dx, dy, dz });
+}
+
+/* An island goes out as its occupancy chunks: each chunk's position, then
+   its 512 bytes of occupancy bits with runs of zeros squashed down, then the
+   kind of every box in it in the order of its bits, run length encoded. */
+static void net_put_island(NetBuf *b, Island *isl) {
+    BoxPos prev = {0};
+    uint32_t chunks = 0;
+    for (uint16_t occ = 1; occ < MAX_BOX_OCCS; occ++) chunks += isl->occs[occ].count > 0;
+    net_put_var(b, chunks);
+
+    for (uint16_t occ = 1; occ < MAX_BOX_OCCS; occ++) if (isl->occs[occ].count) {
+        BoxOcc *chunk = isl->occs + occ;
+        net_put_pos_delta(b, chunk->pos, prev);
+        prev = chunk->pos;
+
+        /* a zero byte is followed by how many more zeros there are */
+        const uint8_t *bytes = (const uint8_t *) chunk->cols;
+        for (uint32_t i = 0; i < sizeof(chunk->cols);) {
+            net_put_u8(b, bytes[i]);
+            if (bytes[i++]) continue;
+            uint32_t run = 0;
+            while (i < sizeof(chunk->cols) && bytes[i] == 0 && run < 255) i++, run++;
+            net_put_u8(b, (uint8_t) run);
+        }
+
+        BoxKind run_kind = BoxKind_Unoccupied;
+        uint32_t run = 0;
+        for (int x = 0; x < BOX_CHUNK_SIZE; x++)
+            for (int w = 0; w < BOX_CHUNK_SIZE / 4; w++)
+                for (uint64_t bits = chunk->cols[x][w]; bits; bits &= bits - 1) {
+                    BoxPos p = box_occ_cell(chunk, x, w, ctz64(bits));
+                    BoxKind kind = isl->boxes[box_index_find(isl, p)].kind;
+                    if (kind != run_kind && run) {
+                        net_put_var(b, run);
+                        net_put_u8(b, (uint8_t) run_kind);
+                        run = 0;
+                    }
+                    run_kind = kind;
+                    run++;
+                }
+        net_put_var(b, run);
+        net_put_u8(b, (uint8_t) run_kind);
+    }
+}
+
+/* fills isl, which should be empty, back in from net_put_island's output */
+static void net_get_island(NetBuf *b, Island *isl) {
+    BoxPos prev = {0};
+    uint32_t chunks = net_get_var(b);
+    for (uint32_t c = 0; c < chunks && !b->bad; c++) {
+        BoxOcc chunk = { .pos = net_get_pos_delta(b, prev) };
+        prev = chunk.pos;
+
+        uint8_t *bytes = (uint8_t *) chunk.cols;
+        for (uint32_t i = 0; i < sizeof(chunk.cols) && !b->bad;) {
+            uint8_t byte = net_get_u8(b);
+            bytes[i++] = byte;
+            if (byte) continue;
+            for (uint8_t run = net_get_u8(b); run && i < sizeof(chunk.cols); run--)
+                bytes[i++] = 0;
+        }
+
+        uint32_t run = 0;
+        BoxKind kind = BoxKind_Unoccupied;
+        for (int x = 0; x < BOX_CHUNK_SIZE; x++)
+            for (int w = 0; w < BOX_CHUNK_SIZE / 4; w++)
+                for (uint64_t bits = chunk.cols[x][w]; bits && !b->bad; bits &= bits - 1) {
+                    if (run == 0) {
+                        run = net_get_var(b);
+                        kind = (BoxKind) net_get_u8(b);
+                    }
+                    run--;
+                    box_insert(isl, box_occ_cell(&chunk, x, w, ctz64(bits)), kind);
+                }
+    }
+}
+
+/* isl's changes from version `from` on, which had better still be in its log */
+static void net_put_changes(NetBuf *b, Island *isl, uint32_t from) {
+    BoxPos prev = {0};
+    net_put_var(b, isl->version - from);
+    for (uint32_t v = from; v != isl->version; v++) {
+        BoxChange c = isl->log[v % BOX_LOG_SIZE];
+        net_put_pos_delta(b, c.pos, prev);
+        net_put_u8(b, (uint8_t) c.kind);
+        prev = c.pos;
+    }
+}
+
+static void net_get_changes(NetBuf *b, Island *isl) {
+    BoxPos prev = {0};
+    uint32_t count = net_get_var(b);
+    for (uint32_t i = 0; i < count && !b->bad; i++) {
+        BoxPos p = net_get_pos_delta(b, prev);
+        BoxKind kind = (BoxKind) net_get_u8(b);
+        prev = p;
+        if (b->bad) break;
+        if (kind == BoxKind_Unoccupied) rem_box(isl, box_index_find(isl, p));
+        else if (box_occupied(isl, p)) box_set_kind(isl, box_index_find(isl, p), kind);
+        else box_insert(isl, p, kind);
+    }
+}
+
+static Island *net_island_by_uid(uint32_t uid) {
+    for (int i = 0; i < MAX_ISLANDS; i++)
+        if (island_used[i] && islands[i].uid == uid)
+            return islands + i;
+    return NULL;
+}
+
+/* what one side thinks the other has of an island */
+typedef struct { uint32_t uid, version, tick; } NetHave;
+
+typedef struct {
+    SOCKADDR_IN addr;
+    int connected;
+    uint32_t last_heard;
+    Vec3 pos;
+    /* the last of this client's edits that's been applied */
+    uint32_t edit_seq;
+    /* what the client says it has, and what was last sent it and when */
+    NetHave acked[MAX_ISLANDS], sent[MAX_ISLANDS];
+} NetClient;
+
+static struct {
+    SOCKET sock;
+    uint32_t tick;
+    uint8_t packet[NET_MAX_PACKET];
+    uint64_t bytes_sent, bytes_received;
+
+    /* NetMode_Server */
+    NetClient clients[NET_MAX_CLIENTS];
+
+    /* NetMode_Client */
+    SOCKADDR_IN server;
+    uint32_t edit_seq, edit_count;
+    NetEdit edits[64];
+} net;
+
+/* binds to NET_PORT if it's hosting, any port if not. returns 0 if that failed. */
+static int net_init(int host) {
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa)) {
+        log_err("WSAStartup failed");
+        return 0;
+    }
+    net.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (net.sock == INVALID_SOCKET) {
+        log_err("Couldn't make a UDP socket");
+        return 0;
+    }
+
+    SOCKADDR_IN addr = { .sin_family = AF_INET, .sin_port = htons(host ? NET_PORT : 0) };
+    addr.sin_addr.s_addr = inet_addr(NET_HOST);
+    if (bind(net.sock, (SOCKADDR *) &addr, sizeof(addr))) {
+        log_err("Couldn't bind UDP socket");
+        return 0;
+    }
+    u_long nonblocking = 1;
+    ioctlsocket(net.sock, FIONBIO, &nonblocking);
+
+    net.server = (SOCKADDR_IN) { .sin_family = AF_INET, .sin_port = htons(NET_PORT) };
+    net.server.sin_addr.s_addr = inet_addr(NET_HOST);
+    return 1;
+}
+
+static void net_send(SOCKADDR_IN *to, NetBuf *b) {
+    if (b->bad) {
+        log_err("Packet too big to send");
+        return;
+    }
+    sendto(net.sock, (const char *) b->buf, b->len, 0, (SOCKADDR *) to, sizeof(*to));
+    net.bytes_sent += b->len;
+}
+
+/* returns 0 once there's nothing left to read */
+static int net_recv(SOCKADDR_IN *from, NetBuf *b) {
+    int from_len = sizeof(*from);
+    int got = recvfrom(net.sock, (char *) net.packet, sizeof(net.packet), 0,
+                       (SOCKADDR *) from, &from_len);
+    if (got <= 0) return 0;
+    net.bytes_received += got;
+    *b = (NetBuf) { net.packet, 0, (uint32_t) got };
+    return 1;
+}
+
+/* how far p, in the world, is from the nearest chunk isl has boxes in */
+static float net_island_dist(Island *isl, Vec3 p) {
+    p = island_to_local(isl, p);
+    float best = INFINITY;
+    for (uint16_t occ = 1; occ < MAX_BOX_OCCS; occ++) if (isl->occs[occ].count) {
+        Vec3 lo = mul3_f(box_pos_to_vec3(isl->occs[occ].pos), BOX_CHUNK_SIZE);
+        Vec3 hi = add3_f(lo, BOX_CHUNK_SIZE);
+        Vec3 d = vec3(m_max(lo.x - p.x, p.x - hi.x), m_max(lo.y - p.y, p.y - hi.y),
+                      m_max(lo.z - p.z, p.z - hi.z));
+        best = m_min(best, mag3(max3_f(d, 0.0f)));
+    }
+    return best;
+}
+
+static NetHave *net_have(NetHave *haves, uint32_t uid) {
+    for (int i = 0; i < MAX_ISLANDS; i++)
+        if (haves[i].uid == uid) return haves + i;
+    return NULL;
+}
+
+static void net_server_read(NetClient *c, NetBuf *b) {
+    c->pos.x = net_get_f32(b);
+    c->pos.y = net_get_f32(b);
+    c->pos.z = net_get_f32(b);
+
+    NetHave acked[MAX_ISLANDS] = {0};
+    uint8_t count = net_get_u8(b);
+    for (uint8_t i = 0; i < count && i < MAX_ISLANDS; i++) {
+        acked[i].uid = net_get_u32(b);
+        acked[i].version = net_get_u32(b);
+    }
+
+    uint8_t edits = net_get_u8(b);
+    NetEdit e[64];
+    for (uint8_t i = 0; i < edits && i < _countof(e); i++) {
+        e[i].seq = net_get_u32(b);
+        e[i].op = net_get_u8(b);
+        e[i].face = net_get_u8(b);
+        e[i].kind = net_get_u8(b);
+        e[i].pos.x = (int16_t) net_get_svar(b);
+        e[i].pos.y = (int16_t) net_get_svar(b);
+        e[i].pos.z = (int16_t) net_get_svar(b);
+    }
+    if (b->bad) return;
+    memcpy(c->acked, acked, sizeof(acked));
+
+    for (uint8_t i = 0; i < edits && i < _countof(e); i++) {
+        if (e[i].seq <= c->edit_seq) continue;
+        c->edit_seq = e[i].seq;
+
+        Island *isl = island_at(e[i].pos);
+        if (isl == NULL || e[i].face >= Face_COUNT) continue;
+        BoxId id = box_index_find(isl, e[i].pos);
+        BoxKind kind = e[i].kind == BoxKind_Lamp || e[i].kind == BoxKind_Water ||
+                       e[i].kind == BoxKind_Sand ? (BoxKind) e[i].kind : BoxKind_Dirt;
+        if (e[i].op == NetEdit_Add) journal_add_box(isl, id, (Face) e[i].face, kind);
+        else journal_rem_box(isl, id);
+    }
+}
+
+/* everything one client's missing, sent to it */
+static void net_server_send(NetClient *c) {
+    NetBuf b = { net.packet, 0, sizeof(net.packet) };
+    net_put_u8(&b, NetMsg_Manifest);
+    net_put_u32(&b, c->edit_seq);
+    uint32_t count_at = b.len;
+    net_put_u8(&b, 0);
+
+    Island *interest[MAX_ISLANDS];
+    uint8_t count = 0;
+    for (int i = 0; i < MAX_ISLANDS; i++)
+        if (island_used[i] && net_island_dist(islands + i, c->pos) < NET_INTEREST_RADIUS) {
+            interest[count++] = islands + i;
+            net_put_u32(&b, islands[i].uid);
+            net_put_u32(&b, islands[i].version);
+        }
+    b.buf[count_at] = count;
+    net_send(&c->addr, &b);
+
+    NetHave sent[MAX_ISLANDS] = {0};
+    for (uint8_t i = 0; i < count; i++) {
+        Island *isl = interest[i];
+        NetHave *acked = net_have(c->acked, isl->uid);
+        NetHave *last = net_have(c->sent, isl->uid);
+        sent[i] = last ? *last : (NetHave) { isl->uid };
+        if (acked && acked->version == isl->version) continue;
+        /* it's on its way, probably */
+        if (last && last->version == isl->version && net.tick - last->tick < NET_RESEND_TICKS)
+            continue;
+
+        b.len = 0;
+        if (acked && box_log_has(isl, acked->version)) {
+            net_put_u8(&b, NetMsg_Delta);
+            net_put_u32(&b, isl->uid);
+            net_put_u32(&b, acked->version);
+            net_put_u32(&b, isl->version);
+            net_put_changes(&b, isl, acked->version);
+        } else {
+            net_put_u8(&b, NetMsg_Snapshot);
+            net_put_u32(&b, isl->uid);
+            net_put_u32(&b, isl->version);
+            net_put_island(&b, isl);
+        }
+        net_send(&c->addr, &b);
+        sent[i] = (NetHave) { isl->uid, isl->version, net.tick };
+    }
+    memcpy(c->sent, sent, sizeof(sent));
+}
+
+static void net_server_tick(void) {
+    net.tick++;
+
+    SOCKADDR_IN from;
+    NetBuf b;
+    while (net_recv(&from, &b)) {
+        if (net_get_u8(&b) != NetMsg_Client) continue;
+
+        NetClient *c = NULL, *free_slot = NULL;
+        for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+            NetClient *it = net.clients + i;
+            if (!it->connected) {
+                if (!free_slot) free_slot = it;
+            } else if (it->addr.sin_port == from.sin_port &&
+                       it->addr.sin_addr.s_addr == from.sin_addr.s_addr) c = it;
+        }
+        if (c == NULL) {
+            if (free_slot == NULL) continue;
+            c = free_slot;
+            *c = (NetClient) { .addr = from, .connected = 1 };
+        }
+        c->last_heard = net.tick;
+        net_server_read(c, &b);
+    }
+
+    for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+        NetClient *c = net.clients + i;
+        if (!c->connected) continue;
+        if (net.tick - c->last_heard > NET_TIMEOUT_TICKS) c->connected = 0;
+        else net_server_send(c);
+    }
+}
+
+/* asks the server to put a box onto the face of the one at onto */
+static void net_request_add(BoxPos onto, Face face, BoxKind kind) {
+    if (net.edit_count == _countof(net.edits)) return;
+    net.edits[net.edit_count++] = (NetEdit) { ++net.edit_seq, NetEdit_Add, (uint8_t) face, (uint8_t) kind, onto };
+}
+
+static void net_request_rem(BoxPos pos) {
+    if (net.edit_count == _countof(net.edits)) return;
+    net.edits[net.edit_count++] = (NetEdit) { ++net.edit_seq, NetEdit_Rem, 0, 0, pos };
+}
+
+static void net_client_read(NetBuf *b) {
+    switch (net_get_u8(b)) {
+    case NetMsg_Manifest: {
+        uint32_t edit_ack = net_get_u32(b);
+        uint8_t count = net_get_u8(b);
+        uint32_t uids[MAX_ISLANDS];
+        for (uint8_t i = 0; i < count && i < MAX_ISLANDS; i++) {
+            uids[i] = net_get_u32(b);
+            net_get_u32(b);
+        }
+        if (b->bad) return;
+
+        /* the server's got these, so quit sending them */
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < net.edit_count; i++)
+            if (net.edits[i].seq > edit_ack) net.edits[kept++] = net.edits[i];
+        net.edit_count = kept;
+
+        /* gone, or too far off to care about */
+        for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+            int listed = 0;
+            for (uint8_t u = 0; u < count && u < MAX_ISLANDS; u++)
+                listed |= uids[u] == islands[i].uid;
+            if (!listed) island_used[i] = 0;
+        }
+    } break;
+
+    case NetMsg_Snapshot: {
+        uint32_t uid = net_get_u32(b), version = net_get_u32(b);
+        Island *isl = net_island_by_uid(uid);
+        if (isl == NULL && (isl = island_alloc()) == NULL) return;
+        island_clear(isl);
+        net_get_island(b, isl);
+        isl->uid = uid;
+        isl->version = isl->log_start = b->bad ? 0 : version;
+    } break;
+
+    case NetMsg_Delta: {
+        uint32_t uid = net_get_u32(b), from = net_get_u32(b), to = net_get_u32(b);
+        Island *isl = net_island_by_uid(uid);
+        if (isl == NULL || isl->version != from) return;
+        net_get_changes(b, isl);
+        isl->version = b->bad ? 0 : to;
+    } break;
+    }
+}
+
+/* takes in whatever the server sent, then tells it where the player is */
+static void net_client_tick(Vec3 player_pos) {
+    net.tick++;
+
+    SOCKADDR_IN from;
+    NetBuf b;
+    while (net_recv(&from, &b))
+        net_client_read(&b);
+
+    b = (NetBuf) { net.packet, 0, sizeof(net.packet) };
+    net_put_u8(&b, NetMsg_Client);
+    net_put_f32(&b, player_pos.x);
+    net_put_f32(&b, player_pos.y);
+    net_put_f32(&b, player_pos.z);
+
+    uint32_t count_at = b.len;
+    uint8_t count = 0;
+    net_put_u8(&b, 0);
+    for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+        net_put_u32(&b, islands[i].uid);
+        net_put_u32(&b, islands[i].version);
+        count++;
+    }
+    b.buf[count_at] = count;
+
+    net_put_u8(&b, (uint8_t) net.edit_count);
+    for (uint32_t i = 0; i < net.edit_count; i++) {
+        net_put_u32(&b, net.edits[i].seq);
+        net_put_u8(&b, net.edits[i].op);
+        net_put_u8(&b, net.edits[i].face);
+        net_put_u8(&b, net.edits[i].kind);
+        net_put_svar(&b, net.edits[i].pos.x);
+        net_put_svar(&b, net.edits[i].pos.y);
+        net_put_svar(&b, net.edits[i].pos.z);
+    }
+    net_send(&net.server, &b);
+}
+
+#endif
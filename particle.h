@@ -0,0 +1,185 @@
+/* Debris: the little cubes a box bursts into when it's knocked out.
+
+   There can be tens of thousands at once after a bulk edit, so they're
+   kept like entities are, one array per field, and a step goes through
+   them in three passes:
+
+     - gravity, drag and velocity get added on MATH_SIMD wide, along with
+       counting down how long each has left
+     - then one scalar pass drops the ones that ran out, sliding the rest
+       down over them so the arrays stay packed, and checks each against
+       the occupancy bits of the island it came off of. one that's ended
+       up inside a box gets put back and bounced, which is nowhere near
+       real collision but for debris nobody can tell.
+     - the renderer gets them as a ParticleInstance each, and draws every
+       one as the same cube with one instanced draw call
+
+   They're only for show: nothing else reads them, they get their own
+   random numbers, and they're not in the replay hash. */
+
+#define MAX_PARTICLES (1 << 17)
+/* per box knocked out by the player, and per box of a bulk edit */
+#define PARTICLE_BURST (27)
+#define PARTICLE_BURST_BULK (4)
+/* in ticks, give or take a third */
+#define PARTICLE_LIFE (90.0f)
+#define PARTICLE_SIZE (0.15f)
+#define PARTICLE_GRAVITY (0.012f)
+#define PARTICLE_DRAG (0.97f)
+
+typedef struct {
+    Vec3 pos;
+    uint8_t r, g, b;
+    /* PARTICLE_SIZE-ish, in 255ths of a box */
+    uint8_t size;
+} ParticleInstance;
+
+static struct {
+    uint32_t count;
+    float pos_x[MAX_PARTICLES], pos_y[MAX_PARTICLES], pos_z[MAX_PARTICLES];
+    float vel_x[MAX_PARTICLES], vel_y[MAX_PARTICLES], vel_z[MAX_PARTICLES];
+    /* ticks left */
+    float life[MAX_PARTICLES];
+    /* which island it came off of, which is the only one it bumps into */
+    uint8_t island[MAX_PARTICLES];
+    uint8_t shade[MAX_PARTICLES];
+    uint8_t kind[MAX_PARTICLES];
+
+    uint32_t rng;
+} particles = { .rng = 0x5EED };
+
+/* count particles flying out of the box at p in isl, which should still
+   be there (or just been taken out) */
+static void particle_burst(Island *isl, BoxPos p, BoxKind kind, uint32_t count) {
+    Vec3 center = island_to_world(isl, add3_f(box_pos_to_vec3(p), 0.5f));
+    IslandXform *xf = island_xform + (isl - islands);
+    uint32_t *rng = &particles.rng;
+
+    for (uint32_t k = 0; k < count && particles.count < MAX_PARTICLES; k++) {
+        uint32_t i = particles.count++;
+        /* spread out through the box, going away from the middle of it */
+        Vec3 off = vec3(rand_f(rng) - 0.5f, rand_f(rng) - 0.5f, rand_f(rng) - 0.5f);
+        Vec3 world_off = mul4x4_dir(xf->to_world, mul3_f(off, 0.8f));
+        Vec3 vel = add3(mul3_f(world_off, 0.15f), vec3(0.0f, 0.06f + rand_f(rng) * 0.06f, 0.0f));
+
+        particles.pos_x[i] = center.x + world_off.x;
+        particles.pos_y[i] = center.y + world_off.y;
+        particles.pos_z[i] = center.z + world_off.z;
+        particles.vel_x[i] = vel.x;
+        particles.vel_y[i] = vel.y;
+        particles.vel_z[i] = vel.z;
+        particles.life[i] = PARTICLE_LIFE * (0.67f + rand_f(rng) * 0.67f);
+        particles.island[i] = (uint8_t) (isl - islands);
+        particles.shade[i] = (uint8_t) (180 + (rand_u32(rng) & 63));
+        particles.kind[i] = (uint8_t) kind;
+    }
+}
+
+/* a few particles out of every box s is about to carve out, on every island */
+static void particle_burst_shape(BoxShape *s) {
+    for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+        Island *isl = islands + i;
+        for (BoxId id = 1; id < MAX_BOXES; id++)
+            if (OCCUPIED(isl->boxes[id]) && box_shape_has(s, isl->boxes[id].pos))
+                particle_burst(isl, isl->boxes[id].pos, isl->boxes[id].kind, PARTICLE_BURST_BULK);
+    }
+}
+
+static void particle_integrate(void) {
+    uint32_t i = 0, n = particles.count;
+#if MATH_SIMD
+    f32xN gravity = f32xN_set(PARTICLE_GRAVITY), drag = f32xN_set(PARTICLE_DRAG), one = f32xN_set(1.0f);
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+        f32xN vx = f32xN_mul(f32xN_load(particles.vel_x + i), drag);
+        f32xN vy = f32xN_mul(f32xN_sub(f32xN_load(particles.vel_y + i), gravity), drag);
+        f32xN vz = f32xN_mul(f32xN_load(particles.vel_z + i), drag);
+        f32xN_store(particles.vel_x + i, vx);
+        f32xN_store(particles.vel_y + i, vy);
+        f32xN_store(particles.vel_z + i, vz);
+        f32xN_store(particles.pos_x + i, f32xN_add(f32xN_load(particles.pos_x + i), vx));
+        f32xN_store(particles.pos_y + i, f32xN_add(f32xN_load(particles.pos_y + i), vy));
+        f32xN_store(particles.pos_z + i, f32xN_add(f32xN_load(particles.pos_z + i), vz));
+        f32xN_store(particles.life + i, f32xN_sub(f32xN_load(particles.life + i), one));
+    }
+#endif
+    for (; i < n; i++) {
+        particles.vel_x[i] = particles.vel_x[i] * PARTICLE_DRAG;
+        particles.vel_y[i] = (particles.vel_y[i] - PARTICLE_GRAVITY) * PARTICLE_DRAG;
+        particles.vel_z[i] = particles.vel_z[i] * PARTICLE_DRAG;
+        particles.pos_x[i] += particles.vel_x[i];
+        particles.pos_y[i] += particles.vel_y[i];
+        particles.pos_z[i] += particles.vel_z[i];
+        particles.life[i] -= 1.0f;
+    }
+}
+
+/* drops the dead ones, and bounces whichever ended up in a box */
+static void particle_collide_compact(void) {
+    /* a burst's particles are next to each other and mostly stay in one
+       chunk, so the chunk lookup from the last one is usually still good */
+    uint8_t last_isl = 0;
+    BoxPos last_chunk = { INT16_MIN };
+    BoxOcc *occ = NULL;
+
+    uint32_t out = 0;
+    for (uint32_t i = 0; i < particles.count; i++) {
+        if (particles.life[i] <= 0.0f) continue;
+
+        Vec3 p = vec3(particles.pos_x[i], particles.pos_y[i], particles.pos_z[i]);
+        Vec3 v = vec3(particles.vel_x[i], particles.vel_y[i], particles.vel_z[i]);
+        uint8_t isl = particles.island[i];
+        if (island_used[isl]) {
+            IslandXform *xf = island_xform + isl;
+            Vec3 local = xf->moves ? mul4x4_pos(xf->to_local, p) : p;
+            BoxPos cell = { (int16_t) floorf(local.x), (int16_t) floorf(local.y), (int16_t) floorf(local.z) };
+            BoxPos chunk = box_chunk_pos(cell);
+            if (isl != last_isl || !eq_bp(chunk, last_chunk)) {
+                uint16_t o = pos_map_get(&islands[isl].occ_map, chunk);
+                occ = o ? islands[isl].occs + o : NULL;
+                last_isl = isl;
+                last_chunk = chunk;
+            }
+            if (occ && (occ->cols[cell.x & 15][(cell.z & 15) >> 2] & box_occ_bit(cell))) {
+                /* back to where it was, and off it goes, mostly sideways */
+                p = sub3(p, v);
+                v = vec3(v.x * 0.5f, v.y * -0.3f, v.z * 0.5f);
+            }
+        }
+
+        particles.pos_x[out] = p.x;
+        particles.pos_y[out] = p.y;
+        particles.pos_z[out] = p.z;
+        particles.vel_x[out] = v.x;
+        particles.vel_y[out] = v.y;
+        particles.vel_z[out] = v.z;
+        particles.life[out] = particles.life[i];
+        particles.island[out] = particles.island[i];
+        particles.shade[out] = particles.shade[i];
+        particles.kind[out] = particles.kind[i];
+        out++;
+    }
+    particles.count = out;
+}
+
+static void particle_step(void) {
+    particle_integrate();
+    particle_collide_compact();
+}
+
+/* one per live particle into out, which has room for MAX_PARTICLES;
+   returns how many. they shrink away over their last 20 ticks. */
+static uint32_t particle_instances(ParticleInstance *out) {
+    for (uint32_t i = 0; i < particles.count; i++) {
+        float fade = min(1.0f, particles.life[i] / 20.0f);
+        uint8_t s = particles.shade[i];
+        int lamp = particles.kind[i] == BoxKind_Lamp;
+        out[i] = (ParticleInstance) {
+            .pos = vec3(particles.pos_x[i], particles.pos_y[i], particles.pos_z[i]),
+            .r = s,
+            .g = lamp ? (uint8_t) (s * 7 / 8) : s,
+            .b = lamp ? (uint8_t) (s / 2) : s,
+            .size = (uint8_t) (PARTICLE_SIZE * fade * 255.0f),
+        };
+    }
+    return particles.count;
+}
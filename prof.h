@@ -0,0 +1,253 @@
+/* Scoped timing zones, for figuring out which part of a frame spiked.
+
+     PROF_ZONE(ProfZone_PlayerPhysics) {
+         player_physics();
+     }
+
+   times the block that follows it. Don't `return` or `break` out of a zone,
+   the end of it would never get recorded.
+
+   Each thread writes into its own ring buffer, so recording a zone is two
+   rdtsc's and a store, no locks. F3 writes everything still in the rings out
+   to "trace.json" (open it in chrome://tracing or ui.perfetto.dev) and logs
+   a p50/p99 per zone.
+
+   None of this is compiled in if USE_PROFILER (top of main.c) is 0. */
+
+typedef enum {
+    ProfZone_Frame,
+    ProfZone_SimTick,
+    ProfZone_PlayerPhysics,
+    ProfZone_Entities,
+    ProfZone_EntityBatch,
+    ProfZone_Particles,
+    ProfZone_Updates,
+    ProfZone_Fluid,
+    ProfZone_RenderFrame,
+    ProfZone_FrameLatencyWait,
+    ProfZone_GenerateGeometry,
+    ProfZone_ParticleInstances,
+    ProfZone_MapBuffers,
+    ProfZone_BakeAO,
+    ProfZone_Light,
+    ProfZone_RenderPresent,
+    ProfZone_COUNT
+} ProfZone;
+const char *prof_zone_names[ProfZone_COUNT] = {
+    "frame",
+    "sim_tick",
+    "player_physics",
+    "entities",
+    "entity_batch",
+    "particles",
+    "updates",
+    "fluid",
+    "render_frame",
+    "frame_latency_wait",
+    "generate_geometry",
+    "particle_instances",
+    "map_buffers",
+    "bake_ao",
+    "light",
+    "render_present",
+};
+
+#if USE_PROFILER
+
+typedef struct {
+    uint64_t start, end;
+    ProfZone zone;
+} ProfEvent;
+
+/* must be a power of two */
+#define PROF_RING_SIZE (1 << 14)
+#define PROF_MAX_THREADS 16
+typedef struct {
+    /* only ever written by the thread that owns this ring, after the event
+       it counts is in place. volatile gets us release/acquire on MSVC x64. */
+    volatile uint64_t head;
+    DWORD thread_id;
+    ProfEvent events[PROF_RING_SIZE];
+} ProfRing;
+
+static struct {
+    DWORD tls;
+    volatile LONG ring_count;
+    ProfRing rings[PROF_MAX_THREADS];
+
+    /* pairs of readings used to turn rdtsc ticks into microseconds */
+    uint64_t tsc_start;
+    int64_t qpc_start, qpc_freq;
+} prof;
+
+static void prof_init(void) {
+    LARGE_INTEGER qpc, freq;
+    QueryPerformanceCounter(&qpc);
+    QueryPerformanceFrequency(&freq);
+    prof.qpc_start = qpc.QuadPart;
+    prof.qpc_freq = freq.QuadPart;
+    prof.tsc_start = __rdtsc();
+    prof.tls = TlsAlloc();
+}
+
+static ProfRing *prof_ring(void) {
+    ProfRing *ring = TlsGetValue(prof.tls);
+    if (ring) return ring;
+
+    LONG i = InterlockedIncrement(&prof.ring_count) - 1;
+    if (i >= PROF_MAX_THREADS) {
+        log_err("Out of profiler rings, bump PROF_MAX_THREADS");
+        InterlockedDecrement(&prof.ring_count);
+        return NULL;
+    }
+    ring = prof.rings + i;
+    ring->thread_id = GetCurrentThreadId();
+    TlsSetValue(prof.tls, ring);
+    return ring;
+}
+
+static uint64_t prof_begin(void) {
+    return __rdtsc();
+}
+
+static void prof_end(ProfZone zone, uint64_t start) {
+    uint64_t end = __rdtsc();
+    ProfRing *ring = prof_ring();
+    if (ring == NULL) return;
+
+    uint64_t head = ring->head;
+    ring->events[head & (PROF_RING_SIZE - 1)] = (ProfEvent) { start, end, zone };
+    ring->head = head + 1;
+}
+
+#define PROF_ZONE(zone)                                    \
+    for (uint64_t _prof_start = prof_begin(), _prof_on = 1; \
+         _prof_on;                                         \
+         prof_end((zone), _prof_start), _prof_on = 0)
+
+/* copies out whatever the ring's writer can't have been overwriting while
+   we read it. returns how many events made it into out. */
+static uint32_t prof_ring_read(ProfRing *ring, ProfEvent *out) {
+    uint64_t head = ring->head;
+    uint64_t tail = head > PROF_RING_SIZE ? head - PROF_RING_SIZE : 0;
+    for (uint64_t i = tail; i < head; i++)
+        out[i - tail] = ring->events[i & (PROF_RING_SIZE - 1)];
+
+    /* anything the writer lapped during the copy may be torn, skip it, and
+       so is the slot it's writing now, which is the oldest one left */
+    uint64_t head_after = ring->head;
+    uint64_t safe_tail = head_after >= PROF_RING_SIZE ? head_after - PROF_RING_SIZE + 1 : 0;
+    uint32_t skip = (uint32_t) (max(safe_tail, tail) - tail);
+    uint32_t count = (uint32_t) (head - tail);
+    if (skip >= count) return 0;
+    for (uint32_t i = skip; i < count; i++)
+        out[i - skip] = out[i];
+    return count - skip;
+}
+
+/* doubles because an hour of rdtsc ticks doesn't fit in a float's mantissa */
+static double prof_tsc_per_us(void) {
+    LARGE_INTEGER qpc;
+    QueryPerformanceCounter(&qpc);
+    uint64_t tsc = __rdtsc();
+    double us = (double) (qpc.QuadPart - prof.qpc_start) * 1e6 / (double) prof.qpc_freq;
+    return (double) (int64_t) (tsc - prof.tsc_start) / max(us, 1.0);
+}
+
+static void prof_fmt_us(Fmt *f, uint64_t ticks, double tsc_per_us) {
+    int64_t ns = (int64_t) ((double) (int64_t) ticks * 1000.0 / tsc_per_us);
+    fmt_u64(f, (uint64_t) (ns / 1000));
+    fmt_str(f, ".");
+    fmt_u64(f, (uint64_t) (ns / 100 % 10));
+    fmt_u64(f, (uint64_t) (ns / 10 % 10));
+    fmt_u64(f, (uint64_t) (ns % 10));
+}
+
+static ProfEvent prof_scratch_events[PROF_RING_SIZE];
+static uint64_t prof_scratch_durs[PROF_RING_SIZE * PROF_MAX_THREADS];
+
+/* logs p50/p99 for every zone over the events still in the rings,
+   which is the last PROF_RING_SIZE zones each thread recorded */
+static void prof_log_summary(void) {
+    char buf[256];
+    Fmt f = { buf, 0, sizeof(buf) };
+    double tsc_per_us = prof_tsc_per_us();
+
+    for (ProfZone z = 0; z < ProfZone_COUNT; z++) {
+        uint32_t n = 0;
+        for (LONG r = 0; r < prof.ring_count; r++) {
+            uint32_t count = prof_ring_read(prof.rings + r, prof_scratch_events);
+            for (uint32_t i = 0; i < count; i++)
+                if (prof_scratch_events[i].zone == z)
+                    prof_scratch_durs[n++] = prof_scratch_events[i].end
+                                           - prof_scratch_events[i].start;
+        }
+        if (n == 0) continue;
+        sort_u64(prof_scratch_durs, n);
+
+        fmt_str(&f, prof_zone_names[z]);
+        fmt_str(&f, ": p50 ");
+        prof_fmt_us(&f, prof_scratch_durs[n / 2], tsc_per_us);
+        fmt_str(&f, "us p99 ");
+        prof_fmt_us(&f, prof_scratch_durs[n * 99 / 100], tsc_per_us);
+        fmt_str(&f, "us (");
+        fmt_u64(&f, n);
+        fmt_str(&f, " samples)");
+        log_fmt(&f);
+    }
+}
+
+/* writes out the rings as Chrome's trace event JSON format */
+static void prof_dump_trace(const char *path) {
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        log_win32_last_err("Couldn't open profiler trace file");
+        return;
+    }
+
+    static char buf[1 << 16];
+    Fmt f = { buf, 0, sizeof(buf) };
+    double tsc_per_us = prof_tsc_per_us();
+    DWORD written;
+
+    fmt_str(&f, "{\"traceEvents\":[\n");
+    int first = 1;
+    for (LONG r = 0; r < prof.ring_count; r++) {
+        ProfRing *ring = prof.rings + r;
+        uint32_t count = prof_ring_read(ring, prof_scratch_events);
+        for (uint32_t i = 0; i < count; i++) {
+            ProfEvent *e = prof_scratch_events + i;
+            if (!first) fmt_str(&f, ",\n");
+            first = 0;
+
+            fmt_str(&f, "{\"name\":\"");
+            fmt_str(&f, prof_zone_names[e->zone]);
+            fmt_str(&f, "\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+            fmt_u64(&f, ring->thread_id);
+            fmt_str(&f, ",\"ts\":");
+            prof_fmt_us(&f, e->start - prof.tsc_start, tsc_per_us);
+            fmt_str(&f, ",\"dur\":");
+            prof_fmt_us(&f, e->end - e->start, tsc_per_us);
+            fmt_str(&f, "}");
+
+            /* flush well before the buffer could fill up mid-event */
+            if (f.cap - f.len < 256) {
+                WriteFile(file, f.buf, f.len, &written, NULL);
+                f.len = 0;
+            }
+        }
+    }
+    fmt_str(&f, "\n]}\n");
+    WriteFile(file, f.buf, f.len, &written, NULL);
+    CloseHandle(file);
+}
+
+#else
+
+#define prof_init()
+#define prof_log_summary()
+#define prof_dump_trace(path)
+#define PROF_ZONE(zone)
+
+#endif
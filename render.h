@@ -25,7 +25,7 @@
 typedef struct {
     Vec3 pos;
     Vec3 norm;
-    // uint8_t r, g, b, a;
+    uint8_t r, g, b, a;
 } Vertex;
 
 static Vertex cube_vertices[] = {
@@ -67,8 +67,11 @@ static Vertex cube_vertices[] = {
     {{1.0f, 0.0f, 1.0f}, 0.0f,-1.0f, 0.0f},
 };
 
-#define VERT_BUF_SIZE  ((2 << 10) * sizeof(cube_vertices))
-#define INDEX_BUF_SIZE ((2 << 10) * _countof(cube_vertices) * sizeof(uint32_t))
+/* enough for one island's worth of boxes with every face showing; all the
+   islands share it, so island_geometry stops writing faces once it's full */
+#define MAX_VERTS      ((2 << 10) * _countof(cube_vertices))
+#define VERT_BUF_SIZE  (MAX_VERTS * sizeof(Vertex))
+#define INDEX_BUF_SIZE (MAX_VERTS * sizeof(uint32_t))
 
 typedef struct {
     Mat4 view_proj;
@@ -76,6 +79,7 @@ typedef struct {
 
 #include "./build/d3d11_vshader.h"
 #include "./build/d3d11_pshader.h"
+#include "./build/d3d11_particle_vshader.h"
 
 static struct {
     /* is window visible?
@@ -100,6 +104,17 @@ static struct {
     ID3D11Buffer *vertex_buffer;
     ID3D11Buffer *index_buffer;
     ID3D11Buffer *uniform_buffer;
+
+    /* debris: cube_vertices once, and a ParticleInstance per particle */
+    ID3D11VertexShader *particle_shader;
+    ID3D11InputLayout *particle_layout;
+    ID3D11Buffer *particle_cube;
+    ID3D11Buffer *particle_buffer;
+
+    /* which FrameSnap's mesh and particles are in the buffers, so a frame
+       that comes around before the next snap doesn't upload them again */
+    uint64_t mesh_version, snap_tick;
+    uint32_t index_count, particle_count;
 } rcx;
 
 // called when device & all d3d resources needs to be released
@@ -109,6 +124,10 @@ static void render_destroy() {
         ID3D11DeviceContext_ClearState(rcx.context);
     }
 
+    SAFE_RELEASE(ID3D11Buffer, rcx.particle_buffer);
+    SAFE_RELEASE(ID3D11Buffer, rcx.particle_cube);
+    SAFE_RELEASE(ID3D11InputLayout, rcx.particle_layout);
+    SAFE_RELEASE(ID3D11VertexShader, rcx.particle_shader);
     SAFE_RELEASE(ID3D11Buffer, rcx.uniform_buffer);
     SAFE_RELEASE(ID3D11Buffer, rcx.index_buffer);
     SAFE_RELEASE(ID3D11Buffer, rcx.vertex_buffer);
@@ -129,6 +148,8 @@ static void render_destroy() {
 
     rcx.context1 = NULL;
     rcx.frame_latency_wait = NULL;
+    /* whatever comes next has to be uploaded into the new buffers */
+    rcx.mesh_version = rcx.snap_tick = 0;
 }
 
 // called any time device needs to be created
@@ -137,6 +158,13 @@ static HRESULT render_create(HWND wnd) {
     HRESULT hr;
     D3D_FEATURE_LEVEL level;
 
+    // AO and lighting caches, about 20MB between them. these are the sim
+    // thread's (see frame_build), so they outlive a device being recreated
+    if (!island_ao) island_ao = arena_push_zero(&arena_world, MAX_ISLANDS * sizeof(BoxAO));
+    if (!island_light) island_light = arena_push_zero(&arena_world, MAX_ISLANDS * sizeof(BoxLight));
+    if (!island_ao || !island_light)
+        return E_OUTOFMEMORY;
+
     // device, context
     {
         UINT flags = D3D11_CREATE_DEVICE_SINGLETHREADED;
@@ -351,6 +379,15 @@ static HRESULT render_create(HWND wnd) {
                 D3D11_INPUT_PER_VERTEX_DATA,
                 0
             },
+            {
+                "COLOR",
+                0,
+                DXGI_FORMAT_R8G8B8A8_UNORM,
+                0,
+                offsetof(Vertex, r),
+                D3D11_INPUT_PER_VERTEX_DATA,
+                0
+            },
         };
 
         ID3DBlob *code = NULL;
@@ -453,6 +490,61 @@ static HRESULT render_create(HWND wnd) {
         LOG_AND_RETURN_ERROR(hr, "ID3D11Device::CreateBuffer failed (vertex)");
     }
 
+    // particle shader & input layout: the cube from slot 0, the instances from slot 1
+    {
+        D3D11_INPUT_ELEMENT_DESC layout[] = {
+            { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex, pos.x),
+              D3D11_INPUT_PER_VERTEX_DATA, 0 },
+            { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex, norm.x),
+              D3D11_INPUT_PER_VERTEX_DATA, 0 },
+            { "INSTANCE_POS", 0, DXGI_FORMAT_R32G32B32_FLOAT, 1, offsetof(ParticleInstance, pos.x),
+              D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+            { "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 1, offsetof(ParticleInstance, r),
+              D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        };
+
+        hr = ID3D11Device_CreateVertexShader(
+            rcx.device,
+            d3d11_particle_vshader,
+            sizeof(d3d11_particle_vshader),
+            NULL,
+            &rcx.particle_shader
+        );
+        LOG_AND_RETURN_ERROR(hr, "ID3D11Device::CreateVertexShader failed (particle)");
+
+        hr = ID3D11Device_CreateInputLayout(
+            rcx.device,
+            layout,
+            _countof(layout),
+            d3d11_particle_vshader,
+            sizeof(d3d11_particle_vshader),
+            &rcx.particle_layout
+        );
+        LOG_AND_RETURN_ERROR(hr, "ID3D11Device::CreateInputLayout failed (particle)");
+    }
+
+    // particle buffers
+    {
+        D3D11_BUFFER_DESC desc = {
+            .ByteWidth = sizeof(cube_vertices),
+            .Usage = D3D11_USAGE_IMMUTABLE,
+            .BindFlags = D3D11_BIND_VERTEX_BUFFER,
+        };
+        D3D11_SUBRESOURCE_DATA data = { .pSysMem = cube_vertices };
+
+        hr = ID3D11Device_CreateBuffer(rcx.device, &desc, &data, &rcx.particle_cube);
+        LOG_AND_RETURN_ERROR(hr, "ID3D11Device::CreateBuffer failed (particle cube)");
+
+        desc = (D3D11_BUFFER_DESC) {
+            .ByteWidth = MAX_PARTICLES * sizeof(ParticleInstance),
+            .Usage = D3D11_USAGE_DYNAMIC,
+            .BindFlags = D3D11_BIND_VERTEX_BUFFER,
+            .CPUAccessFlags = D3D11_CPU_ACCESS_WRITE,
+        };
+        hr = ID3D11Device_CreateBuffer(rcx.device, &desc, NULL, &rcx.particle_buffer);
+        LOG_AND_RETURN_ERROR(hr, "ID3D11Device::CreateBuffer failed (particles)");
+    }
+
     return S_OK;
 }
 
@@ -628,38 +720,405 @@ static D3D11_MAPPED_SUBRESOURCE map_buffer(ID3D11Buffer *buf) {
     return mapped_sub_res;
 }
 
-/* returns the number of indices to render */
-static uint32_t generate_geometry(void) {
-    D3D11_MAPPED_SUBRESOURCE verts_mapped = map_buffer(rcx.vertex_buffer);
-    D3D11_MAPPED_SUBRESOURCE indxs_mapped = map_buffer(rcx.index_buffer);
-
-    int vi = 0, ii = 0;
-    for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(boxes[id])) {
-        Vec3 pos = box_pos_to_vec3(boxes[id].pos);
-
-        for (int local_i = 0; local_i < _countof(cube_vertices); local_i++)
-            ((uint32_t*)indxs_mapped.pData)[ii++] = vi + local_i;
-
-        for (int start_i = vi; (vi - start_i) < _countof(cube_vertices); vi++) {
-            #define BASE_VERT (cube_vertices[vi - start_i])
-            Vertex *vertex = (Vertex*)verts_mapped.pData + vi;
-            *vertex = (Vertex) {
-                .pos = add3(BASE_VERT.pos, pos),
-                .norm = BASE_VERT.norm,
-            };
+/* where in cube_vertices each Face's six vertices start */
+static const int face_cube_verts[Face_COUNT] = {
+     6, 18,
+    24, 30,
+    12,  0,
+};
+
+/* how bright each ambient occlusion level (see ao.h) leaves a corner */
+static const uint8_t ao_shade[4] = { 115, 165, 210, 255 };
+
+/* Each face's six cube_vertices are two triangles, ABC and CBD (the fourth
+   and fifth repeat C and B). When A and D are brighter than B and C, the
+   quad gets split between those instead, so the shading doesn't streak
+   along the diagonal. Which vertices go out in what order, and how bright,
+   only depends on the face and its BoxAOFace, so it's all worked out
+   ahead of time. */
+typedef struct { uint8_t local[6], shade[6]; } FaceAOVerts;
+static FaceAOVerts face_ao_verts[Face_COUNT][256];
+
+static void face_ao_verts_init(void) {
+    static const uint8_t order[2][6] = {
+        { 0, 1, 2, 3, 4, 5 },
+        { 0, 1, 5, 0, 5, 2 },
+    };
+    for (Face f = 0; f < Face_COUNT; f++)
+        for (int corners = 0; corners < 256; corners++) {
+            int level[6];
+            for (int local_i = 0; local_i < 6; local_i++) {
+                int k = ao_corner(f, cube_vertices[face_cube_verts[f] + local_i].pos);
+                level[local_i] = (corners >> (k * 2)) & 3;
+            }
+            int flip = level[0] + level[5] > level[1] + level[2];
+            for (int i = 0; i < 6; i++) {
+                face_ao_verts[f][corners].local[i] = order[flip][i];
+                face_ao_verts[f][corners].shade[i] = ao_shade[level[order[flip][i]]];
+            }
+        }
+}
+
+/* what color each light level (see light.h) gives, sky << 4 | block.
+   each level is 80% as bright as the one above it, and lamps are warmer. */
+static uint8_t light_color[256][3];
+
+static void light_color_init(void) {
+    float bright[LIGHT_MAX + 1];
+    bright[LIGHT_MAX] = 1.0f;
+    for (int level = LIGHT_MAX; level > 0; level--) bright[level - 1] = bright[level] * 0.8f;
+
+    static const float lamp[3] = { 1.0f, 0.8f, 0.55f };
+    for (int sky = 0; sky <= LIGHT_MAX; sky++)
+        for (int block = 0; block <= LIGHT_MAX; block++)
+            for (int i = 0; i < 3; i++) {
+                float c = m_max(m_max(bright[sky], bright[block] * lamp[i]), 0.06f);
+                light_color[sky << 4 | block][i] = (uint8_t) (c * 255.0f);
+            }
+}
+
+/* how each kind of box tints the light falling on it */
+static const uint8_t box_kind_tint[BoxKind_COUNT][3] = {
+    [BoxKind_Unoccupied] = { 255, 255, 255 },
+    [BoxKind_Dirt]       = { 255, 255, 255 },
+    [BoxKind_Lamp]       = { 255, 255, 255 },
+    [BoxKind_Grass]      = { 125, 215,  95 },
+    [BoxKind_Water]      = {  70, 125, 235 },
+    [BoxKind_Sand]       = { 235, 205, 140 },
+};
+
+static int box_kind_tinted(BoxKind kind) {
+    return (box_kind_tint[kind][0] & box_kind_tint[kind][1] & box_kind_tint[kind][2]) != 255;
+}
+
+/* where island_geometry's meshing has tinted boxes, by BoxOcc and cell, so
+   it never has to find a box through the backend. only chunks with one in
+   get cleared and filled in, and everything else in them is left 0. */
+static uint8_t geometry_kinds[MAX_BOX_OCCS][BOX_CHUNK_SIZE * BOX_CHUNK_SIZE * BOX_CHUNK_SIZE];
+
+/* Face buckets.
+
+   Every face in a bucket points the same way, so if the camera's behind
+   the plane the nearest of them sits on, the whole lot is facing away and
+   there's no point sending it to the GPU just for D3D11_CULL_BACK to throw
+   it out. island_geometry writes an island's faces out a Face at a time,
+   and each Face a chunk at a time; a chunk's faces of f can't be any
+   nearer the camera, along f's normal, than its reach. The chunks are put
+   in order of reach, so the ones that could be facing the camera are
+   always the first few, and a bucket only ever needs one draw. */
+typedef struct {
+    /* where each Face's bucket starts in the index buffer */
+    uint32_t first[Face_COUNT];
+    /* for the nth chunk in each bucket, its reach and where its faces end */
+    float reach[Face_COUNT][MAX_BOX_OCCS];
+    uint32_t end[Face_COUNT][MAX_BOX_OCCS];
+    uint16_t chunks;
+} FaceBuckets;
+
+/* how far p is along f's normal */
+static float face_along(Face f, Vec3 p) {
+    BoxPos n = face_offset[f];
+    return n.x * p.x + n.y * p.y + n.z * p.z;
+}
+
+/* the least face_along any face f of a box in chunk can have. a box's face
+   sits on its far side when the normal points up an axis, and on its own
+   side when it points down one (see cube_vertices). */
+static float face_reach(Face f, BoxPos chunk) {
+    BoxPos n = face_offset[f];
+    int along = n.x * chunk.x + n.y * chunk.y + n.z * chunk.z;
+    int up = n.x + n.y + n.z > 0;
+    return (float) (along * BOX_CHUNK_SIZE + (up ? 1 : 1 - BOX_CHUNK_SIZE));
+}
+
+/* how many of the indices at the start of f's bucket could be facing eye,
+   which has to be in the island's own grid */
+static uint32_t face_bucket_visible(FaceBuckets *b, Face f, Vec3 eye) {
+    float along = face_along(f, eye);
+    int n = 0;
+    while (n < b->chunks && b->reach[f][n] < along) n++;
+    return n ? b->end[f][n - 1] - b->first[f] : 0;
+}
+
+/* writes out the exposed faces of every box in isl, a column at a time,
+   into buckets (see above); only faces that aren't up against another box
+   are worth drawing. ao and light have to have been caught up with isl.
+   each face is lit by the empty cell in front of it, and tinted by its
+   box's kind. verts and indxs have room for MAX_VERTS; returns 0 if that
+   wasn't enough and some faces got left out. */
+static int island_geometry(Island *isl, BoxAO *ao, BoxLight *light, Vertex *verts, uint32_t *indxs, int *vi, int *ii, FaceBuckets *buckets) {
+    if (face_ao_verts[0][0].shade[0] == 0) face_ao_verts_init();
+    if (light_color[0][0] == 0) light_color_init();
+
+    uint16_t occs[MAX_BOX_OCCS], chunks = 0;
+    for (uint16_t occ = 1; occ < MAX_BOX_OCCS; occ++)
+        if (isl->occs[occ].count) occs[chunks++] = occ;
+    buckets->chunks = chunks;
+
+    int fit = 1;
+    uint64_t tinted = 0;
+    for (BoxId id = 1; id < MAX_BOXES; id++) if (box_kind_tinted(isl->boxes[id].kind)) {
+        BoxPos p = isl->boxes[id].pos;
+        uint16_t occ = pos_map_get(&isl->occ_map, box_chunk_pos(p));
+        if (!(tinted >> occ & 1)) memset(geometry_kinds[occ], 0, sizeof(geometry_kinds[occ]));
+        tinted |= (uint64_t) 1 << occ;
+        geometry_kinds[occ][box_chunk_index(p)] = (uint8_t) isl->boxes[id].kind;
+    }
+
+    for (Face f = 0; f < Face_COUNT; f++) {
+        buckets->first[f] = *ii;
+
+        /* nearest first; there's only ever a few dozen */
+        float *reach = buckets->reach[f];
+        for (int c = 0; c < chunks; c++) {
+            uint16_t occ = occs[c];
+            float r = face_reach(f, isl->occs[occ].pos);
+            int at = c;
+            for (; at > 0 && reach[at - 1] > r; at--) {
+                reach[at] = reach[at - 1];
+                occs[at] = occs[at - 1];
+            }
+            reach[at] = r;
+            occs[at] = occ;
+        }
+
+        Vertex *base = cube_vertices + face_cube_verts[f];
+        for (int c = 0; c < chunks; c++) {
+            uint16_t occ = occs[c];
+            BoxOcc *chunk = isl->occs + occ;
+            uint16_t lit_chunk = light->overflow ? 0 : pos_map_get(&light->chunk_map, chunk->pos);
+
+            uint64_t exposed[BOX_CHUNK_SIZE][BOX_CHUNK_SIZE / 4];
+            box_occ_faces(isl, chunk, f, exposed);
+
+            for (int x = 0; x < BOX_CHUNK_SIZE; x++)
+                for (int w = 0; w < BOX_CHUNK_SIZE / 4; w++)
+                    for (uint64_t bits = exposed[x][w]; bits; bits &= bits - 1) {
+                        if ((size_t) *vi + 6 > MAX_VERTS) {
+                            fit = 0;
+                            continue;
+                        }
+                        BoxPos p = box_occ_cell(chunk, x, w, ctz64(bits));
+                        Vec3 pos = box_pos_to_vec3(p);
+                        FaceAOVerts *fv = &face_ao_verts[f][ao->faces[occ][box_chunk_index(p)][f]];
+
+                        uint32_t front;
+                        uint16_t front_chunk = lit_chunk
+                            ? light_step(light, lit_chunk, box_chunk_index(p), f, &front) : 0;
+                        uint8_t *color = light_color[front_chunk
+                            ? light->chunks[front_chunk].cells[front] : LIGHT_MAX << 4];
+                        const uint8_t *tint = box_kind_tint[tinted >> occ & 1
+                            ? geometry_kinds[occ][box_chunk_index(p)] : BoxKind_Unoccupied];
+
+                        for (int i = 0; i < 6; i++) {
+                            Vertex *v = base + fv->local[i];
+                            uint32_t shade = fv->shade[i];
+                            indxs[(*ii)++] = *vi;
+                            verts[(*vi)++] = (Vertex) {
+                                .pos = add3(v->pos, pos),
+                                .norm = v->norm,
+                                .r = (uint8_t) (shade * color[0] * tint[0] / (255 * 255)),
+                                .g = (uint8_t) (shade * color[1] * tint[1] / (255 * 255)),
+                                .b = (uint8_t) (shade * color[2] * tint[2] / (255 * 255)),
+                                .a = 255,
+                            };
+                        }
+                    }
+            buckets->end[f][c] = *ii;
         }
     }
+    return fit;
+}
+
+/* Frame snapshots.
+
+   The simulation and rendering are on threads of their own (see main.c),
+   so the renderer can't look at the islands, the player or anything else
+   the sim thread might be halfway through changing. Instead, after every
+   tick the sim thread puts everything render_frame needs into a FrameSnap:
+   where the camera is, the islands' geometry and the particles.
+
+   There are three, passed around lock-free: one the sim thread's filling
+   in (back), one the render thread's drawing from (front), and the newest
+   finished one in between (middle). Publishing swaps back for middle,
+   and if there's been a publish since the render thread last looked, it
+   swaps front for middle, so each side only ever waits on itself. Snaps
+   the render thread doesn't get to in time are just skipped over.
+
+   The geometry is only built again when an island's changed; otherwise
+   the last snap's gets copied over, or kept if the snap already has it.
+   mesh_version tells the render thread whether it's already uploaded it.
+   Each island's faces are in buckets (see FaceBuckets) the render thread
+   picks through with the camera brought into the island's own grid, so
+   to_local is kept as it was when the geometry was built. */
+
+typedef struct {
+    uint64_t tick;
+    Vec3 eye, facing;
 
-    ID3D11DeviceContext_Unmap(rcx.context, (ID3D11Resource*)rcx.vertex_buffer, 0);
-    ID3D11DeviceContext_Unmap(rcx.context, (ID3D11Resource*)rcx.index_buffer, 0);
-    return ii;
+    uint64_t mesh_version;
+    uint32_t vert_count, index_count;
+    Vertex *verts;
+    uint32_t *indxs;
+    /* chunks is 0 for islands that aren't there */
+    FaceBuckets buckets[MAX_ISLANDS];
+    Mat4 to_local[MAX_ISLANDS];
+
+    uint32_t particle_count;
+    ParticleInstance *particles;
+} FrameSnap;
+
+/* set on middle when it's been published and not picked up yet */
+#define FRAME_FRESH (4)
+
+static struct {
+    FrameSnap snaps[3];
+    /* each only touched by its own thread */
+    uint32_t back, front;
+    volatile LONG middle;
+
+    /* the sim thread's own: the last one published, and what the islands
+       were like when the mesh was last built */
+    uint32_t last;
+    uint64_t tick, mesh_version;
+    uint8_t used[MAX_ISLANDS];
+    uint32_t uid[MAX_ISLANDS], version[MAX_ISLANDS], moves[MAX_ISLANDS];
+    /* how many vertices each island came to last time */
+    uint32_t island_verts[MAX_ISLANDS];
+} frames = { .front = 0, .middle = 1, .back = 2 };
+
+static int frame_init(void) {
+    for (int i = 0; i < 3; i++) {
+        FrameSnap *f = frames.snaps + i;
+        f->verts = arena_push(&arena_world, VERT_BUF_SIZE);
+        f->indxs = arena_push(&arena_world, INDEX_BUF_SIZE);
+        f->particles = arena_push(&arena_world, MAX_PARTICLES * sizeof(ParticleInstance));
+        if (!f->verts || !f->indxs || !f->particles) return 0;
+    }
+    return 1;
 }
 
-static void render_frame() {
+/* whether any island's been edited, moved, made or freed since last time */
+static int frame_mesh_changed(void) {
+    int changed = 0;
+    for (int i = 0; i < MAX_ISLANDS; i++) {
+        Island *isl = islands + i;
+        if (frames.used[i] != island_used[i] || (island_used[i] &&
+            (frames.uid[i] != isl->uid || frames.version[i] != isl->version ||
+             frames.moves[i] != island_xform[i].moves))) changed = 1;
+        frames.used[i] = island_used[i];
+        frames.uid[i] = isl->uid;
+        frames.version[i] = isl->version;
+        frames.moves[i] = island_xform[i].moves;
+    }
+    return changed;
+}
+
+static void frame_geometry(FrameSnap *f) {
+    int vi = 0, ii = 0, fit = 1;
+    for (int i = 0; i < MAX_ISLANDS; i++) {
+        int start = vi;
+        f->buckets[i].chunks = 0;
+        if (island_used[i]) {
+            PROF_ZONE(ProfZone_BakeAO)
+                ao_update(island_ao + i, islands + i);
+            PROF_ZONE(ProfZone_Light)
+                light_update(island_light + i, islands + i);
+            fit &= island_geometry(islands + i, island_ao + i, island_light + i,
+                                   f->verts, f->indxs, &vi, &ii, f->buckets + i);
+
+            /* islands that have been moved get put where they are now */
+            IslandXform *xf = island_xform + i;
+            f->to_local[i] = xf->to_local;
+            if (xf->moves)
+                for (Vertex *v = f->verts + start; v < f->verts + vi; v++) {
+                    v->pos = mul4x4_pos(xf->to_world, v->pos);
+                    v->norm = mul4x4_dir(xf->to_world, v->norm);
+                }
+        }
+        frames.island_verts[i] = vi - start;
+    }
+    if (!fit) log_err("Out of room for island geometry");
+    f->vert_count = vi;
+    f->index_count = ii;
+}
+
+/* sim thread: fills in back from where everything is now, and publishes it */
+static void frame_build(void) {
+    if (frames.snaps[0].verts == NULL && !frame_init()) return;
+    FrameSnap *f = frames.snaps + frames.back;
+    f->tick = ++frames.tick;
+    f->eye = player_eye();
+    f->facing = cam_facing();
+
+    PROF_ZONE(ProfZone_GenerateGeometry) {
+        if (frame_mesh_changed()) {
+            frames.mesh_version++;
+            frame_geometry(f);
+        } else if (f->mesh_version != frames.mesh_version) {
+            FrameSnap *last = frames.snaps + frames.last;
+            memcpy(f->verts, last->verts, last->vert_count * sizeof(Vertex));
+            memcpy(f->indxs, last->indxs, last->index_count * sizeof(uint32_t));
+            memcpy(f->buckets, last->buckets, sizeof(f->buckets));
+            memcpy(f->to_local, last->to_local, sizeof(f->to_local));
+            f->vert_count = last->vert_count;
+            f->index_count = last->index_count;
+        }
+        f->mesh_version = frames.mesh_version;
+    }
+    f->particle_count = particle_instances(f->particles);
+
+    frames.last = frames.back;
+    frames.back = InterlockedExchange(&frames.middle, frames.back | FRAME_FRESH) & 3;
+}
+
+/* render thread: the newest snap there is. it's the render thread's until
+   the next frame_acquire. */
+static FrameSnap *frame_acquire(void) {
+    if (frames.middle & FRAME_FRESH)
+        frames.front = InterlockedExchange(&frames.middle, frames.front) & 3;
+    return frames.snaps + frames.front;
+}
+
+/* how much of the vertex and index buffers an island's geometry is using;
+   every vertex gets an index of its own */
+static uint64_t render_mesh_bytes(int island) {
+    return frames.island_verts[island] * (sizeof(Vertex) + sizeof(uint32_t));
+}
+
+/* copies whatever f has that the buffers don't */
+static void render_upload(FrameSnap *f) {
+    if (f->tick == rcx.snap_tick) return;
+    rcx.snap_tick = f->tick;
+
+    if (f->mesh_version != rcx.mesh_version) {
+        PROF_ZONE(ProfZone_MapBuffers) {
+            D3D11_MAPPED_SUBRESOURCE verts_mapped = map_buffer(rcx.vertex_buffer);
+            D3D11_MAPPED_SUBRESOURCE indxs_mapped = map_buffer(rcx.index_buffer);
+            memcpy(verts_mapped.pData, f->verts, f->vert_count * sizeof(Vertex));
+            memcpy(indxs_mapped.pData, f->indxs, f->index_count * sizeof(uint32_t));
+            ID3D11DeviceContext_Unmap(rcx.context, (ID3D11Resource*)rcx.vertex_buffer, 0);
+            ID3D11DeviceContext_Unmap(rcx.context, (ID3D11Resource*)rcx.index_buffer, 0);
+        }
+        rcx.mesh_version = f->mesh_version;
+        rcx.index_count = f->index_count;
+    }
+
+    rcx.particle_count = f->particle_count;
+    if (f->particle_count)
+        PROF_ZONE(ProfZone_ParticleInstances) {
+            D3D11_MAPPED_SUBRESOURCE mapped = map_buffer(rcx.particle_buffer);
+            memcpy(mapped.pData, f->particles, f->particle_count * sizeof(ParticleInstance));
+            ID3D11DeviceContext_Unmap(rcx.context, (ID3D11Resource*)rcx.particle_buffer, 0);
+        }
+}
+
+static void render_frame(FrameSnap *f) {
     if (rcx.occluded) return;
 
     if (rcx.frame_latency_wait)
-        WaitForSingleObjectEx(rcx.frame_latency_wait, INFINITE, TRUE);
+        PROF_ZONE(ProfZone_FrameLatencyWait)
+            WaitForSingleObjectEx(rcx.frame_latency_wait, INFINITE, TRUE);
 
 #if WINDOW_DEPTH || WINDOW_STENCIL
     ID3D11DeviceContext_OMSetRenderTargets(
@@ -703,8 +1162,7 @@ static void render_frame() {
     /* Copy the data into the constant buffer. */
     Vec2 ss = state.screen_size;
     Mat4 proj = perspective4x4(PI_f * 0.25f, ss.x/ss.y, 0.01f, 100.0f);
-    Vec3 eye = player_eye();
-    Mat4 view = look_at4x4(eye, add3(eye, cam_facing()), vec3_y);
+    Mat4 view = look_at4x4(f->eye, add3(f->eye, f->facing), vec3_y);
     Mat4 m = mul4x4(proj, view);
     // m = mul4x4(m, translate4x4((Vec3) { 0.0f, -1.0f, 0.0f }));
     // m = mul4x4(m, rotate4x4(vec3_x, state.rot));
@@ -715,7 +1173,7 @@ static void render_frame() {
     ID3D11DeviceContext_Unmap(rcx.context, (ID3D11Resource*)rcx.uniform_buffer, 0);
     ID3D11DeviceContext_VSSetConstantBuffers(rcx.context, 0, 1, &rcx.uniform_buffer);
 
-    uint32_t index_count = generate_geometry();
+    render_upload(f);
 
     // draw a triangle
     const UINT stride = sizeof(Vertex);
@@ -747,5 +1205,24 @@ static void render_frame() {
         NULL,
         ~0U
     );
-    ID3D11DeviceContext_DrawIndexed(rcx.context, index_count, 0, 0);
+    /* only the buckets that could have a face turned towards the camera */
+    if (rcx.index_count)
+        for (int i = 0; i < MAX_ISLANDS; i++) if (f->buckets[i].chunks) {
+            Vec3 eye = mul4x4_pos(f->to_local[i], f->eye);
+            for (Face face = 0; face < Face_COUNT; face++) {
+                uint32_t count = face_bucket_visible(f->buckets + i, face, eye);
+                if (count)
+                    ID3D11DeviceContext_DrawIndexed(rcx.context, count, f->buckets[i].first[face], 0);
+            }
+        }
+
+    if (rcx.particle_count) {
+        ID3D11Buffer *buffers[2] = { rcx.particle_cube, rcx.particle_buffer };
+        const UINT strides[2] = { sizeof(Vertex), sizeof(ParticleInstance) };
+        const UINT offsets[2] = { 0, 0 };
+        ID3D11DeviceContext_IASetInputLayout(rcx.context, rcx.particle_layout);
+        ID3D11DeviceContext_IASetVertexBuffers(rcx.context, 0, 2, buffers, strides, offsets);
+        ID3D11DeviceContext_VSSetShader(rcx.context, rcx.particle_shader, NULL, 0);
+        ID3D11DeviceContext_DrawInstanced(rcx.context, _countof(cube_vertices), rcx.particle_count, 0, 0);
+    }
 }
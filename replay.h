@@ -0,0 +1,274 @@
+/* Recording everything the player does, a tick at a time, so a session can
+   be run again exactly: headless, as fast as it'll go, under a profiler.
+
+   The simulation only ever sees input through a TickInput. Whatever comes
+   in between ticks (keys, mouse motion, clicks, controller sticks) gets
+   piled up in one, and the tick hands it over all at once, so applying a
+   recorded one gets exactly the same result as the live one did.
+
+   A recording starts with a snapshot of the world (see journal.h), where
+   each island has been moved to, and whatever else main.c needs to pick up
+   where it left off. Then every tick gets a flags byte saying which of its
+   parts changed, followed by just those, so an idle tick costs a byte. At
+   the end there's a hash of where it all ended up, which a replay checks
+   itself against.
+
+   This only works offline: a server's or client's world also changes
+   with whatever comes over the network. */
+
+typedef enum {
+    TickEvent_Interact,
+    TickEvent_Hit,
+    TickEvent_Jump,
+    /* F5, the debug island turn */
+    TickEvent_TurnIsland,
+    TickEvent_COUNT,
+} TickEvent;
+
+#define TICK_MAX_EVENTS (16)
+typedef struct {
+    uint64_t down_keys[512 / 64];
+    /* cam_turn and player_move input, summed up over the tick */
+    Vec2 turn, move;
+    /* in the order they happened */
+    uint8_t event_count;
+    uint8_t events[TICK_MAX_EVENTS];
+} TickInput;
+
+static void tick_event(TickInput *in, TickEvent e) {
+    if (in->event_count < TICK_MAX_EVENTS)
+        in->events[in->event_count++] = (uint8_t) e;
+}
+
+#define REPLAY_MAGIC 0x594C5052
+typedef enum {
+    ReplayTick_Keys   = 1 << 0,
+    ReplayTick_Turn   = 1 << 1,
+    ReplayTick_Move   = 1 << 2,
+    ReplayTick_Events = 1 << 3,
+    /* not a tick; the hash follows */
+    ReplayTick_End    = 1 << 7,
+} ReplayTick;
+
+static struct {
+    HANDLE file;
+    int recording;
+    /* what down_keys were last tick, since only changes are written */
+    uint64_t keys[512 / 64];
+    uint32_t ticks;
+
+    uint32_t len, at;
+    uint8_t buf[1 << 16];
+} replay;
+
+static void replay_flush(void) {
+    DWORD written;
+    if (replay.len && !WriteFile(replay.file, replay.buf, replay.len, &written, NULL))
+        log_win32_last_err("Couldn't write replay");
+    replay.len = 0;
+}
+
+static void replay_put(const void *data, uint32_t len) {
+    const uint8_t *bytes = data;
+    while (len) {
+        if (replay.len == sizeof(replay.buf)) replay_flush();
+        uint32_t n = min(len, (uint32_t) sizeof(replay.buf) - replay.len);
+        memcpy(replay.buf + replay.len, bytes, n);
+        replay.len += n;
+        bytes += n;
+        len -= n;
+    }
+}
+
+/* returns 0 if the file ran out first */
+static int replay_get(void *data, uint32_t len) {
+    uint8_t *bytes = data;
+    while (len) {
+        if (replay.at == replay.len) {
+            DWORD got = 0;
+            ReadFile(replay.file, replay.buf, sizeof(replay.buf), &got, NULL);
+            replay.at = 0;
+            replay.len = got;
+            if (got == 0) return 0;
+        }
+        uint32_t n = min(len, replay.len - replay.at);
+        memcpy(bytes, replay.buf + replay.at, n);
+        replay.at += n;
+        bytes += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static uint64_t replay_mix(uint64_t h) {
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+static uint64_t replay_hash_bytes(uint64_t h, const void *data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++)
+        h = (h ^ ((const uint8_t *) data)[i]) * 0x100000001B3ull;
+    return h;
+}
+
+/* doesn't care what order islands are in or which ids their boxes have,
+   since a replay loads them from a snapshot with everything packed in
+   from the start */
+static uint64_t replay_world_hash(void) {
+    uint64_t world = 0;
+    for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+        Island *isl = islands + i;
+        uint64_t boxes = 0;
+        for (BoxId id = 1; id < MAX_BOXES; id++) if (OCCUPIED(isl->boxes[id])) {
+            BoxPos p = isl->boxes[id].pos;
+            boxes += replay_mix(((uint64_t) (uint16_t) p.x << 48) | ((uint64_t) (uint16_t) p.y << 32)
+                              | ((uint64_t) (uint16_t) p.z << 16) | isl->boxes[id].kind);
+        }
+        uint64_t h = replay_hash_bytes(boxes, &island_xform[i].to_world, sizeof(Mat4));
+        world += replay_mix(h + isl->box_count);
+    }
+    return world;
+}
+
+/* starts writing path; the caller puts whatever else it needs to restore
+   right after, with replay_put, before the first replay_tick */
+static int replay_record(const char *path) {
+    replay.file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (replay.file == INVALID_HANDLE_VALUE) {
+        log_win32_last_err("Couldn't open replay to record");
+        replay.file = NULL;
+        return 0;
+    }
+    replay.recording = 1;
+    replay.len = replay.ticks = 0;
+    memset(replay.keys, 0, sizeof(replay.keys));
+
+    uint32_t snap_len = journal_snap_build(0);
+    uint32_t header[2] = { REPLAY_MAGIC, snap_len };
+    replay_put(header, sizeof(header));
+    replay_put(journal_snap, snap_len);
+    for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i])
+        replay_put(&island_xform[i].to_world, sizeof(Mat4));
+    return 1;
+}
+
+static void replay_tick(TickInput *in) {
+    if (!replay.recording) return;
+
+    uint8_t changed_keys = 0, flags = 0;
+    for (int i = 0; i < 512 / 64; i++)
+        changed_keys += in->down_keys[i] != replay.keys[i];
+    if (changed_keys) flags |= ReplayTick_Keys;
+    if (in->turn.x != 0.0f || in->turn.y != 0.0f) flags |= ReplayTick_Turn;
+    if (in->move.x != 0.0f || in->move.y != 0.0f) flags |= ReplayTick_Move;
+    if (in->event_count) flags |= ReplayTick_Events;
+
+    replay_put(&flags, 1);
+    if (changed_keys) {
+        replay_put(&changed_keys, 1);
+        for (uint8_t i = 0; i < 512 / 64; i++) if (in->down_keys[i] != replay.keys[i]) {
+            replay_put(&i, 1);
+            replay_put(in->down_keys + i, sizeof(uint64_t));
+            replay.keys[i] = in->down_keys[i];
+        }
+    }
+    if (flags & ReplayTick_Turn) replay_put(&in->turn, sizeof(Vec2));
+    if (flags & ReplayTick_Move) replay_put(&in->move, sizeof(Vec2));
+    if (flags & ReplayTick_Events) {
+        replay_put(&in->event_count, 1);
+        replay_put(in->events, in->event_count);
+    }
+    replay.ticks++;
+
+    /* not every tick; a crash just loses the end of the recording */
+    if (replay.len > sizeof(replay.buf) / 2) replay_flush();
+}
+
+/* signs off a recording with the hash of where everything ended up */
+static void replay_stop(uint64_t hash) {
+    if (!replay.recording) return;
+    uint8_t end = ReplayTick_End;
+    replay_put(&end, 1);
+    replay_put(&hash, sizeof(hash));
+    replay_flush();
+    CloseHandle(replay.file);
+    replay.file = NULL;
+    replay.recording = 0;
+}
+
+/* loads the world a recording starts with; the caller then gets back
+   whatever it put after replay_record, and runs replay_next until it's 0 */
+static int replay_play(const char *path) {
+    replay.file = CreateFileA(path, GENERIC_READ, 0, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (replay.file == INVALID_HANDLE_VALUE) {
+        log_win32_last_err("Couldn't open replay");
+        replay.file = NULL;
+        return 0;
+    }
+    replay.recording = 0;
+    replay.len = replay.at = replay.ticks = 0;
+    memset(replay.keys, 0, sizeof(replay.keys));
+
+    uint32_t header[2];
+    if (!replay_get(header, sizeof(header)) || header[0] != REPLAY_MAGIC ||
+        header[1] > sizeof(journal_snap) || !replay_get(journal_snap, header[1]) ||
+        !journal_snap_load(header[1])) {
+        log_err("Replay is garbled");
+        CloseHandle(replay.file);
+        replay.file = NULL;
+        return 0;
+    }
+    for (int i = 0; i < MAX_ISLANDS; i++) if (island_used[i]) {
+        Mat4 to_world, ident = ident4x4();
+        replay_get(&to_world, sizeof(Mat4));
+        /* ones that never moved are left exactly as island_alloc made them */
+        if (memcmp(&to_world, &ident, sizeof(Mat4)))
+            island_move(islands + i, to_world);
+    }
+    return 1;
+}
+
+static void replay_close(void) {
+    if (replay.file) CloseHandle(replay.file);
+    replay.file = NULL;
+}
+
+/* fills in the next tick; 0 once there are no more, at which point
+   end_hash is what the recording says the hash should come out to, if
+   has_end says it got that far */
+static int replay_next(TickInput *in, uint64_t *end_hash, int *has_end) {
+    uint8_t flags;
+    *has_end = 0;
+    if (!replay_get(&flags, 1)) return 0;
+    if (flags & ReplayTick_End) {
+        *has_end = replay_get(end_hash, sizeof(*end_hash));
+        return 0;
+    }
+
+    *in = (TickInput) {0};
+    int ok = 1;
+    if (flags & ReplayTick_Keys) {
+        uint8_t count = 0;
+        ok &= replay_get(&count, 1);
+        for (uint8_t c = 0; c < count && ok; c++) {
+            uint8_t i = 0;
+            ok &= replay_get(&i, 1);
+            if (i < 512 / 64) ok &= replay_get(replay.keys + i, sizeof(uint64_t));
+            else ok = 0;
+        }
+    }
+    memcpy(in->down_keys, replay.keys, sizeof(replay.keys));
+    if (flags & ReplayTick_Turn) ok &= replay_get(&in->turn, sizeof(Vec2));
+    if (flags & ReplayTick_Move) ok &= replay_get(&in->move, sizeof(Vec2));
+    if (flags & ReplayTick_Events) {
+        ok &= replay_get(&in->event_count, 1);
+        in->event_count = min(in->event_count, TICK_MAX_EVENTS);
+        ok &= replay_get(in->events, in->event_count);
+    }
+    if (!ok) return 0;
+    replay.ticks++;
+    return 1;
+}
@@ -2,19 +2,40 @@ cbuffer UniformBuffer {
     matrix view_proj;
 };
 struct VS_INPUT {
-    float3 pos  : POSITION;
-    float3 norm : NORMAL;
+    float3 pos   : POSITION;
+    float3 norm  : NORMAL;
+    float4 color : COLOR;
 };
 
 struct PS_INPUT {
-    float4 pos  : SV_Position;
-    float3 norm : NORMAL;
+    float4 pos   : SV_Position;
+    float3 norm  : NORMAL;
+    float4 color : COLOR;
 };
 
 PS_INPUT vs(VS_INPUT input) {
     PS_INPUT output;
     output.pos = mul(float4(input.pos, 1.0f), view_proj);
     output.norm = input.norm;
+    output.color = input.color;
+    return output;
+}
+
+/* debris, see particle.h: the same cube over and over, one per instance,
+   with the instance's size in its color's alpha */
+struct PARTICLE_INPUT {
+    float3 pos   : POSITION;
+    float3 norm  : NORMAL;
+    float3 at    : INSTANCE_POS;
+    float4 color : COLOR;
+};
+
+PS_INPUT vs_particle(PARTICLE_INPUT input) {
+    PS_INPUT output;
+    float3 pos = input.at + (input.pos - 0.5f) * input.color.a;
+    output.pos = mul(float4(pos, 1.0f), view_proj);
+    output.norm = input.norm;
+    output.color = float4(input.color.rgb, 1.0f);
     return output;
 }
 
@@ -25,5 +46,6 @@ float4 ps(PS_INPUT input) : SV_Target {
 
     float3 diffuse = max(dot(input.norm, light_dir), 0.0f) * light_color;
     float3 ambient = light_color * 0.3f;
-    return float4((ambient + diffuse) * light_strength, 1.0f);
+    /* baked ambient occlusion and flood filled light, see ao.h and light.h */
+    return float4((ambient + diffuse) * light_strength * input.color.rgb, 1.0f);
 }
@@ -0,0 +1,295 @@
+/* Boxes that change on their own, like grass creeping over dirt.
+
+   Every tick, each chunk of every island gets UPDATE_RANDOM_TICKS of its
+   cells picked at random, and whatever box is in one gets its kind's
+   random tick. Nothing has to keep track of which boxes have something
+   slow to do; they just get around to it sooner or later.
+
+   Anything that should happen a set number of ticks from now goes through
+   update_schedule, onto a timer wheel: UPDATE_WHEEL_SLOTS lists, one per
+   tick, gone round and round. Updates further off than a lap just sit out
+   the laps until they're due. When a slot comes up, what's due in it gets
+   sorted by island and then Morton order, so updates in the same chunk run
+   one after the other, and each runs its kind's scheduled update.
+
+   A scheduled update remembers its box's BoxId, since that's quick to
+   check, and its position, since ids get shuffled (island_compact_step)
+   and boxes go off to other islands (island_split_step). If there's some
+   other kind of box there by the time it's due, or none, it's dropped.
+
+   No more than UPDATE_BUDGET updates run a tick. Scheduled ones go first,
+   and whatever doesn't fit waits for the next tick; random ticks just stop
+   early, which only slows them down.
+
+   It all goes off of updates.rng, so replays keep that and whatever's
+   scheduled (update_record). The journal doesn't, though: after a restart,
+   random ticks end up doing whatever was scheduled, just later. Clients
+   leave all of this to the server, and get its edits over the network. */
+
+#define UPDATE_RANDOM_TICKS 3
+/* has to be a power of two */
+#define UPDATE_WHEEL_SLOTS 256
+/* no more than 4096; update_run_scheduled sorts them by 12 bits of index */
+#define UPDATE_MAX_SCHEDULED 4096
+#define UPDATE_BUDGET 1024
+
+typedef void UpdateFn(Island *isl, BoxId id);
+
+typedef struct {
+    uint64_t due;
+    uint32_t island_uid;
+    BoxPos pos;
+    BoxId id;
+    uint8_t kind;
+    /* the next one in the same slot; 0 ends it, so pool[0] is never used */
+    uint16_t next;
+} UpdateScheduled;
+
+static struct {
+    uint32_t rng;
+    uint64_t tick;
+
+    UpdateScheduled pool[UPDATE_MAX_SCHEDULED];
+    uint16_t free[UPDATE_MAX_SCHEDULED];
+    uint16_t free_count, next;
+    uint16_t wheel[UPDATE_WHEEL_SLOTS];
+    uint32_t scheduled;
+
+    /* running totals, for bench.h */
+    uint64_t ran_random, ran_scheduled, dropped;
+} updates = { .rng = 0x5EED, .next = 1 };
+
+static void update_push(UpdateScheduled u) {
+    uint16_t i = updates.free_count ? updates.free[--updates.free_count]
+               : updates.next < UPDATE_MAX_SCHEDULED ? updates.next++ : 0;
+    if (i == 0) {
+        log_err("Out of scheduled updates");
+        return;
+    }
+    uint16_t *slot = updates.wheel + (u.due & (UPDATE_WHEEL_SLOTS - 1));
+    u.next = *slot;
+    updates.pool[i] = u;
+    *slot = i;
+    updates.scheduled++;
+}
+
+/* runs id's kind's scheduled update on it delay ticks from now, or next
+   tick for 0 */
+static void update_schedule(Island *isl, BoxId id, uint32_t delay) {
+    update_push((UpdateScheduled) {
+        .due = updates.tick + m_max(delay, 1),
+        .island_uid = isl->uid,
+        .pos = isl->boxes[id].pos,
+        .id = id,
+        .kind = (uint8_t) isl->boxes[id].kind,
+    });
+}
+
+static void update_free(uint16_t i) {
+    updates.free[updates.free_count++] = i;
+    updates.scheduled--;
+}
+
+/* Grass.
+
+   Spreads onto dirt next to it with nothing on top, a step up or down at
+   most, and turns back into dirt a little while after something's put on
+   top of it. */
+#define GRASS_SMOTHER_TICKS 120
+
+static int grass_covered(Island *isl, BoxId id) {
+    return box_neighbor(isl, id, Face_Above) != BoxId_NULL;
+}
+
+static void grass_random_tick(Island *isl, BoxId id) {
+    if (grass_covered(isl, id)) {
+        update_schedule(isl, id, GRASS_SMOTHER_TICKS);
+        return;
+    }
+
+    static const Face sides[4] = { Face_Left, Face_Right, Face_Front, Face_Back };
+    Face f = sides[rand_u32(&updates.rng) & 3];
+    BoxId to = box_neighbor(isl, id, f);
+    if (to && grass_covered(isl, to)) to = box_neighbor(isl, to, Face_Above);
+    else if (to == BoxId_NULL) {
+        BoxId below = box_neighbor(isl, id, Face_Below);
+        to = below ? box_neighbor(isl, below, f) : BoxId_NULL;
+    }
+    if (to && isl->boxes[to].kind == BoxKind_Dirt && !grass_covered(isl, to))
+        journal_set_kind(isl, to, BoxKind_Grass);
+}
+
+static void grass_smother(Island *isl, BoxId id) {
+    if (grass_covered(isl, id)) journal_set_kind(isl, id, BoxKind_Dirt);
+}
+
+static UpdateFn *update_random[BoxKind_COUNT] = {
+    [BoxKind_Grass] = grass_random_tick,
+};
+static UpdateFn *update_scheduled[BoxKind_COUNT] = {
+    [BoxKind_Grass] = grass_smother,
+};
+
+/* where a scheduled update's box has got to, if it's still the same kind */
+static Island *update_find(UpdateScheduled *u, BoxId *id) {
+    for (int i = 0; i < MAX_ISLANDS; i++) {
+        Island *isl = islands + i;
+        if (!island_used[i] || isl->uid != u->island_uid) continue;
+        *id = eq_bp(isl->boxes[u->id].pos, u->pos) && OCCUPIED(isl->boxes[u->id])
+            ? u->id : box_occupied(isl, u->pos) ? box_index_find(isl, u->pos) : BoxId_NULL;
+        if (*id) return isl->boxes[*id].kind == u->kind ? isl : NULL;
+    }
+    Island *isl = island_at(u->pos);
+    if (isl == NULL) return NULL;
+    *id = box_index_find(isl, u->pos);
+    return isl->boxes[*id].kind == u->kind ? isl : NULL;
+}
+
+/* runs what's due this tick, a chunk at a time; returns how many ran */
+static uint32_t update_run_scheduled(uint32_t budget) {
+    uint16_t *slot = updates.wheel + (updates.tick & (UPDATE_WHEEL_SLOTS - 1));
+    uint16_t *next_slot = updates.wheel + ((updates.tick + 1) & (UPDATE_WHEEL_SLOTS - 1));
+    if (*slot == 0) return 0;
+
+    /* island index, then Morton order, then where it is in the pool */
+    uint64_t mark = arena_mark(&arena_frame);
+    uint64_t *keys = arena_push(&arena_frame, updates.scheduled * sizeof(uint64_t));
+    if (keys == NULL) return 0;
+    uint32_t n = 0;
+    for (uint16_t *at = slot; *at;) {
+        UpdateScheduled *u = updates.pool + *at;
+        if (u->due > updates.tick) {
+            at = &u->next;
+            continue;
+        }
+        int isl_i = 0;
+        while (isl_i < MAX_ISLANDS - 1 && !(island_used[isl_i] && islands[isl_i].uid == u->island_uid))
+            isl_i++;
+        keys[n++] = (uint64_t) isl_i << 60 | box_morton(u->pos) << 12 | *at;
+        *at = u->next;
+    }
+    sort_u64(keys, n);
+
+    uint32_t ran = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        uint16_t i = (uint16_t) (keys[k] & 0xFFF);
+        UpdateScheduled *u = updates.pool + i;
+        if (ran == budget) {
+            /* next tick's, then */
+            u->due = updates.tick + 1;
+            u->next = *next_slot;
+            *next_slot = i;
+            continue;
+        }
+        BoxId id;
+        Island *isl = update_find(u, &id);
+        if (isl && update_scheduled[u->kind]) {
+            update_scheduled[u->kind](isl, id);
+            ran++;
+        } else updates.dropped++;
+        update_free(i);
+    }
+    updates.ran_scheduled += ran;
+    arena_pop(&arena_frame, mark);
+    return ran;
+}
+
+/* UPDATE_RANDOM_TICKS cells of every chunk, in Morton order, so where
+   they land doesn't depend on how the islands got their chunks. the cells
+   with boxes in them are all picked first and looked up together, since
+   box_index_find can cost a pass over the arena each. */
+static uint32_t update_run_random(uint32_t budget) {
+    uint32_t ran = 0;
+    for (int i = 0; i < MAX_ISLANDS && ran < budget; i++) if (island_used[i]) {
+        Island *isl = islands + i;
+        uint64_t keys[MAX_BOX_OCCS];
+        uint32_t n = 0;
+        for (uint16_t occ = 1; occ < MAX_BOX_OCCS; occ++) if (isl->occs[occ].count)
+            keys[n++] = box_morton(isl->occs[occ].pos) << 6 | occ;
+        sort_u64(keys, n);
+
+        BoxPos hit[MAX_BOX_OCCS * UPDATE_RANDOM_TICKS];
+        BoxId hit_ids[MAX_BOX_OCCS * UPDATE_RANDOM_TICKS];
+        uint32_t hits = 0;
+        for (uint32_t k = 0; k < n && hits < budget - ran; k++) {
+            BoxOcc *chunk = isl->occs + (keys[k] & 63);
+            for (int r = 0; r < UPDATE_RANDOM_TICKS && hits < budget - ran; r++) {
+                uint32_t cell = rand_u32(&updates.rng) & (BOX_CHUNK_SIZE * BOX_CHUNK_SIZE * BOX_CHUNK_SIZE - 1);
+                int x = cell & 15, y = (cell >> 4) & 15, z = cell >> 8;
+                if (chunk->cols[x][z >> 2] & ((uint64_t) 1 << ((z & 3) << 4 | y)))
+                    hit[hits++] = box_occ_cell(chunk, x, z >> 2, (z & 3) << 4 | y);
+            }
+        }
+        box_index_find_batch(isl, hit, hit_ids, hits);
+
+        for (uint32_t h = 0; h < hits && ran < budget; h++) {
+            /* random ticks only change kinds, but in case one ever moves a box */
+            BoxId id = hit_ids[h];
+            if (!OCCUPIED(isl->boxes[id]) || !eq_bp(isl->boxes[id].pos, hit[h])) continue;
+            UpdateFn *fn = update_random[isl->boxes[id].kind];
+            if (fn == NULL) continue;
+            fn(isl, id);
+            ran++;
+        }
+    }
+    updates.ran_random += ran;
+    return ran;
+}
+
+static void update_tick(void) {
+    uint32_t ran = update_run_scheduled(UPDATE_BUDGET);
+    update_run_random(UPDATE_BUDGET - ran);
+    updates.tick++;
+}
+
+/* whatever a replay needs to go on the same way: the rng, and every
+   scheduled update, by how far off it is and which island it's on,
+   counting only used ones, the same as journal_snap_build does. ids
+   don't survive a snapshot, so they're looked up again. */
+typedef struct { uint32_t delay; uint8_t island, kind; BoxPos pos; } UpdateSaved;
+
+static void update_record(void) {
+    replay_put(&updates.rng, sizeof(updates.rng));
+    replay_put(&updates.scheduled, sizeof(updates.scheduled));
+    for (int s = 0; s < UPDATE_WHEEL_SLOTS; s++)
+        for (uint16_t i = updates.wheel[s]; i; i = updates.pool[i].next) {
+            UpdateScheduled *u = updates.pool + i;
+            UpdateSaved saved = { (uint32_t) (u->due - updates.tick), 0, u->kind, u->pos };
+            for (int isl_i = 0; isl_i < MAX_ISLANDS; isl_i++) if (island_used[isl_i]) {
+                if (islands[isl_i].uid == u->island_uid) break;
+                saved.island++;
+            }
+            replay_put(&saved, sizeof(saved));
+        }
+}
+
+static int update_replay(void) {
+    memset(updates.wheel, 0, sizeof(updates.wheel));
+    updates.free_count = updates.scheduled = 0;
+    updates.next = 1;
+
+    uint32_t count = 0;
+    if (!replay_get(&updates.rng, sizeof(updates.rng)) || !replay_get(&count, sizeof(count)))
+        return 0;
+    for (uint32_t c = 0; c < count; c++) {
+        UpdateSaved saved;
+        if (!replay_get(&saved, sizeof(saved))) return 0;
+        Island *isl = NULL;
+        for (int i = 0, seen = 0; i < MAX_ISLANDS && isl == NULL; i++)
+            if (island_used[i] && seen++ == saved.island) isl = islands + i;
+        /* even ones that'll be dropped, so there's as many as there were */
+        update_push((UpdateScheduled) {
+            .due = updates.tick + saved.delay,
+            .island_uid = isl ? isl->uid : 0,
+            .pos = saved.pos,
+            .id = isl && box_occupied(isl, saved.pos) ? box_index_find(isl, saved.pos) : BoxId_NULL,
+            .kind = saved.kind,
+        });
+    }
+    return 1;
+}
+
+static uint64_t update_hash(uint64_t h) {
+    h = replay_hash_bytes(h, &updates.rng, sizeof(updates.rng));
+    return replay_hash_bytes(h, &updates.scheduled, sizeof(updates.scheduled));
+}